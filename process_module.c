@@ -8,25 +8,80 @@
 #include<linux/slab.h>
 #include<linux/uaccess.h>
 #include<linux/string.h>
+#include<linux/seq_file.h>
+#include<linux/mutex.h>
+#include<linux/sched.h>
+#include<linux/sched/signal.h>
+#include<linux/sched/task.h>
+#include<linux/rcupdate.h>
+#include<linux/pid.h>
+#include<linux/threads.h>
+#include<linux/mm.h>
+#include<linux/tracepoint.h>
+#include<linux/binfmts.h>
+#include<linux/poll.h>
+#include<linux/wait.h>
+#include<linux/spinlock.h>
+#include<linux/ktime.h>
+
+#include "process_module.h"
 
 
 //Size macro
 #define DATA_SIZE 512
 
-//Global pointer to memory region
-static char *dataPtr;
+//Records are kept in page sized chunks so that a big tree never needs one large allocation
+#define RECORDS_PER_CHUNK ((PAGE_SIZE - sizeof(struct list_head) - sizeof(int)) / sizeof(struct pst_record))
 
-//Initial values for the first and second command.
-int PID = 1;
-char *option = "-x";
-struct pid *pid;
-struct task_struct *task;
-char *token;
+struct pst_chunk {
+	struct list_head list;
+	int count;
+	struct pst_record records[RECORDS_PER_CHUNK];
+};
+
+//Records of a traversal, the chunks are reserved before the processes are walked under RCU
+struct pst_records {
+	struct list_head chunks;
+	struct pst_chunk *fill; // chunk the next record goes to
+	u32 total;
+};
+
+//dfs and bfs, shared with the userspace benchmark in pst_bench.c
+#include "pst_traverse.h"
+
+//Exits a session remembers so that threads leaving together report their process once
+#define PST_EXIT_SLOTS 16
+
+//State of one open of /dev/process_device, kept in the seq_file so that every process gets its own
+struct pst_session {
+	struct mutex lock;		// serializes write, ioctl and read on this open
+	struct pst_records result;	// last traversal, read back through read() or PST_IOC_QUERY
+	u32 capacity;			// processes the buffers are sized for, doubled whenever they do not fit
+	struct pst_chunk *cursor;	// chunk of the record read last, NULL after a traversal
+	loff_t cursor_pos;		// position of the first record of cursor
+
+	//Watch mode, set up by PST_IOC_WATCH
+	pid_t watch_root;		// tgid of the watched root, 0 when not watching
+	spinlock_t events_lock;		// protects the ring, taken by the tracepoint probes
+	struct pst_event *events;	// ring of PST_EVENT_RING events
+	u32 head, tail;
+	u32 lost;			// events dropped since the last one queued
+	wait_queue_head_t wait;
+	struct {			// processes whose exit was queued last, under events_lock
+		struct signal_struct *signal;
+		pid_t tgid;
+	} exited[PST_EXIT_SLOTS];
+	u32 exited_next;
+};
+
+//Initial capacity of a session
+#define PST_INITIAL_CAPACITY 1024
 
+//Events a watching session buffers before it starts dropping them
+#define PST_EVENT_RING 1024
 
-//Getting input from the command line.
-module_param(PID, int, 0);
-module_param(option, charp, 0);
+//Tracepoints of the watch mode, looked up when the module is loaded
+static struct tracepoint *pst_tp_fork, *pst_tp_exec, *pst_tp_exit;
 
 
 dev_t dev = 0;
@@ -39,159 +94,774 @@ static void __exit process_driver_exit(void);
 static int pst_open(struct inode *inode, struct file *file);
 static int pst_release(struct inode *inode, struct file *file);
 static ssize_t pst_write(struct file *filp, const char *buf, size_t len, loff_t *off);
-void dfs(struct task_struct *task);
-void bfs(struct task_struct *task);
+static ssize_t pst_read(struct file *file, char __user *buf, size_t len, loff_t *off);
+static __poll_t pst_poll(struct file *file, poll_table *wait);
+static long pst_ioctl(struct file *file, unsigned int cmd, unsigned long arg);
 
 static struct file_operations fops = 
 {
 	.owner	= THIS_MODULE,
 	.write	= pst_write,
+	.unlocked_ioctl = pst_ioctl,
+	.read	= pst_read,
+	.poll	= pst_poll,
+	.llseek	= seq_lseek,
 	.open	= pst_open,
 	.release = pst_release, 
 };
 
-static int pst_open(struct inode *inode, struct file * file)
-{	
+/* Frees the records of a traversal
+ * @param records
+ * */
+static void pst_free_records(struct pst_records *records)
+{
+	struct pst_chunk *chunk, *next;
 
-	//ALlocating a single block memory
-	dataPtr = kzalloc(DATA_SIZE, GFP_KERNEL);
-	
-	//Error checking
-	if(!dataPtr) {
-	printk(KERN_INFO "Could not allocate memory!\n");
+	list_for_each_entry_safe(chunk, next, &records->chunks, list) {
+		list_del(&chunk->list);
+		kfree(chunk);
 	}
+	records->fill = NULL;
+	records->total = 0;
+}
+
+/* Allocates empty chunks for count records, nothing is allocated while the tree is walked
+ * @param records
+ * @param count
+ * */
+static int pst_reserve_records(struct pst_records *records, u32 count)
+{
+	struct pst_chunk *chunk;
+
+	pst_free_records(records);
+	while(count > 0) {
+		chunk = kmalloc(sizeof(struct pst_chunk), GFP_KERNEL);
+		if(!chunk) {
+			printk(KERN_INFO "Could not allocate memory!\n");
+			pst_free_records(records);
+			return -ENOMEM;
+		}
+		chunk->count = 0;
+		list_add_tail(&chunk->list, &records->chunks);
+		count -= min_t(u32, count, RECORDS_PER_CHUNK);
+	}
+	records->fill = list_first_entry_or_null(&records->chunks, struct pst_chunk, list);
 	return 0;
 }
 
-static int pst_release(struct inode *inode, struct file *file)
+/* Frees the chunks that were reserved but not filled
+ * @param records
+ * */
+static void pst_trim_records(struct pst_records *records)
+{
+	struct pst_chunk *chunk, *next;
+
+	list_for_each_entry_safe(chunk, next, &records->chunks, list) {
+		if(chunk->count == 0) {
+			list_del(&chunk->list);
+			kfree(chunk);
+		}
+	}
+	records->fill = NULL;
+}
+
+/* Fills the resource fields of a record, called under rcu_read_lock.
+ * CPU times are the raw per-thread counters plus those of the exited threads.
+ * @param record
+ * @param task_struct
+ * */
+static void pst_fill_usage(struct pst_record *record, struct task_struct *task)
+{
+	struct task_struct *thread;
+
+	task_lock(task);
+	if(task->mm)
+		record->rss = get_mm_rss(task->mm) << PAGE_SHIFT;
+	task_unlock(task);
+
+	record->utime = task->signal->utime;
+	record->stime = task->signal->stime;
+	for_each_thread(task, thread) {
+		record->utime += thread->utime;
+		record->stime += thread->stime;
+	}
+	record->threads = get_nr_threads(task);
+
+	record->subtree_tasks = 1;
+	record->subtree_rss = record->rss;
+	record->subtree_utime = record->utime;
+	record->subtree_stime = record->stime;
+	record->subtree_threads = record->threads;
+}
+
+/* Appends a task to the reserved chunks, called under rcu_read_lock
+ * @param records
+ * @param task_struct
+ * @param ppid pid of the task it was reached from
+ * @param depth
+ * @param flags PST_FLAG_*
+ * */
+static int pst_add_record(struct pst_records *records, struct task_struct *task, pid_t ppid, u32 depth, u32 flags)
 {
-	//Freeing the allocated memory region
-	kfree(dataPtr);
+	struct pst_chunk *chunk = records->fill;
+	struct pst_record *record;
+
+	if(chunk && chunk->count == RECORDS_PER_CHUNK) {
+		chunk = list_is_last(&chunk->list, &records->chunks) ? NULL : list_next_entry(chunk, list);
+		records->fill = chunk;
+	}
+	if(chunk == NULL)
+		return -ENOSPC;
+
+	record = &chunk->records[chunk->count++];
+	memset(record, 0, sizeof(struct pst_record));
+	record->pid = task->pid;
+	record->ppid = ppid;
+	record->depth = depth;
+	record->state = task_state_to_char(task);
+	strncpy(record->comm, task->comm, PST_COMM_LEN);
+	record->comm[PST_COMM_LEN - 1] = 0;
+	if(flags & PST_FLAG_USAGE)
+		pst_fill_usage(record, task);
+	records->total++;
 	return 0;
 }
 
+/* Adds every record's subtree totals to its parent, the records must be in dfs order.
+ * Walking backwards, the finished subtrees of depth d + 1 are summed in sums[d + 1]
+ * until their parent at depth d is reached.
+ * @param records
+ * */
+static int pst_rollup(struct pst_records *records)
+{
+	struct pst_record *sums, *record;
+	struct pst_chunk *chunk;
+	u32 depth;
+	int i;
+
+	sums = kvcalloc(records->total + 1, sizeof(struct pst_record), GFP_KERNEL);
+	if(!sums)
+		return -ENOMEM;
+
+	list_for_each_entry_reverse(chunk, &records->chunks, list) {
+		for(i = chunk->count - 1; i >= 0; i--) {
+			record = &chunk->records[i];
+			depth = record->depth;
+
+			//depth is below total, so sums[depth + 1] is in bounds
+			record->subtree_tasks += sums[depth + 1].subtree_tasks;
+			record->subtree_rss += sums[depth + 1].subtree_rss;
+			record->subtree_utime += sums[depth + 1].subtree_utime;
+			record->subtree_stime += sums[depth + 1].subtree_stime;
+			record->subtree_threads += sums[depth + 1].subtree_threads;
+			memset(&sums[depth + 1], 0, sizeof(struct pst_record));
+
+			sums[depth].subtree_tasks += record->subtree_tasks;
+			sums[depth].subtree_rss += record->subtree_rss;
+			sums[depth].subtree_utime += record->subtree_utime;
+			sums[depth].subtree_stime += record->subtree_stime;
+			sums[depth].subtree_threads += record->subtree_threads;
+		}
+	}
+	kvfree(sums);
+	return 0;
+}
 
-static ssize_t pst_write(struct file *filp,const char __user *buf, size_t len, loff_t* off)
+/* Returns the record at a position of the output.
+ * Reads go forward, so the walk starts from the chunk of the last record found rather than
+ * from the first chunk, which kept a whole read quadratic in the number of chunks.
+ * @param session
+ * @param pos
+ * */
+static struct pst_record *pst_find_record(struct pst_session *session, loff_t pos)
 {
+	struct list_head *chunks = &session->result.chunks;
+	struct pst_chunk *chunk = session->cursor;
+	loff_t first = session->cursor_pos;
 
-	//Copying content of the memory region from user to kernelş
-	//Whenever user writes something that means s/he wants to run pstraverse
-	//Resolve inputs and call pstraverse functions according to inputs
-	if(copy_from_user(dataPtr,buf,len) != 0) {
-		printk(KERN_INFO "Copying from user to kernel failed!\n");
+	if(!chunk || pos < first) {
+		chunk = list_first_entry_or_null(chunks, struct pst_chunk, list);
+		first = 0;
+	}
+	while(chunk) {
+		if(pos < first + chunk->count) {
+			session->cursor = chunk;
+			session->cursor_pos = first;
+			return &chunk->records[pos - first];
+		}
+		first += chunk->count;
+		chunk = list_is_last(&chunk->list, chunks) ? NULL : list_next_entry(chunk, list);
 	}
+	return NULL;
+}
 
-	token = strsep(&dataPtr, " ");
+//seq_file iterator, the output is streamed one page at a time
+static void *pst_seq_start(struct seq_file *m, loff_t *pos)
+{
+	struct pst_session *session = m->private;
 
-	if ((kstrtoint(token,10,&PID)))
-		printk("Could not convert string to long int\n");
+	mutex_lock(&session->lock);
+	return pst_find_record(session, *pos);
+}
 
-	token = strsep(&dataPtr, " ");	
-	option = token;
-	
+static void *pst_seq_next(struct seq_file *m, void *v, loff_t *pos)
+{
+	(*pos)++;
+	return pst_find_record(m->private, *pos);
+}
 
-	printk("PID: %d Option: %s",PID,option);
-	pid = find_get_pid(PID);
-	task = pid_task(pid, PIDTYPE_PID);
+static void pst_seq_stop(struct seq_file *m, void *v)
+{
+	struct pst_session *session = m->private;
 
-	printk(KERN_INFO "PID: %d Executable: %s\n", task->pid, task->comm);
+	mutex_unlock(&session->lock);
+}
 
-	if(task == NULL) {
-		printk("Could not find any process with process id: %d\n",PID);
-		return 1;
-	}
+static int pst_seq_show(struct seq_file *m, void *v)
+{
+	struct pst_record *record = v;
 
-	if(strcmp(option, "-d") == 0) {
+	seq_printf(m, "PID: %d Executable: %s\n", record->pid, record->comm);
+	return 0;
+}
 
-		dfs(task);
-	}
-	else if (strcmp(option, "-b") == 0) {
+static const struct seq_operations pst_seq_ops = {
+	.start	= pst_seq_start,
+	.next	= pst_seq_next,
+	.stop	= pst_seq_stop,
+	.show	= pst_seq_show,
+};
 
-		bfs(task);
-	}
-	else {
-		dfs(task);
+/* Checks whether a task belongs to the watched root or to a process below it
+ * @param task_struct
+ * @param root tgid of the watched root
+ * */
+static bool pst_is_watched(struct task_struct *task, pid_t root)
+{
+	struct task_struct *parent;
+	bool found = false;
+
+	rcu_read_lock();
+	while(1) {
+		if(task->tgid == root) {
+			found = true;
+			break;
+		}
+		parent = rcu_dereference(task->real_parent);
+		if(parent == task) // init_task is its own parent
+			break;
+		task = parent;
 	}
-	
-	return len;
+	rcu_read_unlock();
+	return found;
 }
 
-/* Prints the process tree using dfs with ids and executable names
+/* Queues an event for the reader of a watching session, drops it if the ring is full.
+ * Called from the tracepoint probes so it must not sleep.
+ * @param session
+ * @param type PST_EVENT_*
  * @param task_struct
+ * @param ppid
  * */
-void dfs(struct task_struct *task) {
+static void pst_push_event(struct pst_session *session, u32 type, struct task_struct *task, pid_t ppid)
+{
+	struct pst_event *event;
+	unsigned long irqflags;
+
+	spin_lock_irqsave(&session->events_lock, irqflags);
+	if(session->tail - session->head == PST_EVENT_RING) {
+		session->lost++;
+		spin_unlock_irqrestore(&session->events_lock, irqflags);
+		return;
+	}
+	event = &session->events[session->tail % PST_EVENT_RING];
+	event->type = type;
+	event->pid = task->tgid;
+	event->ppid = ppid;
+	event->lost = session->lost;
+	event->time_ns = ktime_get_ns();
+	strncpy(event->comm, task->comm, PST_COMM_LEN);
+	event->comm[PST_COMM_LEN - 1] = 0;
+	session->lost = 0;
+	WRITE_ONCE(session->tail, session->tail + 1);
+	spin_unlock_irqrestore(&session->events_lock, irqflags);
+
+	wake_up_interruptible(&session->wait);
+}
 
-	struct task_struct *task_next;
-	struct list_head *list;
+//Probe of sched_process_fork, new threads belong to an existing process and are not reported
+static void pst_probe_fork(void *data, struct task_struct *parent, struct task_struct *child)
+{
+	struct pst_session *session = data;
 
+	if(!thread_group_leader(child))
+		return;
+	if(pst_is_watched(parent, READ_ONCE(session->watch_root)))
+		pst_push_event(session, PST_EVENT_FORK, child, parent->tgid);
+}
 
-	list_for_each(list, &task->children) {
+//Probe of sched_process_exec
+static void pst_probe_exec(void *data, struct task_struct *task, pid_t old_pid, struct linux_binprm *bprm)
+{
+	struct pst_session *session = data;
 
-		task_next = list_entry(list, struct task_struct, sibling);
-    		printk(KERN_INFO "PID: %d Executable: %s\n", task_next->pid, task_next->comm);
-		dfs(task_next);
-	}
+	if(pst_is_watched(task, READ_ONCE(session->watch_root)))
+		pst_push_event(session, PST_EVENT_EXEC, task, task_ppid_nr(task));
 }
 
-/* Prints the process tree using bfs with ids and executable names
+/* Claims the exit of a process for one of its threads. Every thread that exits after live
+ * dropped to 0 sees it at 0, the first one to get here reports the exit and the others do not.
+ * The signal_struct is held by each exiting thread so it is not reused while they run the probe,
+ * the tgid is compared too since a later process may get the memory of a remembered one.
+ * @param session
  * @param task_struct
  * */
-void bfs(struct task_struct *task) {
+static bool pst_claim_exit(struct pst_session *session, struct task_struct *task)
+{
+	struct signal_struct *signal = task->signal;
+	unsigned long irqflags;
+	bool claimed = true;
+	int i;
+
+	spin_lock_irqsave(&session->events_lock, irqflags);
+	for(i = 0; i < PST_EXIT_SLOTS; i++)
+		if(session->exited[i].signal == signal && session->exited[i].tgid == task->tgid)
+			claimed = false;
+	if(claimed) {
+		i = session->exited_next++ % PST_EXIT_SLOTS;
+		session->exited[i].signal = signal;
+		session->exited[i].tgid = task->tgid;
+	}
+	spin_unlock_irqrestore(&session->events_lock, irqflags);
+	return claimed;
+}
+
+//Probe of sched_process_exit, runs for every thread and the process is gone once the last one exits
+static void pst_probe_exit(void *data, struct task_struct *task)
+{
+	struct pst_session *session = data;
+
+	if(atomic_read(&task->signal->live) != 0)
+		return;
+	if(pst_is_watched(task, READ_ONCE(session->watch_root)) && pst_claim_exit(session, task))
+		pst_push_event(session, PST_EVENT_EXIT, task, task_ppid_nr(task));
+}
+
+static struct {
+	struct tracepoint **tracepoint;
+	void *probe;
+} pst_probes[] = {
+	{ &pst_tp_fork, pst_probe_fork },
+	{ &pst_tp_exec, pst_probe_exec },
+	{ &pst_tp_exit, pst_probe_exit },
+};
+
+static void pst_find_tracepoint(struct tracepoint *tp, void *priv)
+{
+	if(strcmp(tp->name, "sched_process_fork") == 0)
+		pst_tp_fork = tp;
+	else if(strcmp(tp->name, "sched_process_exec") == 0)
+		pst_tp_exec = tp;
+	else if(strcmp(tp->name, "sched_process_exit") == 0)
+		pst_tp_exit = tp;
+}
+
+/* Stops the watch mode of a session, the probes are gone when this returns.
+ * Called with session->lock held or from release.
+ * @param session
+ * */
+static void pst_watch_stop(struct pst_session *session)
+{
+	int i;
+
+	if(!session->watch_root)
+		return;
+	for(i = 0; i < ARRAY_SIZE(pst_probes); i++)
+		tracepoint_probe_unregister(*pst_probes[i].tracepoint, pst_probes[i].probe, session);
+	tracepoint_synchronize_unregister();
+	WRITE_ONCE(session->watch_root, 0);
+	wake_up_interruptible(&session->wait);
+}
 
-	struct task_struct *task_next;
-	struct list_head *list;
-	struct list_head *list1;
-	struct task_struct *task_next1;
+/* Starts watching the processes under a pid, or moves an existing watch to it.
+ * Called with session->lock held.
+ * @param session
+ * @param root_pid
+ * */
+static int pst_watch_start(struct pst_session *session, int root_pid)
+{
+	struct task_struct *task;
+	pid_t root = 0, watching = session->watch_root;
+	int i, r;
+
+	if(!pst_tp_fork || !pst_tp_exec || !pst_tp_exit)
+		return -EOPNOTSUPP;
+
+	rcu_read_lock();
+	task = pid_task(find_vpid(root_pid), PIDTYPE_PID);
+	if(task)
+		root = task->tgid;
+	rcu_read_unlock();
+	if(!root)
+		return -ESRCH;
+
+	if(!session->events) {
+		session->events = kvmalloc_array(PST_EVENT_RING, sizeof(struct pst_event), GFP_KERNEL);
+		if(!session->events)
+			return -ENOMEM;
+	}
+	spin_lock_irq(&session->events_lock);
+	session->head = session->tail = session->lost = 0;
+	spin_unlock_irq(&session->events_lock);
+
+	WRITE_ONCE(session->watch_root, root);
+	if(watching)
+		return 0;
+
+	for(i = 0; i < ARRAY_SIZE(pst_probes); i++) {
+		r = tracepoint_probe_register(*pst_probes[i].tracepoint, pst_probes[i].probe, session);
+		if(r) {
+			while(i--)
+				tracepoint_probe_unregister(*pst_probes[i].tracepoint, pst_probes[i].probe, session);
+			tracepoint_synchronize_unregister();
+			WRITE_ONCE(session->watch_root, 0);
+			return r;
+		}
+	}
+	return 0;
+}
 
-		
-	list_for_each(list, &task->children) {
-			
-		task_next = list_entry(list, struct task_struct, sibling);
-		printk(KERN_INFO "PID: %d Executable: %s\n", task_next->pid, task_next->comm);
+//Session of an open device file
+static inline struct pst_session *pst_session_of(struct file *file)
+{
+	return ((struct seq_file *)file->private_data)->private;
+}
+
+static int pst_open(struct inode *inode, struct file * file)
+{	
+	struct pst_session *session;
+	int r;
 
+	session = kzalloc(sizeof(struct pst_session), GFP_KERNEL);
+	if(!session) {
+		printk(KERN_INFO "Could not allocate memory!\n");
+		return -ENOMEM;
 	}
-	list_for_each(list1, &task->children) {	
-		
-		task_next1 = list_entry(list1, struct task_struct, sibling);
-		bfs(task_next1);
-		
+	mutex_init(&session->lock);
+	INIT_LIST_HEAD(&session->result.chunks);
+	session->capacity = PST_INITIAL_CAPACITY;
+	spin_lock_init(&session->events_lock);
+	init_waitqueue_head(&session->wait);
+
+	r = seq_open(file, &pst_seq_ops);
+	if(r) {
+		kfree(session);
+		return r;
 	}
-	
+	((struct seq_file *)file->private_data)->private = session;
+	return 0;
 }
 
-static int __init process_driver_init(void)
+static int pst_release(struct inode *inode, struct file *file)
 {
-	
-	if((alloc_chrdev_region(&dev, 0, 1, "pst_Dev")) < 0) {
-		printk(KERN_INFO"Cannot allocate the major number...\n");
+	struct pst_session *session = pst_session_of(file);
+
+	pst_watch_stop(session);
+	kvfree(session->events);
+	pst_free_records(&session->result);
+	mutex_destroy(&session->lock);
+	kfree(session);
+	return seq_release(inode, file);
+}
+
+//Whether a read of a watching session would not block
+static bool pst_events_ready(struct pst_session *session)
+{
+	return READ_ONCE(session->head) != READ_ONCE(session->tail) || !READ_ONCE(session->watch_root);
+}
+
+/* Returns the text of the last traversal, or struct pst_event records once PST_IOC_WATCH was issued.
+ * Events are only returned whole, a read blocks until one is queued unless O_NONBLOCK is set.
+ * */
+static ssize_t pst_read(struct file *file, char __user *buf, size_t len, loff_t *off)
+{
+	struct pst_session *session = pst_session_of(file);
+	struct pst_event event;
+	size_t copied = 0;
+	int r;
+
+	if(!READ_ONCE(session->watch_root))
+		return seq_read(file, buf, len, off);
+	if(len < sizeof(struct pst_event))
+		return -EINVAL;
+
+	if(file->f_flags & O_NONBLOCK) {
+		if(!pst_events_ready(session))
+			return -EAGAIN;
+	}
+	else {
+		r = wait_event_interruptible(session->wait, pst_events_ready(session));
+		if(r)
+			return r;
 	}
 
-	printk(KERN_INFO "Initializing pstraverse module.\n");
-	printk("PID: %d options: %s\n", PID, option);	
+	while(copied + sizeof(struct pst_event) <= len) {
+		spin_lock_irq(&session->events_lock);
+		if(session->head == session->tail) {
+			spin_unlock_irq(&session->events_lock);
+			break;
+		}
+		event = session->events[session->head % PST_EVENT_RING];
+		WRITE_ONCE(session->head, session->head + 1);
+		spin_unlock_irq(&session->events_lock);
+
+		if(copy_to_user(buf + copied, &event, sizeof(struct pst_event)))
+			return copied ? copied : -EFAULT;
+		copied += sizeof(struct pst_event);
+	}
+	return copied;
+}
+
+static __poll_t pst_poll(struct file *file, poll_table *wait)
+{
+	struct pst_session *session = pst_session_of(file);
 
-	pid = find_get_pid(PID);
-	task = pid_task(pid, PIDTYPE_PID);
+	poll_wait(file, &session->wait, wait);
+	if(pst_events_ready(session))
+		return EPOLLIN | EPOLLRDNORM;
+	return 0;
+}
 
-	printk(KERN_INFO "PID: %d Executable: %s\n", task->pid, task->comm);
 
-	if(task == NULL) {
-		printk("Could not find any process with process id: %d\n",PID);
-		return 1;
+/* Frees the buffers of a snapshot and the walk over it
+ * @param snapshot
+ * @param frames
+ * */
+static void pst_free_snapshot(struct pst_snapshot *snapshot, struct pst_frame *frames)
+{
+	kvfree(snapshot->nodes);
+	kvfree(snapshot->slots);
+	kvfree(frames);
+}
+
+/* Runs a traversal from the task with the given pid into the records of the session.
+ * Under RCU the process list is copied into a snapshot and the walk is iterative over it
+ * with a preallocated stack or queue. If the processes do not fit the buffers are doubled
+ * and the walk is retried.
+ * Called with session->lock held.
+ * @param session
+ * @param root_pid
+ * @param mode PST_MODE_DFS or PST_MODE_BFS
+ * @param max_depth 0 for no limit
+ * @param flags PST_FLAG_*, PST_FLAG_USAGE needs PST_MODE_DFS
+ * */
+static int pst_traverse(struct pst_session *session, int root_pid, u32 mode, u32 max_depth, u32 flags)
+{
+	struct pst_records *records = &session->result;
+	struct pst_snapshot snapshot;
+	struct pst_frame *frames;
+	struct task_struct *task;
+	u32 capacity, root;
+	int r;
+
+	//The chunks the cursor points into are about to be freed
+	session->cursor = NULL;
+	while(1) {
+		capacity = session->capacity;
+		snapshot.capacity = capacity;
+		snapshot.nodes = kvmalloc_array(capacity, sizeof(struct pst_node), GFP_KERNEL);
+		snapshot.slots = kvmalloc_array(2 * capacity, sizeof(u32), GFP_KERNEL);
+		frames = kvmalloc_array(capacity, sizeof(struct pst_frame), GFP_KERNEL);
+		if(!snapshot.nodes || !snapshot.slots || !frames) {
+			pst_free_snapshot(&snapshot, frames);
+			return -ENOMEM;
+		}
+		r = pst_reserve_records(records, capacity);
+		if(r) {
+			pst_free_snapshot(&snapshot, frames);
+			return r;
+		}
+
+		rcu_read_lock();
+		task = pid_task(find_vpid(root_pid), PIDTYPE_PID);
+
+		if(task == NULL) {
+			r = -ESRCH;
+		}
+		else if((r = pst_snapshot(&snapshot)) == 0) {
+
+			//A thread id stands for its process, as in the snapshot
+			root = pst_find_node(&snapshot, task->tgid);
+			if(root == PST_NONE)
+				r = -ESRCH;
+			else if(mode == PST_MODE_BFS)
+				r = bfs(&snapshot, root, frames, max_depth, flags, records);
+			else
+				r = dfs(&snapshot, root, frames, max_depth, flags, records);
+		}
+		rcu_read_unlock();
+		pst_free_snapshot(&snapshot, frames);
+
+		if(r != -ENOSPC)
+			break;
+		if(capacity >= PID_MAX_LIMIT)
+			break;
+		session->capacity = capacity * 2;
 	}
 
-	if(strcmp(option, "-d") == 0) {
+	if(r == 0 && (flags & PST_FLAG_USAGE))
+		r = pst_rollup(records);
+	if(r)
+		pst_free_records(records);
+	else
+		pst_trim_records(records);
+	return r;
+}
 
-		dfs(task);
+static ssize_t pst_write(struct file *filp,const char __user *buf, size_t len, loff_t* off)
+{
+	struct seq_file *m = filp->private_data;
+	struct pst_session *session = m->private;
+	char data[DATA_SIZE];
+	char *cursor = data;
+	char *token, *option;
+	int pid, r;
+
+	//Copying content of the memory region from user to kernel
+	//Whenever user writes something that means s/he wants to run pstraverse
+	//Resolve inputs and run the traversal, the result is read back from the device
+	if(len >= DATA_SIZE)
+		return -EINVAL;
+	if(copy_from_user(data,buf,len) != 0) {
+		printk(KERN_INFO "Copying from user to kernel failed!\n");
+		return -EFAULT;
 	}
-	else if (strcmp(option, "-b") == 0) {
+	data[len] = 0;
+
+	token = strsep(&cursor, " ");
 
-		bfs(task);
+	if ((kstrtoint(token,10,&pid))) {
+		printk("Could not convert string to long int\n");
+		return -EINVAL;
 	}
-	else {
-		dfs(task);
+
+	token = strsep(&cursor, " ");	
+	option = token ? token : "-x";
+
+	//The seq_file lock is taken first, in the order read takes both, so that resetting its
+	//position below cannot race with a read
+	mutex_lock(&m->lock);
+	mutex_lock(&session->lock);
+	r = pst_traverse(session, pid, strcmp(option, "-b") == 0 ? PST_MODE_BFS : PST_MODE_DFS, 0, 0);
+	mutex_unlock(&session->lock);
+	if(!r) {
+		//The next read starts from the first record of the new result
+		m->index = 0;
+		m->count = 0;
+		m->from = 0;
+		*off = 0;
+	}
+	mutex_unlock(&m->lock);
+	
+	return r ? r : len;
+}
+
+/* Answers PST_IOC_QUERY, the whole subtree is returned in one call as fixed layout records
+ * */
+static long pst_ioctl_query(struct pst_session *session, unsigned long arg)
+{
+	struct pst_query query;
+	struct pst_record __user *records;
+	struct pst_chunk *chunk;
+	int r;
+
+	if(copy_from_user(&query, (void __user *)arg, sizeof(query)))
+		return -EFAULT;
+	if(query.version != PST_ABI_VERSION)
+		return -EPROTO;
+	if((query.flags & ~PST_FLAG_USAGE) || query.mode > PST_MODE_BFS)
+		return -EINVAL;
+	if((query.flags & PST_FLAG_USAGE) && query.mode != PST_MODE_DFS)
+		return -EINVAL;
+
+	mutex_lock(&session->lock);
+	r = pst_traverse(session, query.root_pid, query.mode, query.max_depth, query.flags);
+	if(r) {
+		mutex_unlock(&session->lock);
+		return r;
 	}
 
+	//Copying as many records as fit, total tells the caller how big the buffer should be
+	records = u64_to_user_ptr(query.records);
+	query.count = 0;
+	query.total = session->result.total;
+	list_for_each_entry(chunk, &session->result.chunks, list) {
+		u32 n = min_t(u32, chunk->count, query.capacity - query.count);
+
+		if(query.count == query.capacity)
+			break;
+		if(copy_to_user(records + query.count, chunk->records, n * sizeof(struct pst_record))) {
+			mutex_unlock(&session->lock);
+			return -EFAULT;
+		}
+		query.count += n;
+	}
+	mutex_unlock(&session->lock);
+
+	if(copy_to_user((void __user *)arg, &query, sizeof(query)))
+		return -EFAULT;
+	return 0;
+}
+
+/* Answers PST_IOC_WATCH, events are then read from the same file
+ * */
+static long pst_ioctl_watch(struct pst_session *session, unsigned long arg)
+{
+	struct pst_watch watch;
+	int r = 0;
+
+	if(copy_from_user(&watch, (void __user *)arg, sizeof(watch)))
+		return -EFAULT;
+	if(watch.version != PST_ABI_VERSION)
+		return -EPROTO;
+	if(watch.flags != 0)
+		return -EINVAL;
+
+	mutex_lock(&session->lock);
+	if(watch.root_pid == 0)
+		pst_watch_stop(session);
+	else
+		r = pst_watch_start(session, watch.root_pid);
+	mutex_unlock(&session->lock);
+	return r;
+}
+
+static long pst_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
+{
+	struct pst_session *session = pst_session_of(file);
+
+	switch(cmd) {
+	case PST_IOC_QUERY:
+		return pst_ioctl_query(session, arg);
+	case PST_IOC_WATCH:
+		return pst_ioctl_watch(session, arg);
+	}
+	return -ENOTTY;
+}
+
+static int __init process_driver_init(void)
+{
 	
+	if((alloc_chrdev_region(&dev, 0, 1, "pst_Dev")) < 0) {
+		printk(KERN_INFO"Cannot allocate the major number...\n");
+	}
+
+	printk(KERN_INFO "Initializing pstraverse module.\n");
+
+	for_each_kernel_tracepoint(pst_find_tracepoint, NULL);
+	if(!pst_tp_fork || !pst_tp_exec || !pst_tp_exit)
+		printk(KERN_INFO "sched_process tracepoints not found, watch mode is disabled.\n");
+
 	cdev_init(&pst_cdev, &fops);
 
 
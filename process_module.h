@@ -0,0 +1,81 @@
+//Binary query interface of process_module, shared by the module and shellfyre
+#ifndef PROCESS_MODULE_H
+#define PROCESS_MODULE_H
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+//Bumped whenever pst_query or pst_record change layout
+#define PST_ABI_VERSION 2
+
+#define PST_COMM_LEN 16
+
+//Traversal orders
+#define PST_MODE_DFS 0
+#define PST_MODE_BFS 1
+
+//Query flags
+#define PST_FLAG_USAGE (1 << 0) // fill the resource fields and the subtree totals, dfs only
+
+//Request of PST_IOC_QUERY, the records of the subtree are copied to the records buffer
+struct pst_query {
+	__u32 version;	 // PST_ABI_VERSION
+	__s32 root_pid;
+	__u32 mode;	 // PST_MODE_*
+	__u32 max_depth; // 0 for no limit, the root is at depth 0
+	__u32 flags;	 // PST_FLAG_*
+	__u32 capacity;	 // number of records that fit in the buffer
+	__u64 records;	 // user pointer to struct pst_record[capacity]
+	__u32 count;	 // out: records copied
+	__u32 total;	 // out: tasks found, may be larger than capacity
+};
+
+//One task of the subtree, in traversal order
+//The resource fields are only filled with PST_FLAG_USAGE, the subtree totals include the task itself
+struct pst_record {
+	__s32 pid;
+	__s32 ppid;
+	__u32 depth;
+	__u32 state; // state letter as in /proc/<pid>/stat
+	char comm[PST_COMM_LEN];
+	__u32 threads;
+	__u32 subtree_tasks;
+	__u64 rss;   // bytes
+	__u64 utime; // nanoseconds, all threads of the process
+	__u64 stime;
+	__u64 subtree_rss;
+	__u64 subtree_utime;
+	__u64 subtree_stime;
+	__u32 subtree_threads;
+	__u32 reserved;
+};
+
+//Request of PST_IOC_WATCH, afterwards read() on the same file returns struct pst_event
+//records for the descendants of root_pid and poll() reports when some are ready
+struct pst_watch {
+	__u32 version;	// PST_ABI_VERSION
+	__s32 root_pid; // 0 stops watching
+	__u32 flags;	// reserved, must be 0
+	__u32 reserved;
+};
+
+//Event types
+#define PST_EVENT_FORK 1
+#define PST_EVENT_EXEC 2
+#define PST_EVENT_EXIT 3
+
+//One fork, exec or exit of a process under the watched root
+struct pst_event {
+	__u32 type;	 // PST_EVENT_*
+	__s32 pid;
+	__s32 ppid;
+	__u32 lost;	 // events dropped before this one because the reader was too slow
+	__u64 time_ns;	 // CLOCK_MONOTONIC
+	char comm[PST_COMM_LEN];
+};
+
+#define PST_IOC_MAGIC 'p'
+#define PST_IOC_QUERY _IOWR(PST_IOC_MAGIC, 1, struct pst_query)
+#define PST_IOC_WATCH _IOW(PST_IOC_MAGIC, 2, struct pst_watch)
+
+#endif
@@ -0,0 +1,334 @@
+//Benchmark for the dfs/bfs traversals of process_module, run in userspace on a mock task_struct
+//Compiled with gcc -O2 -o pst_bench pst_bench.c
+//Run with ./pst_bench [-n nodes] [-r repeats] [-s seed] [-o output.json]
+//Exits with 1 if a traversal does not return the expected order
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+
+#include "process_module.h"
+
+typedef uint32_t u32;
+
+//Mock of the kernel list_head, only what the traversals use
+struct list_head {
+	struct list_head *next, *prev;
+};
+
+#define container_of(ptr, type, member) ((type *)((char *)(ptr) - offsetof(type, member)))
+#define list_entry(ptr, type, member) container_of(ptr, type, member)
+#define list_next_entry(pos, member) list_entry((pos)->member.next, __typeof__(*(pos)), member)
+#define list_prev_entry(pos, member) list_entry((pos)->member.prev, __typeof__(*(pos)), member)
+#define list_for_each_entry(pos, head, member) \
+	for (pos = list_entry((head)->next, __typeof__(*pos), member); &pos->member != (head); pos = list_next_entry(pos, member))
+#define list_for_each_entry_reverse(pos, head, member) \
+	for (pos = list_entry((head)->prev, __typeof__(*pos), member); &pos->member != (head); pos = list_prev_entry(pos, member))
+
+static void INIT_LIST_HEAD(struct list_head *list)
+{
+	list->next = list->prev = list;
+}
+
+static void list_add_tail(struct list_head *entry, struct list_head *head)
+{
+	entry->prev = head->prev;
+	entry->next = head;
+	head->prev->next = entry;
+	head->prev = entry;
+}
+
+//Mock of task_struct, pids are the index in the tree plus one.
+//children and sibling are only followed by the order checks, the traversals use the task list
+struct task_struct {
+	pid_t pid;
+	pid_t tgid;
+	char comm[16];
+	struct task_struct *real_parent;
+	struct list_head children;
+	struct list_head sibling;
+	struct list_head tasks;
+};
+
+//Mock of the list of all processes, in the order they were created
+static struct list_head task_list;
+#define for_each_process(p) list_for_each_entry(p, &task_list, tasks)
+
+static pid_t task_ppid_nr(struct task_struct *task)
+{
+	return task->real_parent ? task->real_parent->pid : 0;
+}
+
+//Records go to one flat array instead of the page sized chunks of the module
+struct pst_records {
+	struct pst_record *records;
+	u32 total;
+	u32 capacity;
+};
+
+static int pst_add_record(struct pst_records *records, struct task_struct *task, pid_t ppid, u32 depth, u32 flags)
+{
+	struct pst_record *record;
+
+	(void)flags; // the mock tasks have no usage to add
+	if (records->total == records->capacity)
+		return -ENOSPC;
+	record = &records->records[records->total++];
+	memset(record, 0, sizeof(struct pst_record));
+	record->pid = task->pid;
+	record->ppid = ppid;
+	record->depth = depth;
+	record->state = 'S';
+	memcpy(record->comm, task->comm, PST_COMM_LEN);
+	return 0;
+}
+
+#include "pst_traverse.h"
+
+//Shapes of the synthetic trees
+enum { TREE_WIDE, TREE_DEEP, TREE_KARY, TREE_RANDOM, TREE_SHAPES };
+const char *tree_names[] = { "wide", "deep", "8-ary", "random" };
+
+long long now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/**
+ * Builds a tree of n tasks, task 0 is the root and every task is added after its parent
+ * @param tasks  n entries
+ * @param depths set to the depth of every task
+ */
+void make_tasks(struct task_struct *tasks, u32 *depths, u32 n, int shape)
+{
+	for (u32 i = 0; i < n; i++) {
+		struct task_struct *task = &tasks[i];
+		u32 parent = 0;
+
+		task->pid = task->tgid = i + 1;
+		snprintf(task->comm, sizeof(task->comm), "task_%u", i);
+		INIT_LIST_HEAD(&task->children);
+		task->real_parent = NULL;
+		if (i == 0)
+			INIT_LIST_HEAD(&task_list);
+		list_add_tail(&task->tasks, &task_list);
+		depths[i] = 0;
+		if (i == 0)
+			continue;
+
+		switch (shape) {
+		case TREE_WIDE: parent = 0; break;
+		case TREE_DEEP: parent = i - 1; break;
+		case TREE_KARY: parent = (i - 1) / 8; break;
+		case TREE_RANDOM: parent = random() % i; break;
+		}
+		task->real_parent = &tasks[parent];
+		depths[i] = depths[parent] + 1;
+		list_add_tail(&task->sibling, &tasks[parent].children);
+	}
+}
+
+/**
+ * Checks a dfs against a preorder walk that follows first child, next sibling and parent links
+ * @return 1 if the order matches
+ */
+int check_dfs(struct task_struct *tasks, u32 *depths, u32 max_depth, struct pst_records *records)
+{
+	struct task_struct *task = &tasks[0];
+	u32 i = 0;
+
+	while (1) {
+		if (i == records->total || records->records[i].pid != task->pid
+		    || records->records[i].depth != depths[task->pid - 1])
+			return 0;
+		i++;
+
+		if (!(max_depth && depths[task->pid - 1] >= max_depth) && task->children.next != &task->children) {
+			task = list_entry(task->children.next, struct task_struct, sibling);
+			continue;
+		}
+		while (task != &tasks[0] && task->sibling.next == &task->real_parent->children)
+			task = task->real_parent;
+		if (task == &tasks[0])
+			break;
+		task = list_next_entry(task, sibling);
+	}
+	return i == records->total;
+}
+
+/**
+ * Checks a bfs: depths never decrease, the children of a task come together in list order
+ * and right after the children of the task recorded before it
+ * @return 1 if the order is a level order of the whole tree
+ */
+int check_bfs(struct task_struct *tasks, u32 *depths, u32 n, u32 max_depth, struct pst_records *records)
+{
+	u32 *position = malloc(sizeof(u32) * n);
+	u32 expected = 0, last_parent = 0, ok = 1;
+	struct task_struct *previous = NULL;
+
+	for (u32 i = 0; i < n; i++)
+		if (!max_depth || depths[i] <= max_depth)
+			expected++;
+	if (records->total != expected || records->records[0].pid != 1)
+		ok = 0;
+
+	for (u32 i = 0; ok && i < records->total; i++) {
+		struct pst_record *record = &records->records[i];
+		struct task_struct *task = &tasks[record->pid - 1];
+
+		position[record->pid - 1] = i;
+		if (record->depth != depths[record->pid - 1])
+			ok = 0;
+		else if (i == 0)
+			ok = 1;
+		else if (record->depth < records->records[i - 1].depth)
+			ok = 0;
+		else if (position[record->ppid - 1] < last_parent)
+			ok = 0;
+		else if (position[record->ppid - 1] == last_parent && previous->real_parent == task->real_parent)
+			ok = list_next_entry(previous, sibling) == task;
+		else
+			ok = task->sibling.prev == &task->real_parent->children;
+
+		last_parent = i == 0 ? 0 : position[record->ppid - 1];
+		previous = task;
+	}
+	free(position);
+	return ok;
+}
+
+/**
+ * Writes the records the way the module's seq_file shows them
+ * @return bytes written
+ */
+size_t serialize(struct pst_records *records, char *buf, size_t size)
+{
+	size_t used = 0;
+
+	for (u32 i = 0; i < records->total && used < size; i++)
+		used += snprintf(buf + used, size - used, "PID: %d Executable: %s\n",
+				 records->records[i].pid, records->records[i].comm);
+	return used;
+}
+
+int main(int argc, char *argv[])
+{
+	u32 n = 200000, repeats = 10, seed = 1;
+	char *output = NULL;
+	int opt, failed = 0;
+
+	while ((opt = getopt(argc, argv, "n:r:s:o:")) != -1) {
+		switch (opt) {
+		case 'n': n = atol(optarg); break;
+		case 'r': repeats = atol(optarg); break;
+		case 's': seed = atol(optarg); break;
+		case 'o': output = optarg; break;
+		default:
+			fprintf(stderr, "Usage: %s [-n nodes] [-r repeats] [-s seed] [-o output.json]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (n < 2 || repeats < 1) {
+		fprintf(stderr, "pst_bench: nodes must be at least 2 and repeats positive\n");
+		return 1;
+	}
+
+	struct task_struct *tasks = malloc(sizeof(struct task_struct) * n);
+	u32 *depths = malloc(sizeof(u32) * n);
+	struct pst_frame *frames = malloc(sizeof(struct pst_frame) * n);
+	struct pst_snapshot snapshot = { malloc(sizeof(struct pst_node) * n), malloc(sizeof(u32) * 2 * n), n, 0 };
+	struct pst_records records = { malloc(sizeof(struct pst_record) * n), 0, n };
+	size_t text_size = (size_t)n * 64;
+	char *text = malloc(text_size);
+
+	FILE *out = stdout;
+	if (output && (out = fopen(output, "w")) == NULL) {
+		fprintf(stderr, "pst_bench: %s: %s\n", output, strerror(errno));
+		return 1;
+	}
+	srandom(seed);
+
+	fprintf(out, "{\n  \"nodes\": %u,\n  \"repeats\": %u,\n", n, repeats);
+	for (int shape = 0; shape < TREE_SHAPES; shape++) {
+		long long snapshot_ns = 0, dfs_ns = 0, bfs_ns = 0, text_ns = 0, start;
+		size_t bytes = 0;
+		u32 root;
+		int ok = 1;
+
+		make_tasks(tasks, depths, n, shape);
+
+		for (u32 r = 0; r < repeats; r++) {
+			start = now_ns();
+			ok &= pst_snapshot(&snapshot) == 0;
+			snapshot_ns += now_ns() - start;
+
+			records.total = 0;
+			start = now_ns();
+			ok &= dfs(&snapshot, 0, frames, 0, 0, &records) == 0;
+			dfs_ns += now_ns() - start;
+
+			start = now_ns();
+			bytes = serialize(&records, text, text_size);
+			text_ns += now_ns() - start;
+
+			records.total = 0;
+			start = now_ns();
+			ok &= bfs(&snapshot, 0, frames, 0, 0, &records) == 0;
+			bfs_ns += now_ns() - start;
+		}
+
+		//Order checks against the children lists, with and without a depth limit
+		root = pst_find_node(&snapshot, tasks[0].tgid);
+		ok &= root == 0 && pst_find_node(&snapshot, n + 1) == PST_NONE;
+		records.total = 0;
+		ok &= dfs(&snapshot, root, frames, 0, 0, &records) == 0 && check_dfs(tasks, depths, 0, &records);
+		records.total = 0;
+		ok &= dfs(&snapshot, root, frames, 3, 0, &records) == 0 && check_dfs(tasks, depths, 3, &records);
+		records.total = 0;
+		ok &= bfs(&snapshot, root, frames, 0, 0, &records) == 0 && check_bfs(tasks, depths, n, 0, &records);
+		records.total = 0;
+		ok &= bfs(&snapshot, root, frames, 3, 0, &records) == 0 && check_bfs(tasks, depths, n, 3, &records);
+		//More processes or a bigger tree than the buffers must be refused, not overrun
+		records.total = 0;
+		records.capacity = n / 2;
+		ok &= dfs(&snapshot, root, frames, 0, 0, &records) == -ENOSPC;
+		records.total = 0;
+		ok &= bfs(&snapshot, root, frames, 0, 0, &records) == -ENOSPC;
+		records.capacity = n;
+		snapshot.capacity = n / 2;
+		ok &= pst_snapshot(&snapshot) == -ENOSPC;
+		snapshot.capacity = n;
+
+		if (!ok) {
+			fprintf(stderr, "pst_bench: %s tree: traversal order check failed\n", tree_names[shape]);
+			failed = 1;
+		}
+		fprintf(out, "  \"%s\": {\"order_ok\": %s, \"snapshot_ns_per_task\": %.2f, \"dfs_ns_per_task\": %.2f, "
+			"\"bfs_ns_per_task\": %.2f, \"serialize_ns_per_task\": %.2f, \"serialize_mb_per_s\": %.1f}%s\n",
+			tree_names[shape], ok ? "true" : "false", (double)snapshot_ns / repeats / n,
+			(double)dfs_ns / repeats / n, (double)bfs_ns / repeats / n,
+			(double)text_ns / repeats / n, bytes / (text_ns / 1e9 / repeats) / 1e6,
+			shape == TREE_SHAPES - 1 ? "" : ",");
+	}
+	fprintf(out, "}\n");
+
+	if (out != stdout)
+		fclose(out);
+	free(tasks);
+	free(depths);
+	free(frames);
+	free(snapshot.nodes);
+	free(snapshot.slots);
+	free(records.records);
+	free(text);
+	return failed;
+}
@@ -0,0 +1,221 @@
+//Stress test for the per open sessions of process_module, needs the module loaded
+//Compiled with gcc -O2 -pthread -o pst_stress pst_stress.c
+//Run with ./pst_stress [-t threads] [-i iterations] [-p root_pid]
+//Every thread opens the device on its own and also shares one open file with the others,
+//while a churn thread keeps forking so that the process tree changes under the walks.
+//Exits with 1 if a result is inconsistent, 2 if the device cannot be opened
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "process_module.h"
+
+#define DEVICE "/dev/process_device"
+
+int iterations = 1000;
+pid_t root = 1;
+int shared_fd = -1;
+volatile int churning = 1;
+
+//Counters of one thread, summed at the end
+struct stress_t {
+	pthread_t thread;
+	long queries;
+	long reads;
+	long failures;
+};
+
+/**
+ * Queries the subtree of root and checks that the records describe it
+ * @return 0 if the result is consistent, -1 otherwise
+ */
+int check_query(int fd, uint32_t mode, uint32_t flags)
+{
+	struct pst_query query;
+	struct pst_record *records = NULL;
+	uint32_t capacity = 256;
+	int r = -1;
+
+	memset(&query, 0, sizeof(query));
+	query.version = PST_ABI_VERSION;
+	query.root_pid = root;
+	query.mode = mode;
+	query.flags = flags;
+
+	//Retried with a bigger buffer if the tree grew past it
+	while (1) {
+		records = realloc(records, sizeof(struct pst_record) * capacity);
+		query.capacity = capacity;
+		query.records = (uintptr_t)records;
+		if (ioctl(fd, PST_IOC_QUERY, &query) == -1) {
+			fprintf(stderr, "pst_stress: PST_IOC_QUERY: %s\n", strerror(errno));
+			goto out;
+		}
+		if (query.total <= query.capacity)
+			break;
+		capacity = query.total * 2;
+	}
+
+	if (query.count != query.total || query.count == 0 || records[0].depth != 0) {
+		fprintf(stderr, "pst_stress: %u records of %u, root depth %u\n", query.count, query.total,
+			query.count ? records[0].depth : 0);
+		goto out;
+	}
+	for (uint32_t i = 1; i < query.count; i++) {
+		if (records[i].depth == 0 || (mode == PST_MODE_BFS && records[i].depth < records[i - 1].depth)
+		    || (mode == PST_MODE_DFS && records[i].depth > records[i - 1].depth + 1)) {
+			fprintf(stderr, "pst_stress: record %u at depth %u after depth %u\n", i, records[i].depth, records[i - 1].depth);
+			goto out;
+		}
+	}
+	if ((flags & PST_FLAG_USAGE) && records[0].subtree_tasks != query.count) {
+		fprintf(stderr, "pst_stress: subtree of %u tasks in %u records\n", records[0].subtree_tasks, query.count);
+		goto out;
+	}
+	r = 0;
+out:
+	free(records);
+	return r;
+}
+
+/**
+ * Runs a traversal through write() and checks the text read back
+ * @return 0 if the text is well formed, -1 otherwise
+ */
+int check_read(int fd, int bfs)
+{
+	char request[32], buf[4096], line[256];
+	size_t used = 0, lines = 0;
+	ssize_t n;
+
+	snprintf(request, sizeof(request), bfs ? "%d -b" : "%d", root);
+	lseek(fd, 0, SEEK_SET);
+	if (write(fd, request, strlen(request)) == -1) {
+		fprintf(stderr, "pst_stress: write: %s\n", strerror(errno));
+		return -1;
+	}
+	while ((n = read(fd, buf, sizeof(buf))) > 0) {
+		for (ssize_t i = 0; i < n; i++) {
+			int pid;
+
+			if (buf[i] != '\n') {
+				if (used < sizeof(line) - 1)
+					line[used++] = buf[i];
+				continue;
+			}
+			line[used] = 0;
+			used = 0;
+			if (sscanf(line, "PID: %d Executable:", &pid) != 1 || (lines == 0 && pid != root)) {
+				fprintf(stderr, "pst_stress: unexpected line %s\n", line);
+				return -1;
+			}
+			lines++;
+		}
+	}
+	if (n == -1 || lines == 0) {
+		fprintf(stderr, "pst_stress: read: %s\n", n == -1 ? strerror(errno) : "no records");
+		return -1;
+	}
+	return 0;
+}
+
+void *stress_thread(void *arg)
+{
+	struct stress_t *stress = arg;
+
+	for (int i = 0; i < iterations; i++) {
+		int fd = open(DEVICE, O_RDWR);
+
+		if (fd == -1) {
+			fprintf(stderr, "pst_stress: %s: %s\n", DEVICE, strerror(errno));
+			stress->failures++;
+			continue;
+		}
+		//Each open has a session of its own, so a write and the read after it belong together
+		switch (i % 3) {
+		case 0: stress->failures += check_query(fd, PST_MODE_DFS, 0) != 0; stress->queries++; break;
+		case 1: stress->failures += check_query(fd, PST_MODE_DFS, PST_FLAG_USAGE) != 0; stress->queries++; break;
+		case 2: stress->failures += check_read(fd, i & 1) != 0; stress->reads++; break;
+		}
+		close(fd);
+
+		//The shared session is serialized by its lock, every ioctl is complete on its own
+		stress->failures += check_query(shared_fd, i & 1 ? PST_MODE_BFS : PST_MODE_DFS, 0) != 0;
+		stress->queries++;
+	}
+	return NULL;
+}
+
+//Keeps forking short lived children so that the walks race with forks and exits
+void *churn_thread(void *arg)
+{
+	long *forks = arg;
+
+	while (churning) {
+		pid_t pid = fork();
+
+		if (pid == 0)
+			_exit(0);
+		if (pid > 0) {
+			waitpid(pid, NULL, 0);
+			(*forks)++;
+		}
+	}
+	return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+	int threads = 8, opt;
+	long queries = 0, reads = 0, failures = 0, forks = 0;
+	pthread_t churn;
+
+	while ((opt = getopt(argc, argv, "t:i:p:")) != -1) {
+		switch (opt) {
+		case 't': threads = atoi(optarg); break;
+		case 'i': iterations = atoi(optarg); break;
+		case 'p': root = atoi(optarg); break;
+		default:
+			fprintf(stderr, "Usage: %s [-t threads] [-i iterations] [-p root_pid]\n", argv[0]);
+			return 2;
+		}
+	}
+	if (threads < 1 || iterations < 1) {
+		fprintf(stderr, "pst_stress: threads and iterations must be positive\n");
+		return 2;
+	}
+
+	shared_fd = open(DEVICE, O_RDWR);
+	if (shared_fd == -1) {
+		fprintf(stderr, "pst_stress: %s: %s, load process_module.ko first\n", DEVICE, strerror(errno));
+		return 2;
+	}
+
+	struct stress_t *stress = calloc(threads, sizeof(struct stress_t));
+	pthread_create(&churn, NULL, churn_thread, &forks);
+	for (int i = 0; i < threads; i++)
+		pthread_create(&stress[i].thread, NULL, stress_thread, &stress[i]);
+	for (int i = 0; i < threads; i++) {
+		pthread_join(stress[i].thread, NULL);
+		queries += stress[i].queries;
+		reads += stress[i].reads;
+		failures += stress[i].failures;
+	}
+	churning = 0;
+	pthread_join(churn, NULL);
+	close(shared_fd);
+
+	printf("{\"threads\": %d, \"iterations\": %d, \"queries\": %ld, \"reads\": %ld, \"forks\": %ld, \"failures\": %ld}\n",
+	       threads, iterations, queries, reads, forks, failures);
+	free(stress);
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,179 @@
+//Traversals of process_module, kept apart so that pst_bench.c can run them on a mock task_struct
+//The includer provides struct task_struct with tgid, for_each_process, task_ppid_nr,
+//struct pst_records and pst_add_record
+#ifndef PST_TRAVERSE_H
+#define PST_TRAVERSE_H
+
+//End of a child or sibling link, or a process that is not in the snapshot
+#define PST_NONE ((u32)-1)
+
+//A process of a snapshot, the links between the nodes are indexes into the snapshot
+struct pst_node {
+	struct task_struct *task;
+	pid_t ppid;
+	u32 child;	// first child
+	u32 last;	// last child, children are appended
+	u32 sibling;	// next child of the same parent
+};
+
+//Every process of the system with its children.
+//The children and sibling lists of task_struct change under tasklist_lock, which modules
+//cannot take, and are not safe to walk under RCU alone. The task list and real_parent are,
+//so the tree is rebuilt from them.
+struct pst_snapshot {
+	struct pst_node *nodes;	// capacity entries
+	u32 *slots;		// 2 * capacity entries, open addressing from tgid to node
+	u32 capacity;
+	u32 count;
+};
+
+//An entry of the explicit dfs stack or of the bfs queue
+struct pst_frame {
+	u32 node;
+	u32 depth;
+};
+
+static int pst_add_record(struct pst_records *records, struct task_struct *task, pid_t ppid, u32 depth, u32 flags);
+
+static inline u32 pst_slot(struct pst_snapshot *snapshot, pid_t tgid)
+{
+	return ((u32)tgid * 2654435761u) % (2 * snapshot->capacity);
+}
+
+/* Looks up the node of a process in a snapshot
+ * @param snapshot
+ * @param tgid
+ * @return index of the node, or PST_NONE
+ * */
+static u32 pst_find_node(struct pst_snapshot *snapshot, pid_t tgid)
+{
+	u32 slot = pst_slot(snapshot, tgid);
+
+	while(snapshot->slots[slot] != PST_NONE) {
+		if(snapshot->nodes[snapshot->slots[slot]].task->tgid == tgid)
+			return snapshot->slots[slot];
+		slot = (slot + 1) % (2 * snapshot->capacity);
+	}
+	return PST_NONE;
+}
+
+/* Records every process and links it to its parent, called under rcu_read_lock.
+ * Children come in task list order, which is the order they were forked in.
+ * @param snapshot nodes and slots preallocated for capacity processes
+ * @return 0, or -ENOSPC if there are more than capacity processes
+ * */
+static int pst_snapshot(struct pst_snapshot *snapshot)
+{
+	struct task_struct *task;
+	struct pst_node *parent;
+	u32 i, slot, found;
+
+	snapshot->count = 0;
+	memset(snapshot->slots, 0xff, 2 * snapshot->capacity * sizeof(u32));
+
+	for_each_process(task) {
+		if(snapshot->count == snapshot->capacity)
+			return -ENOSPC;
+		snapshot->nodes[snapshot->count] = (struct pst_node){ task, task_ppid_nr(task), PST_NONE, PST_NONE, PST_NONE };
+
+		slot = pst_slot(snapshot, task->tgid);
+		while(snapshot->slots[slot] != PST_NONE)
+			slot = (slot + 1) % (2 * snapshot->capacity);
+		snapshot->slots[slot] = snapshot->count++;
+	}
+
+	for(i = 0; i < snapshot->count; i++) {
+		found = pst_find_node(snapshot, snapshot->nodes[i].ppid);
+		//init and kthreadd have no parent in the list
+		if(found == PST_NONE || found == i)
+			continue;
+		parent = &snapshot->nodes[found];
+		if(parent->last == PST_NONE)
+			parent->child = i;
+		else
+			snapshot->nodes[parent->last].sibling = i;
+		parent->last = i;
+	}
+	return 0;
+}
+
+/* Records the process tree using dfs with ids and executable names.
+ * Iterative with an explicit stack, every node is pushed once so capacity entries are enough.
+ * @param snapshot
+ * @param root index of the root node
+ * @param stack preallocated, snapshot->capacity entries
+ * @param max_depth 0 for no limit
+ * @param flags PST_FLAG_*
+ * @param records
+ * @return 0, or -ENOSPC if the tree does not fit the records
+ * */
+static int dfs(struct pst_snapshot *snapshot, u32 root, struct pst_frame *stack, u32 max_depth, u32 flags, struct pst_records *records) {
+
+	struct pst_node *nodes = snapshot->nodes;
+	struct pst_frame frame, swap;
+	u32 top = 0, pushed = 1, child, first, last;
+
+	stack[top++] = (struct pst_frame){ root, 0 };
+
+	while(top > 0) {
+
+		frame = stack[--top];
+		if(pst_add_record(records, nodes[frame.node].task, nodes[frame.node].ppid, frame.depth, flags))
+			return -ENOSPC;
+
+		if(max_depth && frame.depth >= max_depth)
+			continue;
+
+		first = top;
+		for(child = nodes[frame.node].child; child != PST_NONE; child = nodes[child].sibling) {
+			if(pushed++ == snapshot->capacity)
+				return -ENOSPC;
+			stack[top++] = (struct pst_frame){ child, frame.depth + 1 };
+		}
+
+		//The children are reversed so that the first child is visited first
+		for(last = top; first + 1 < last; first++, last--) {
+			swap = stack[first];
+			stack[first] = stack[last - 1];
+			stack[last - 1] = swap;
+		}
+	}
+	return 0;
+}
+
+/* Records the process tree using bfs with ids and executable names, level by level.
+ * @param snapshot
+ * @param root index of the root node
+ * @param queue preallocated, snapshot->capacity entries
+ * @param max_depth 0 for no limit
+ * @param flags PST_FLAG_*
+ * @param records
+ * @return 0, or -ENOSPC if the tree does not fit the records
+ * */
+static int bfs(struct pst_snapshot *snapshot, u32 root, struct pst_frame *queue, u32 max_depth, u32 flags, struct pst_records *records) {
+
+	struct pst_node *nodes = snapshot->nodes;
+	struct pst_frame frame;
+	u32 head = 0, tail = 0, child;
+
+	queue[tail++] = (struct pst_frame){ root, 0 };
+
+	while(head < tail) {
+
+		frame = queue[head++];
+		if(pst_add_record(records, nodes[frame.node].task, nodes[frame.node].ppid, frame.depth, flags))
+			return -ENOSPC;
+
+		if(max_depth && frame.depth >= max_depth)
+			continue;
+
+		for(child = nodes[frame.node].child; child != PST_NONE; child = nodes[child].sibling) {
+			if(tail == snapshot->capacity)
+				return -ENOSPC;
+			queue[tail++] = (struct pst_frame){ child, frame.depth + 1 };
+		}
+	}
+	return 0;
+}
+
+#endif
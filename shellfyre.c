@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <unistd.h>
 #include <sys/wait.h>
 #include <stdio.h>
@@ -12,13 +13,36 @@
 #include <math.h>
 #include <fcntl.h>
 #include<sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <sys/syscall.h>
+#include <ctype.h>
+#include <stdint.h>
+#include <signal.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/inotify.h>
+#include <glob.h>
+#include <limits.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
 
+#include "process_module.h"
 
 
 
 
-//Declaration of recursive fileSearch function
+
+//Declaration of recursive fileSearch function and of the directory walk behind it
 void fileSearch(char *keyword, char *current_dir, int recursive, int open);
+typedef int (*walk_handler)(void *arg, char *path, struct dirent *entry);
+void walkDirectory(char *current_dir, int recursive, walk_handler visit, void *arg);
 
 //Declaration of cdh command helper functions
 void printCdHistory(char *cdHistory[]);
@@ -26,6 +50,9 @@ void addCdToHistory(char *cd);
 void writeToCdhFile();
 void readFromCdhFile();
 
+//Declaration of resource accounting helpers for time and stats
+void print_stats(int histograms);
+
 //Fixed sized string array (list) for keeping directory history
 char *cdHistory[10];
 //Index for reaching elements of the history list
@@ -33,9 +60,49 @@ int cdCount = 0;
 //Path to directory in which shellfyre exist
 char pathToShellfyre[512];
 
-//Flags for status of module and crontab job
+//Flags for status of module
 int module_open = 0;
-int has_crontab = 0;
+int module_tried = 0;
+
+//Exit status of the last command, consulted by && and || when walking a command list
+int last_status = 0;
+//Set in forked children (subshells, pipeline stages) so that builtins like exit skip the shell cleanup
+int in_subshell = 0;
+//Set by the exit builtin
+int exit_requested = 0;
+
+//Resource usage of a command, filled from wait4 for every stage of a pipeline
+struct usage_t
+{
+	double wall; // seconds
+	double user;
+	double sys;
+	long max_rss; // KB
+	long minflt;
+	long majflt;
+	long nvcsw;
+	long nivcsw;
+};
+
+//Number of latency buckets, bucket i counts runs of [2^i, 2^(i+1)) microseconds
+#define HISTOGRAM_SIZE 32
+
+//Session statistics of a command name, kept in a list for the stats builtin
+struct command_stats_t
+{
+	char name[64];
+	long count;
+	struct usage_t total;
+	double max_wall;
+	long histogram[HISTOGRAM_SIZE];
+	struct command_stats_t *next;
+};
+
+struct command_stats_t *command_stats = NULL;
+//Collect usage of every external command, switched with stats on/off or SHELLFYRE_ACCOUNTING=1
+int accounting = 0;
+//Summed usage of the stages of the last foreground pipeline
+struct usage_t pipeline_usage;
 
 
 const char *sysname = "shellfyre";
@@ -45,6 +112,7 @@ enum return_codes
 	SUCCESS = 0,
 	EXIT = 1,
 	UNKNOWN = 2,
+	NOT_BUILTIN = 3,
 };
 
 struct command_t
@@ -58,6 +126,443 @@ struct command_t
 	struct command_t *next; // for piping
 };
 
+//Streams a builtin reads from and writes to
+struct io_t
+{
+	FILE *in;
+	FILE *out;
+	FILE *err;
+};
+
+//Signature shared by all builtins, argv is NULL terminated and argv[0] is the name of the builtin
+typedef int (*builtin_handler)(int argc, char **argv, struct io_t *io);
+
+struct builtin_t
+{
+	const char *name;
+	builtin_handler handler;
+};
+
+enum node_types
+{
+	NODE_COMMAND,  // a single pipeline
+	NODE_SEQUENCE, // left ; right
+	NODE_AND,	   // left && right
+	NODE_OR,	   // left || right
+	NODE_SUBSHELL, // ( left )
+	NODE_GROUP,	   // { left; }
+};
+
+/**
+ * A node of the command list tree built by parse_line
+ */
+struct node_t
+{
+	enum node_types type;
+	struct command_t *command; // for NODE_COMMAND
+	struct node_t *left;	   // operand of the operators, body of the groups
+	struct node_t *right;
+	char *redirects[3];		   // of a group or subshell, like command_t
+};
+
+//Number of spans kept per thread by the tracer, older spans are overwritten
+#define TRACE_RING_SIZE 65536
+
+//A timed region of the shell, names are string literals, times are in ticks of trace_clock
+struct trace_span_t
+{
+	const char *name;
+	long long start;
+	long long end;
+};
+
+//Ring buffer of a thread, only written by its own thread so no locking is needed
+struct trace_ring_t
+{
+	struct trace_ring_t *next; // list of all rings for trace_dump
+	pid_t tid;
+	unsigned long head;
+	struct trace_span_t spans[TRACE_RING_SIZE];
+};
+
+//Switched with the trace builtin or SHELLFYRE_TRACE=<file>
+int trace_enabled = 0;
+struct trace_ring_t *trace_rings = NULL;
+__thread struct trace_ring_t *trace_ring = NULL;
+
+/**
+ * Returns a monotonic timestamp in nanoseconds
+ * @return
+ */
+long long now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/**
+ * Clock of the spans. On x86 this is the time stamp counter, which costs about half a
+ * clock_gettime and keeps an enabled span near the 50 ns it is allowed. Elsewhere it is now_ns.
+ * @return ticks, turned into nanoseconds by trace_ns
+ */
+static inline long long trace_clock()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	return now_ns();
+#endif
+}
+
+//now_ns and trace_clock read together when tracing was turned on, trace_ns maps ticks from there
+long long trace_anchor_ns = 0, trace_anchor_ticks = 0;
+
+void trace_start()
+{
+	trace_anchor_ticks = trace_clock();
+	trace_anchor_ns = now_ns();
+	trace_enabled = 1;
+}
+
+/**
+ * Converts ticks of trace_clock into now_ns nanoseconds, at the rate the two clocks kept since
+ * trace_start. The TSC of x86 ticks at a constant rate, so one anchor pair is enough.
+ * @param ticks
+ * @param rate  nanoseconds per tick, from trace_rate
+ * @return
+ */
+long long trace_ns(long long ticks, double rate)
+{
+	return trace_anchor_ns + (long long)((ticks - trace_anchor_ticks) * rate);
+}
+
+double trace_rate()
+{
+	long long ticks = trace_clock() - trace_anchor_ticks, ns = now_ns() - trace_anchor_ns;
+
+	return ticks > 0 && ns > 0 ? (double)ns / ticks : 1;
+}
+
+/**
+ * Starts a span, costs a single branch while tracing is off
+ * @return start in ticks of trace_clock, or 0
+ */
+static inline long long trace_begin()
+{
+	if (__builtin_expect(trace_enabled, 0))
+		return trace_clock();
+	return 0;
+}
+
+/**
+ * Allocates the ring of the calling thread and pushes it to the list of rings
+ * @return
+ */
+struct trace_ring_t *trace_new_ring()
+{
+	struct trace_ring_t *ring = calloc(1, sizeof(struct trace_ring_t));
+	if (ring == NULL)
+		return NULL;
+	ring->tid = syscall(SYS_gettid);
+	ring->next = __atomic_load_n(&trace_rings, __ATOMIC_RELAXED);
+	while (!__atomic_compare_exchange_n(&trace_rings, &ring->next, ring, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+		;
+	return trace_ring = ring;
+}
+
+/**
+ * Ends a span started with trace_begin. The two reads of trace_clock are most of the cost of an
+ * enabled span, shellfyre_bench reports both the span and a single read
+ * @param name string literal
+ * @param start
+ * */
+static inline void trace_end(const char *name, long long start)
+{
+	struct trace_ring_t *ring = trace_ring;
+	struct trace_span_t *span;
+
+	if (__builtin_expect(start == 0, 1))
+		return;
+	if (ring == NULL && (ring = trace_new_ring()) == NULL)
+		return;
+	span = &ring->spans[ring->head & (TRACE_RING_SIZE - 1)];
+	span->name = name;
+	span->start = start;
+	span->end = trace_clock();
+	__atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Writes the spans of every thread as Chrome trace / Perfetto JSON
+ * @param path
+ * @return 0 on success, -1 if the file could not be opened
+ */
+int trace_dump(char *path)
+{
+	FILE *fp = fopen(path, "w");
+	struct trace_ring_t *ring;
+	double rate = trace_rate();
+	int first = 1;
+
+	if (fp == NULL)
+		return -1;
+	fprintf(fp, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+	for (ring = __atomic_load_n(&trace_rings, __ATOMIC_ACQUIRE); ring; ring = ring->next) {
+		unsigned long head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+		unsigned long i = head > TRACE_RING_SIZE ? head - TRACE_RING_SIZE : 0;
+		for (; i < head; i++) {
+			struct trace_span_t *span = &ring->spans[i & (TRACE_RING_SIZE - 1)];
+			long long start = trace_ns(span->start, rate), end = trace_ns(span->end, rate);
+			fprintf(fp, "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d}",
+				first ? "" : ",", span->name, start / 1e3, (end - start) / 1e3, getpid(), ring->tid);
+			first = 0;
+		}
+	}
+	fprintf(fp, "\n]}\n");
+	fclose(fp);
+	return 0;
+}
+
+/**
+ * Drops the recorded spans of every thread
+ * */
+void trace_clear()
+{
+	struct trace_ring_t *ring;
+	for (ring = __atomic_load_n(&trace_rings, __ATOMIC_ACQUIRE); ring; ring = ring->next)
+		__atomic_store_n(&ring->head, 0, __ATOMIC_RELEASE);
+}
+
+//Event loop of the prompt, watching the terminal, signal_fd, timer_fd and the notification helper
+int loop_fd = -1;
+//SIGCHLD, SIGWINCH and SIGINT, blocked in the shell and read from here
+int signal_fd = -1;
+//Signal mask from before the loop blocked its signals, given back to every child
+sigset_t loop_saved_mask;
+//The input is a regular file, which epoll cannot watch but which never blocks
+int input_is_file = 0;
+
+/**
+ * Adds a descriptor to the event loop, if there is one
+ * @param  fd
+ * @param  events EPOLLIN and the like
+ * @return        0 on success, -1 on error
+ */
+int loop_watch(int fd, uint32_t events)
+{
+	struct epoll_event event = { 0 };
+
+	if (loop_fd == -1)
+		return 0;
+	event.events = events;
+	event.data.fd = fd;
+	return epoll_ctl(loop_fd, EPOLL_CTL_ADD, fd, &event);
+}
+
+/**
+ * fork for everything the shell starts, the child gets the signal mask from before the loop back
+ * and leaves the loop to the shell
+ * @return as fork
+ */
+pid_t shell_fork()
+{
+	pid_t pid = fork();
+
+	if (pid == 0) {
+		if (loop_fd != -1) {
+			close(loop_fd);
+			close(signal_fd);
+			loop_fd = signal_fd = -1;
+		}
+		sigprocmask(SIG_SETMASK, &loop_saved_mask, NULL);
+	}
+	return pid;
+}
+
+//Longest message handed to the notification helper, the arguments of one command
+#define NOTIFY_MAX_MESSAGE 1024
+//Bytes of messages that may wait for the helper before new ones are dropped
+#define NOTIFY_QUEUE_BYTES 16384
+//A notification command still running after this long is killed
+#define NOTIFY_TIMEOUT_MS 3000
+
+//Shell side of the socket to the notification helper, -1 until the first notification
+int notify_socket = -1;
+pid_t notify_pid = -1;
+//Messages dropped because the queue was full or the helper could not be reached
+unsigned long notify_dropped = 0;
+//Drops already reported at the prompt
+unsigned long notify_reported = 0;
+
+/**
+ * Runs a command of the helper with its output discarded, killing it after NOTIFY_TIMEOUT_MS
+ * @param args NULL terminated
+ */
+void notify_run(char **args)
+{
+	pid_t pid = shell_fork();
+	struct timespec tick = { 0, 10000000 };
+	int waited;
+
+	if (pid == 0) {
+		//In its own group so that the timeout also reaches what it started
+		setpgid(0, 0);
+		execvp(args[0], args);
+		_exit(127);
+	}
+	if (pid < 0)
+		return;
+	for (waited = 0; waited < NOTIFY_TIMEOUT_MS; waited += 10) {
+		if (waitpid(pid, NULL, WNOHANG) != 0)
+			return;
+		nanosleep(&tick, NULL);
+	}
+	kill(-pid, SIGKILL);
+	waitpid(pid, NULL, 0);
+}
+
+/**
+ * Main loop of the helper, runs the commands it receives one at a time until the shell closes
+ * the socket. A message is the NUL separated arguments of a command.
+ * @param sock
+ */
+void notify_helper(int sock)
+{
+	char msg[NOTIFY_MAX_MESSAGE + 1];
+	char *args[64];
+	ssize_t len;
+	int fd, null = open("/dev/null", O_RDWR);
+
+	//Away from the terminal so that ^C and the pipes of the shell are not shared with it
+	setsid();
+	for (fd = 0; fd < 3; fd++)
+		dup2(null, fd);
+	for (fd = 3; fd < sysconf(_SC_OPEN_MAX) && fd < 65536; fd++)
+		if (fd != sock)
+			close(fd);
+
+	while ((len = recv(sock, msg, NOTIFY_MAX_MESSAGE, 0)) > 0) {
+		int n = 0;
+
+		msg[len] = '\0';
+		for (char *p = msg; p < msg + len && n < 63; p += strlen(p) + 1)
+			args[n++] = p;
+		args[n] = NULL;
+		if (n > 0)
+			notify_run(args);
+	}
+	_exit(0);
+}
+
+/**
+ * Starts the notification helper, a forked copy of the shell reading from a socket pair
+ * @return 0 on success, -1 on error
+ */
+int notify_start()
+{
+	int pair[2], size = NOTIFY_QUEUE_BYTES;
+	pid_t pid;
+
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, pair) == -1)
+		return -1;
+	setsockopt(pair[0], SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+	fflush(NULL);
+	pid = shell_fork();
+	if (pid == 0) {
+		close(pair[0]);
+		notify_helper(pair[1]);
+	}
+	close(pair[1]);
+	if (pid < 0) {
+		close(pair[0]);
+		return -1;
+	}
+	notify_socket = pair[0];
+	notify_pid = pid;
+	//The loop hears about it at once if the helper dies
+	loop_watch(notify_socket, EPOLLRDHUP);
+	return 0;
+}
+
+/**
+ * Closes the socket to the helper, which leaves once it has run what is already queued
+ * */
+void notify_stop()
+{
+	if (notify_socket == -1)
+		return;
+	close(notify_socket);
+	notify_socket = -1;
+	//Reaped here if it is already gone, otherwise it is left to finish on its own
+	waitpid(notify_pid, NULL, WNOHANG);
+	notify_pid = -1;
+}
+
+/**
+ * Queues a command for the helper without waiting for it
+ * @param args NULL terminated
+ * @return 0 if queued, -1 if the message was dropped
+ */
+int notify_exec(char **args)
+{
+	char msg[NOTIFY_MAX_MESSAGE];
+	size_t len = 0;
+
+	for (int i = 0; args[i]; i++) {
+		size_t n = strlen(args[i]) + 1;
+
+		if (len + n > sizeof(msg)) {
+			notify_dropped++;
+			return -1;
+		}
+		memcpy(msg + len, args[i], n);
+		len += n;
+	}
+	if (notify_socket == -1 && notify_start() == -1) {
+		notify_dropped++;
+		return -1;
+	}
+	if (send(notify_socket, msg, len, MSG_DONTWAIT | MSG_NOSIGNAL) == -1) {
+		notify_dropped++;
+		//The helper is gone, the next message starts a new one
+		if (errno != EAGAIN && errno != EWOULDBLOCK)
+			notify_stop();
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Shows a desktop notification with notify-send, or with SHELLFYRE_NOTIFY_CMD when it is set,
+ * an empty SHELLFYRE_NOTIFY_CMD turns notifications off
+ * @param header
+ * @param message
+ * @return 0 if queued or off, -1 if the message was dropped
+ */
+int notify(char *header, char *message)
+{
+	char *cmd = getenv("SHELLFYRE_NOTIFY_CMD");
+	char *args[] = { cmd ? cmd : "/usr/bin/notify-send", header, message, NULL };
+
+	if (cmd && *cmd == '\0')
+		return 0;
+	return notify_exec(args);
+}
+
+/**
+ * Warns about the notifications dropped since the last warning, called before the prompt
+ * */
+void notify_report()
+{
+	unsigned long dropped = notify_dropped - notify_reported;
+
+	if (dropped == 0)
+		return;
+	printf("-%s: %lu notification%s dropped\n", sysname, dropped, dropped == 1 ? "" : "s");
+	notify_reported = notify_dropped;
+}
+
 /**
  * Prints a command struct
  * @param struct command_t *
@@ -107,6 +612,25 @@ int free_command(struct command_t *command)
 	return 0;
 }
 
+/**
+ * Release allocated memory of a command list tree
+ * @param  node [description]
+ * @return      0
+ */
+int free_node(struct node_t *node)
+{
+	if (node == NULL)
+		return 0;
+	if (node->command)
+		free_command(node->command);
+	for (int i = 0; i < 3; i++)
+		free(node->redirects[i]);
+	free_node(node->left);
+	free_node(node->right);
+	free(node);
+	return 0;
+}
+
 /**
  * Show the command prompt
  * @return [description]
@@ -145,11 +669,10 @@ int parse_command(char *buf, struct command_t *command)
 		command->background = true;
 
 	char *pch = strtok(buf, splitters);
-	command->name = (char *)malloc(strlen(pch) + 1);
 	if (pch == NULL)
-		command->name[0] = 0;
+		command->name = strdup("");
 	else
-		strcpy(command->name, pch);
+		command->name = strdup(pch);
 
 	command->args = (char **)malloc(sizeof(char *));
 
@@ -182,7 +705,7 @@ int parse_command(char *buf, struct command_t *command)
 		// piping to another command
 		if (strcmp(arg, "|") == 0)
 		{
-			struct command_t *c = malloc(sizeof(struct command_t));
+			struct command_t *c = calloc(1, sizeof(struct command_t));
 			int l = strlen(pch);
 			pch[l] = splitters[0]; // restore strtok termination
 			index = 1;
@@ -214,6 +737,15 @@ int parse_command(char *buf, struct command_t *command)
 			else
 				redirect_index = 1;
 		}
+		if (redirect_index != -1 && len == 1)
+		{
+			// separated by whitespace, file name is the next token
+			pch = strtok(NULL, splitters);
+			if (!pch)
+				break;
+			command->redirects[redirect_index] = strdup(pch);
+			continue;
+		}
 		if (redirect_index != -1)
 		{
 			command->redirects[redirect_index] = malloc(len);
@@ -235,793 +767,8498 @@ int parse_command(char *buf, struct command_t *command)
 	return 0;
 }
 
-void prompt_backspace()
+enum token_types
 {
-	putchar(8);	  // go back 1
-	putchar(' '); // write empty over
-	putchar(8);	  // go back 1 again
-}
+	TOKEN_END,
+	TOKEN_WORDS, // a pipeline, handed to parse_command
+	TOKEN_SEMI,
+	TOKEN_AND,
+	TOKEN_OR,
+	TOKEN_LPAREN,
+	TOKEN_RPAREN,
+	TOKEN_LBRACE,
+	TOKEN_RBRACE,
+};
 
 /**
- * Prompt a command from the user
- * @param  buf      [description]
- * @param  buf_size [description]
- * @return          [description]
+ * Cursor over a command line for the list parser
  */
-int prompt(struct command_t *command)
+struct parser_t
 {
-	int index = 0;
-	char c;
-	char buf[4096];
-	static char oldbuf[4096];
+	char *buf;
+	int pos;
+	int pending_semi; // a pipeline ended with a single &, which also separates commands
+	int error;
+	enum token_types type; // current token
+	char *start;		   // text of a TOKEN_WORDS token
+	int len;
+};
 
-	// tcgetattr gets the parameters of the current terminal
-	// STDIN_FILENO will tell tcgetattr that it should write the settings
-	// of stdin to oldt
-	static struct termios backup_termios, new_termios;
-	tcgetattr(STDIN_FILENO, &backup_termios);
-	new_termios = backup_termios;
-	// ICANON normally takes care that one line at a time will be processed
-	// that means it will return if it sees a "\n" or an EOF or an EOL
-	new_termios.c_lflag &= ~(ICANON | ECHO); // Also disable automatic echo. We manually echo each char.
-	// Those new settings will be set to STDIN
-	// TCSANOW tells tcsetattr to change attributes immediately.
-	tcsetattr(STDIN_FILENO, TCSANOW, &new_termios);
+/**
+ * Checks whether a brace at the given position stands as a word of its own
+ * @param  buf [description]
+ * @param  pos [description]
+ * @return     1 if it is followed by a delimiter
+ */
+int is_brace_word(char *buf, int pos)
+{
+	char next = buf[pos + 1];
+	return next == 0 || next == ' ' || next == '\t' || next == ';' || next == ')' || next == '&' || next == '|';
+}
 
-	// FIXME: backspace is applied before printing chars
-	show_prompt();
-	int multicode_state = 0;
-	buf[0] = 0;
+/**
+ * Advances the parser to the next token of the line
+ * @param  parser [description]
+ * @return        type of the new token
+ */
+int next_token(struct parser_t *parser)
+{
+	char *buf = parser->buf;
+	int i;
 
-	while (1)
+	if (parser->pending_semi)
 	{
-		c = getchar();
-		// printf("Keycode: %u\n", c); // DEBUG: uncomment for debugging
+		parser->pending_semi = 0;
+		return parser->type = TOKEN_SEMI;
+	}
 
-		if (c == 9) // handle tab
+	while (buf[parser->pos] == ' ' || buf[parser->pos] == '\t')
+		parser->pos++;
+
+	i = parser->pos;
+	switch (buf[i])
+	{
+	case 0:
+		return parser->type = TOKEN_END;
+	case ';':
+		parser->pos++;
+		return parser->type = TOKEN_SEMI;
+	case '(':
+		parser->pos++;
+		return parser->type = TOKEN_LPAREN;
+	case ')':
+		parser->pos++;
+		return parser->type = TOKEN_RPAREN;
+	case '&':
+		if (buf[i + 1] == '&')
 		{
-			buf[index++] = '?'; // autocomplete
-			break;
+			parser->pos += 2;
+			return parser->type = TOKEN_AND;
 		}
-
-		if (c == 127) // handle backspace
+		break;
+	case '|':
+		if (buf[i + 1] == '|')
 		{
-			if (index > 0)
-			{
-				prompt_backspace();
-				index--;
-			}
-			continue;
+			parser->pos += 2;
+			return parser->type = TOKEN_OR;
 		}
-		if (c == 27 && multicode_state == 0) // handle multi-code keys
+		break;
+	case '{':
+		if (is_brace_word(buf, i))
 		{
-			multicode_state = 1;
-			continue;
+			parser->pos++;
+			return parser->type = TOKEN_LBRACE;
 		}
-		if (c == 91 && multicode_state == 1)
+		break;
+	case '}':
+		if (is_brace_word(buf, i))
 		{
-			multicode_state = 2;
-			continue;
+			parser->pos++;
+			return parser->type = TOKEN_RBRACE;
 		}
-		if (c == 65 && multicode_state == 2) // up arrow
+		break;
+	}
+
+	// a pipeline runs until the next list operator outside of quotes
+	while (buf[i])
+	{
+		char c = buf[i];
+		if (c == '"' || c == '\'')
 		{
-			int i;
-			while (index > 0)
-			{
-				prompt_backspace();
-				index--;
-			}
-			for (i = 0; oldbuf[i]; ++i)
-			{
-				putchar(oldbuf[i]);
-				buf[i] = oldbuf[i];
-			}
-			index = i;
+			char *close = strchr(buf + i + 1, c);
+			i = close ? close - buf + 1 : (int)strlen(buf);
 			continue;
 		}
-		else
-			multicode_state = 0;
-
-		putchar(c); // echo the character
-		buf[index++] = c;
-		if (index >= sizeof(buf) - 1)
+		if (c == ';' || c == '(' || c == ')')
 			break;
-		if (c == '\n') // enter key
+		if ((c == '&' && buf[i + 1] == '&') || (c == '|' && buf[i + 1] == '|'))
 			break;
-		if (c == 4) // Ctrl+D
-			return EXIT;
+		if (c == '}' && (buf[i - 1] == ' ' || buf[i - 1] == '\t') && is_brace_word(buf, i))
+			break;
+		if (c == '&') // background, keep it in the pipeline for parse_command
+		{
+			i++;
+			parser->pending_semi = 1;
+			break;
+		}
+		i++;
+	}
+	parser->start = buf + parser->pos;
+	parser->len = i - parser->pos;
+	parser->pos = i;
+	return parser->type = TOKEN_WORDS;
+}
+
+/**
+ * Reports a syntax error at the current token
+ * @param parser [description]
+ */
+void syntax_error(struct parser_t *parser)
+{
+	const char *names[] = {"newline", "", ";", "&&", "||", "(", ")", "{", "}"};
+
+	if (!parser->error)
+	{
+		if (parser->type == TOKEN_WORDS)
+			printf("-%s: syntax error near unexpected token `%.*s'\n", sysname, parser->len, parser->start);
+		else
+			printf("-%s: syntax error near unexpected token `%s'\n", sysname, names[parser->type]);
+	}
+	parser->error = 1;
+}
+
+struct node_t *new_node(enum node_types type, struct node_t *left, struct node_t *right)
+{
+	struct node_t *node = calloc(1, sizeof(struct node_t));
+	node->type = type;
+	node->left = left;
+	node->right = right;
+	return node;
+}
+
+struct node_t *parse_list(struct parser_t *parser);
+
+/**
+ * Parses the redirects after a group or subshell, < file, > file and >> file
+ * @param  text      words after the closing ) or }
+ * @param  redirects in/out redirection of the node
+ * @return           0, or -1 if a word is not a redirect
+ */
+int parse_redirects(char *text, char *redirects[3])
+{
+	char *word = strtok(text, " \t"), *file;
+	int index;
+
+	while (word)
+	{
+		if (word[0] == '<')
+			index = 0;
+		else if (word[0] == '>' && word[1] == '>')
+			index = 2;
+		else if (word[0] == '>')
+			index = 1;
+		else
+			return -1;
+		file = word + (index == 2 ? 2 : 1);
+		if (*file == 0 && (file = strtok(NULL, " \t")) == NULL)
+			return -1;
+		free(redirects[index]);
+		redirects[index] = strdup(file);
+		word = strtok(NULL, " \t");
+	}
+	return 0;
+}
+
+/**
+ * pipeline := WORDS | ( list ) [redirects] | { list } [redirects]
+ * @param  parser [description]
+ * @return        node of the pipeline, NULL on error
+ */
+struct node_t *parse_pipeline(struct parser_t *parser)
+{
+	struct node_t *node;
+	enum token_types closing;
+
+	if (parser->type == TOKEN_WORDS)
+	{
+		char *text = strndup(parser->start, parser->len);
+		node = new_node(NODE_COMMAND, NULL, NULL);
+		node->command = calloc(1, sizeof(struct command_t));
+		parse_command(text, node->command);
+		free(text);
+		next_token(parser);
+		return node;
+	}
+
+	if (parser->type == TOKEN_LPAREN)
+		closing = TOKEN_RPAREN;
+	else if (parser->type == TOKEN_LBRACE)
+		closing = TOKEN_RBRACE;
+	else
+	{
+		syntax_error(parser);
+		return NULL;
+	}
+
+	next_token(parser);
+	node = new_node(closing == TOKEN_RPAREN ? NODE_SUBSHELL : NODE_GROUP, parse_list(parser), NULL);
+	if (node->left == NULL || parser->type != closing)
+	{
+		syntax_error(parser);
+		free_node(node);
+		return NULL;
+	}
+	next_token(parser);
+
+	if (parser->type == TOKEN_WORDS)
+	{
+		char *text = strndup(parser->start, parser->len);
+		int bad = parse_redirects(text, node->redirects);
+		free(text);
+		if (bad)
+		{
+			syntax_error(parser);
+			free_node(node);
+			return NULL;
+		}
+		next_token(parser);
+	}
+	return node;
+}
+
+/**
+ * and_or := pipeline { (&& | ||) pipeline }
+ * @param  parser [description]
+ * @return        node of the chain, NULL on error
+ */
+struct node_t *parse_and_or(struct parser_t *parser)
+{
+	struct node_t *node = parse_pipeline(parser);
+
+	while (node && (parser->type == TOKEN_AND || parser->type == TOKEN_OR))
+	{
+		enum node_types type = parser->type == TOKEN_AND ? NODE_AND : NODE_OR;
+		next_token(parser);
+		struct node_t *right = parse_pipeline(parser);
+		if (right == NULL)
+		{
+			free_node(node);
+			return NULL;
+		}
+		node = new_node(type, node, right);
+	}
+	return node;
+}
+
+/**
+ * list := and_or { ; and_or } [;]
+ * @param  parser [description]
+ * @return        node of the list, NULL on error
+ */
+struct node_t *parse_list(struct parser_t *parser)
+{
+	struct node_t *node = parse_and_or(parser);
+
+	while (node && parser->type == TOKEN_SEMI)
+	{
+		next_token(parser);
+		if (parser->type != TOKEN_WORDS && parser->type != TOKEN_LPAREN && parser->type != TOKEN_LBRACE)
+			break; // trailing ;
+		struct node_t *right = parse_and_or(parser);
+		if (right == NULL)
+		{
+			free_node(node);
+			return NULL;
+		}
+		node = new_node(NODE_SEQUENCE, node, right);
+	}
+	return node;
+}
+
+/**
+ * Parse a whole command line with ; && || ( ) and { } into a tree of pipelines
+ * @param  buf [description]
+ * @return     root of the tree, NULL for an empty line or a syntax error
+ */
+struct node_t *parse_line(char *buf)
+{
+	struct parser_t parser = {0};
+	struct node_t *node;
+
+	parser.buf = buf;
+	if (next_token(&parser) == TOKEN_END)
+		return NULL;
+
+	node = parse_list(&parser);
+	if (node && parser.type != TOKEN_END)
+	{
+		syntax_error(&parser);
+		free_node(node);
+		return NULL;
+	}
+	return node;
+}
+
+void prompt_backspace()
+{
+	putchar(8);	  // go back 1
+	putchar(' '); // write empty over
+	putchar(8);	  // go back 1 again
+}
+
+//A timer of the every and at builtins, kept in timer_heap ordered by when
+struct shell_timer_t
+{
+	int id;
+	long long when;	  // next run, monotonic nanoseconds
+	long long base;	  // next run before the jitter
+	long long period; // 0 for at
+	long long jitter; // every run is delayed by up to this many nanoseconds
+	int overlap;	  // start a run even if the previous one is still going
+	int done;		  // at timer that has run, removed once its run is reaped
+	size_t index;	  // position in timer_heap
+	pid_t pgid;		  // process group of the running instances, 0 if none
+	int running;
+	unsigned long runs;
+	unsigned long skipped;
+	int last_status;
+	char *command;
+};
+
+//Min-heap of the timers, the first one drives timer_fd
+struct shell_timer_t **timer_heap = NULL;
+size_t timer_count = 0;
+size_t timer_capacity = 0;
+int timer_fd = -1;
+int timer_next_id = 1;
+
+int execute_node(struct node_t *node);
+int exit_code(int status);
+
+void timer_swap(size_t a, size_t b)
+{
+	struct shell_timer_t *t = timer_heap[a];
+
+	timer_heap[a] = timer_heap[b];
+	timer_heap[b] = t;
+	timer_heap[a]->index = a;
+	timer_heap[b]->index = b;
+}
+
+/**
+ * Moves a timer to its place in the heap after its time changed
+ * @param i index of the timer
+ */
+void timer_fix(size_t i)
+{
+	while (i > 0 && timer_heap[i]->when < timer_heap[(i - 1) / 2]->when) {
+		timer_swap(i, (i - 1) / 2);
+		i = (i - 1) / 2;
+	}
+	while (1) {
+		size_t min = i, l = 2 * i + 1, r = 2 * i + 2;
+
+		if (l < timer_count && timer_heap[l]->when < timer_heap[min]->when)
+			min = l;
+		if (r < timer_count && timer_heap[r]->when < timer_heap[min]->when)
+			min = r;
+		if (min == i)
+			break;
+		timer_swap(i, min);
+		i = min;
+	}
+}
+
+/**
+ * Sets timer_fd to the first timer of the heap, or disarms it when there is none
+ * */
+void timer_arm()
+{
+	struct itimerspec spec = {{0, 0}, {0, 0}};
+
+	if (timer_fd == -1)
+		return;
+	if (timer_count > 0 && timer_heap[0]->when != LLONG_MAX) {
+		//A zero it_value would disarm the timer
+		long long when = timer_heap[0]->when > 0 ? timer_heap[0]->when : 1;
+		spec.it_value.tv_sec = when / 1000000000LL;
+		spec.it_value.tv_nsec = when % 1000000000LL;
+	}
+	timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &spec, NULL);
+}
+
+/**
+ * Picks the time of the next run of a timer from its base time and jitter
+ * @param t
+ */
+void timer_schedule(struct shell_timer_t *t)
+{
+	t->when = t->base;
+	if (t->jitter > 0)
+		t->when += (long long)(((double)rand() / ((double)RAND_MAX + 1)) * t->jitter);
+}
+
+/**
+ * Adds a timer to the heap
+ * @return id of the timer, -1 on error
+ */
+int timer_add(char *command, long long delay, long long period, long long jitter, int overlap)
+{
+	struct shell_timer_t *t;
+
+	if (timer_fd == -1) {
+		if ((timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) == -1)
+			return -1;
+		loop_watch(timer_fd, EPOLLIN);
+	}
+	if (timer_count == timer_capacity) {
+		size_t capacity = timer_capacity ? 2 * timer_capacity : 8;
+		struct shell_timer_t **heap = realloc(timer_heap, sizeof(struct shell_timer_t *) * capacity);
+
+		if (heap == NULL)
+			return -1;
+		timer_heap = heap;
+		timer_capacity = capacity;
+	}
+	t = calloc(1, sizeof(struct shell_timer_t));
+	if (t == NULL)
+		return -1;
+	t->id = timer_next_id++;
+	t->base = now_ns() + delay;
+	t->period = period;
+	t->jitter = jitter;
+	t->overlap = overlap;
+	t->command = strdup(command);
+	timer_schedule(t);
+	t->index = timer_count;
+	timer_heap[timer_count++] = t;
+	timer_fix(t->index);
+	timer_arm();
+	return t->id;
+}
+
+/**
+ * Takes a timer out of the heap and frees it, its running instances are left alone
+ * @param t
+ */
+void timer_remove(struct shell_timer_t *t)
+{
+	size_t i = t->index;
+
+	timer_swap(i, --timer_count);
+	if (i < timer_count)
+		timer_fix(i);
+	free(t->command);
+	free(t);
+	timer_arm();
+}
+
+/**
+ * Looks up a timer by id
+ * @return the timer, NULL if there is no such timer
+ */
+struct shell_timer_t *timer_find(int id)
+{
+	for (size_t i = 0; i < timer_count; i++)
+		if (timer_heap[i]->id == id)
+			return timer_heap[i];
+	return NULL;
+}
+
+/**
+ * Removes the timer with the given id
+ * @return 0, or -1 if there is no such timer
+ */
+int timer_cancel(int id)
+{
+	struct shell_timer_t *t = timer_find(id);
+
+	if (t == NULL)
+		return -1;
+	timer_remove(t);
+	return 0;
+}
+
+/**
+ * Reaps the finished runs of the timers without blocking, at timers go away with their run
+ * */
+void timer_reap()
+{
+	for (size_t i = 0; i < timer_count;) {
+		struct shell_timer_t *t = timer_heap[i];
+		int status;
+		pid_t pid;
+
+		while (t->running > 0 && (pid = waitpid(-t->pgid, &status, WNOHANG)) != 0) {
+			if (pid == -1) {
+				t->running = 0;
+				break;
+			}
+			t->running--;
+			t->last_status = exit_code(status);
+		}
+		if (t->running == 0)
+			t->pgid = 0;
+		//The last timer takes the place of a removed one and is looked at next
+		if (t->done && t->running == 0)
+			timer_remove(t);
+		else
+			i++;
+	}
+}
+
+/**
+ * Runs a parsed command list in a forked shell with stdin from /dev/null, in the process group
+ * pgid or in a new group when pgid is 0, so that the terminal's ^C does not reach it
+ * @param  tree left to the caller to free
+ * @param  pgid
+ * @param  out  takes stdout and stderr of the command, -1 to keep them
+ * @return      pid of the child, -1 on error
+ */
+pid_t spawn_node(struct node_t *tree, pid_t pgid, int out)
+{
+	pid_t pid;
+
+	fflush(stdout);
+	pid = shell_fork();
+	if (pid == 0) {
+		int null = open("/dev/null", O_RDONLY);
+
+		setpgid(0, pgid);
+		in_subshell = 1;
+		if (null != -1) {
+			dup2(null, STDIN_FILENO);
+			close(null);
+		}
+		if (out != -1) {
+			dup2(out, STDOUT_FILENO);
+			dup2(out, STDERR_FILENO);
+			close(out);
+		}
+		last_status = 0;
+		execute_node(tree);
+		fflush(stdout);
+		_exit(last_status);
+	}
+	//Both sides set the group so that it exists before anything else joins it
+	if (pid > 0)
+		setpgid(pid, pgid ? pgid : pid);
+	return pid;
+}
+
+/**
+ * Runs a command line like spawn_node, it is parsed in the shell first
+ * @param  line
+ * @param  pgid
+ * @param  out  takes stdout and stderr of the command, -1 to keep them
+ * @return      pid of the child, -1 on error
+ */
+pid_t spawn_line(char *line, pid_t pgid, int out)
+{
+	char *buf = strdup(line);
+	struct node_t *tree = parse_line(buf);
+	pid_t pid = spawn_node(tree, pgid, out);
+
+	free_node(tree);
+	free(buf);
+	return pid;
+}
+
+/**
+ * Joins the words of a command given to a builtin like every or onchange, the shell splits quoted
+ * text at blanks so an outer pair of quotes is dropped after joining
+ * @return the command, to be freed
+ */
+char *join_command(int argc, char **argv)
+{
+	size_t len = 1;
+	char *command;
+
+	for (int i = 0; i < argc; i++)
+		len += strlen(argv[i]) + 1;
+	command = calloc(len, 1);
+	for (int i = 0; i < argc; i++) {
+		strcat(command, argv[i]);
+		if (i + 1 < argc)
+			strcat(command, " ");
+	}
+	len = strlen(command);
+	if (len >= 2 && (command[0] == '\'' || command[0] == '"') && command[len - 1] == command[0]) {
+		command[len - 1] = '\0';
+		memmove(command, command + 1, len - 1);
+	}
+	return command;
+}
+
+/**
+ * Runs the command of a timer in the background, in a process group shared by its running instances
+ * @param t
+ */
+void timer_run(struct shell_timer_t *t)
+{
+	pid_t pid;
+
+	if (t->running > 0 && !t->overlap) {
+		t->skipped++;
+		return;
+	}
+	pid = spawn_line(t->command, t->pgid, -1);
+	if (pid == -1) {
+		t->skipped++;
+		return;
+	}
+	if (t->pgid == 0)
+		t->pgid = pid;
+	t->running++;
+	t->runs++;
+}
+
+/**
+ * Runs the timers that are due and schedules their next run, called when timer_fd fires
+ * */
+void timer_fire()
+{
+	uint64_t expirations;
+	long long now = now_ns();
+
+	while (read(timer_fd, &expirations, sizeof(expirations)) > 0)
+		;
+	timer_reap();
+	while (timer_count > 0 && timer_heap[0]->when <= now) {
+		struct shell_timer_t *t = timer_heap[0];
+
+		timer_run(t);
+		if (t->period > 0) {
+			//Runs missed while the shell was busy are skipped rather than run in a burst
+			t->base += t->period;
+			if (t->base <= now) {
+				long long missed = (now - t->base) / t->period + 1;
+
+				t->skipped += missed;
+				t->base += missed * t->period;
+			}
+			timer_schedule(t);
+		}
+		else {
+			t->done = 1;
+			t->when = LLONG_MAX;
+		}
+		timer_fix(0);
+	}
+	timer_reap();
+	timer_arm();
+}
+
+/**
+ * Parses an interval like 90, 500ms, 30s, 15m, 2h or 1d, plain numbers are seconds
+ * @param  text
+ * @param  ns   nanoseconds
+ * @return      0, or -1 if the text is not an interval
+ */
+int parse_interval(const char *text, long long *ns)
+{
+	char *end;
+	double value;
+	double unit = 1e9;
+
+	if (!isdigit((unsigned char)*text) && *text != '.')
+		return -1;
+	value = strtod(text, &end);
+	if (strcmp(end, "ms") == 0)
+		unit = 1e6;
+	else if (strcmp(end, "m") == 0)
+		unit = 60e9;
+	else if (strcmp(end, "h") == 0)
+		unit = 3600e9;
+	else if (strcmp(end, "d") == 0)
+		unit = 86400e9;
+	else if (*end != '\0' && strcmp(end, "s") != 0)
+		return -1;
+	if (value * unit > 1e18)
+		return -1;
+	*ns = (long long)(value * unit);
+	return 0;
+}
+
+//A background pipeline started with &
+struct job_t
+{
+	int id;
+	pid_t *pids; // 0 once reaped
+	int stages;
+	int running; // stages not reaped yet
+	int status;	 // exit code of the last stage
+	char *command;
+	struct job_t *next;
+};
+
+//Background jobs in the order they were started
+struct job_t *job_list = NULL;
+
+/**
+ * Adds a background pipeline to the jobs table and prints its number
+ * @param command first stage of the pipeline
+ * @param pids    one per stage
+ * @param stages
+ */
+void job_add(struct command_t *command, pid_t *pids, int stages)
+{
+	struct job_t *job = calloc(1, sizeof(struct job_t)), **last = &job_list;
+	size_t len = 1;
+	int id = 1;
+
+	for (struct command_t *stage = command; stage; stage = stage->next) {
+		len += strlen(stage->name) + 4;
+		for (int i = 0; i < stage->arg_count; i++)
+			len += strlen(stage->args[i]) + 1;
+	}
+	job->command = calloc(len, 1);
+	for (struct command_t *stage = command; stage; stage = stage->next) {
+		strcat(job->command, stage->name);
+		for (int i = 0; i < stage->arg_count; i++) {
+			strcat(job->command, " ");
+			strcat(job->command, stage->args[i]);
+		}
+		if (stage->next)
+			strcat(job->command, " | ");
+	}
+	job->pids = malloc(sizeof(pid_t) * stages);
+	memcpy(job->pids, pids, sizeof(pid_t) * stages);
+	job->stages = job->running = stages;
+
+	//The smallest number above the ones in use, as other shells do
+	for (; *last; last = &(*last)->next)
+		if ((*last)->id >= id)
+			id = (*last)->id + 1;
+	job->id = id;
+	*last = job;
+	printf("[%d] %d\n", job->id, pids[stages - 1]);
+}
+
+/**
+ * Reaps the finished stages of the background jobs without blocking
+ * @return number of jobs that are done and not reported yet
+ */
+int job_reap()
+{
+	int done = 0;
+
+	for (struct job_t *job = job_list; job; job = job->next) {
+		for (int i = 0; i < job->stages; i++) {
+			int status;
+			pid_t pid;
+
+			if (job->pids[i] == 0)
+				continue;
+			pid = waitpid(job->pids[i], &status, WNOHANG);
+			if (pid == 0)
+				continue;
+			//Already reaped elsewhere if pid is -1, the status is unknown then
+			if (i == job->stages - 1)
+				job->status = pid == -1 ? 0 : exit_code(status);
+			job->pids[i] = 0;
+			job->running--;
+		}
+		if (job->running == 0)
+			done++;
+	}
+	return done;
+}
+
+/**
+ * Prints and forgets the jobs that are done
+ * */
+void job_report()
+{
+	struct job_t **link = &job_list;
+
+	while (*link) {
+		struct job_t *job = *link;
+
+		if (job->running > 0) {
+			link = &job->next;
+			continue;
+		}
+		if (job->status == 0)
+			printf("[%d]  Done\t\t%s &\n", job->id, job->command);
+		else
+			printf("[%d]  Exit %d\t%s &\n", job->id, job->status, job->command);
+		*link = job->next;
+		free(job->pids);
+		free(job->command);
+		free(job);
+	}
+	fflush(stdout);
+}
+
+/**
+ * Blocks the signals the loop reads from signal_fd and sets up the epoll instance
+ * @return 0 on success, -1 on error, the prompt then reads without the loop
+ */
+int loop_init()
+{
+	sigset_t mask;
+
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGCHLD);
+	sigaddset(&mask, SIGWINCH);
+	sigaddset(&mask, SIGINT);
+	if (sigprocmask(SIG_BLOCK, &mask, &loop_saved_mask) == -1)
+		return -1;
+	signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+	loop_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (signal_fd == -1 || loop_fd == -1 || loop_watch(signal_fd, EPOLLIN) == -1) {
+		if (signal_fd != -1)
+			close(signal_fd);
+		if (loop_fd != -1)
+			close(loop_fd);
+		loop_fd = signal_fd = -1;
+		sigprocmask(SIG_SETMASK, &loop_saved_mask, NULL);
+		return -1;
+	}
+	if (loop_watch(STDIN_FILENO, EPOLLIN) == -1) {
+		if (errno != EPERM)
+			return -1;
+		input_is_file = 1;
+	}
+	if (timer_fd != -1)
+		loop_watch(timer_fd, EPOLLIN);
+	if (notify_socket != -1)
+		loop_watch(notify_socket, EPOLLRDHUP);
+	return 0;
+}
+
+/**
+ * Reads the pending signals of the loop, children are reaped right away
+ * @return bit 0 set for SIGINT, bit 1 for SIGWINCH
+ */
+int loop_signals()
+{
+	struct signalfd_siginfo info;
+	int seen = 0;
+
+	while (read(signal_fd, &info, sizeof(info)) == sizeof(info)) {
+		if (info.ssi_signo == SIGINT)
+			seen |= 1;
+		else if (info.ssi_signo == SIGWINCH)
+			seen |= 2;
+		else if (info.ssi_signo == SIGCHLD)
+			timer_reap();
+	}
+	return seen;
+}
+
+/**
+ * Waits in the event loop until there is input, running timers, reporting finished jobs and
+ * noticing a dead notification helper as soon as it happens. Idles in epoll_wait.
+ * @param  line text typed so far, drawn again below the job reports
+ * @param  len
+ * @return      1 when there is input, 0 on ^C, -1 on error
+ */
+int loop_wait(const char *line, int len)
+{
+	struct epoll_event events[8];
+	int tty = isatty(STDOUT_FILENO);
+
+	while (1) {
+		int n = epoll_wait(loop_fd, events, 8, input_is_file ? 0 : -1);
+		int ready = input_is_file, seen = 0;
+
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		for (int i = 0; i < n; i++) {
+			int fd = events[i].data.fd;
+
+			if (fd == STDIN_FILENO)
+				ready = 1;
+			else if (fd == signal_fd)
+				seen |= loop_signals();
+			else if (fd == timer_fd)
+				timer_fire();
+			else if (fd == notify_socket) {
+				pid_t pid = notify_pid;
+
+				//It closed its end, so it is on its way out
+				notify_stop();
+				if (pid > 0)
+					waitpid(pid, NULL, 0);
+			}
+		}
+
+		if (seen & 1) {
+			printf("^C\n");
+			return 0;
+		}
+		if (job_reap() > 0) {
+			if (tty)
+				printf("\r\033[K");
+			job_report();
+			seen |= 2;
+		}
+		if ((seen & 2) && tty) {
+			printf("\r\033[K");
+			show_prompt();
+			fwrite(line, 1, len, stdout);
+		}
+		fflush(stdout);
+		if (ready)
+			return 1;
+	}
+}
+
+//Input of the prompt, read here rather than through stdio so that the loop can wait for it
+char input_buf[4096];
+size_t input_pos = 0;
+size_t input_len = 0;
+
+/**
+ * Reads a character typed at the prompt, the event loop runs while waiting for it
+ * @param  line text typed so far
+ * @param  len
+ * @return      the character, 3 for ^C or EOF
+ */
+int prompt_getchar(const char *line, int len)
+{
+	while (input_pos == input_len) {
+		ssize_t n;
+
+		if (loop_fd != -1) {
+			int r = loop_wait(line, len);
+
+			if (r == 0)
+				return 3;
+			if (r == -1)
+				return EOF;
+		}
+		n = read(STDIN_FILENO, input_buf, sizeof(input_buf));
+		if (n == -1 && (errno == EINTR || errno == EAGAIN))
+			continue;
+		if (n <= 0)
+			return EOF;
+		input_pos = 0;
+		input_len = n;
+	}
+	return (unsigned char)input_buf[input_pos++];
+}
+
+/**
+ * Prompt a command from the user
+ * @param  buf      [description]
+ * @param  buf_size [description]
+ * @return          [description]
+ */
+int prompt(struct node_t **tree)
+{
+	int index = 0;
+	char c;
+	char buf[4096];
+	static char oldbuf[4096];
+
+	// tcgetattr gets the parameters of the current terminal
+	// STDIN_FILENO will tell tcgetattr that it should write the settings
+	// of stdin to oldt
+	static struct termios backup_termios, new_termios;
+	long long span = trace_begin();
+	tcgetattr(STDIN_FILENO, &backup_termios);
+	new_termios = backup_termios;
+	// ICANON normally takes care that one line at a time will be processed
+	// that means it will return if it sees a "\n" or an EOF or an EOL
+	new_termios.c_lflag &= ~(ICANON | ECHO); // Also disable automatic echo. We manually echo each char.
+	// Those new settings will be set to STDIN
+	// TCSANOW tells tcsetattr to change attributes immediately.
+	tcsetattr(STDIN_FILENO, TCSANOW, &new_termios);
+	trace_end("termios", span);
+
+	//A ^C that came during the last command is not meant for the new line, jobs that ended
+	//during it are reported before the prompt
+	if (signal_fd != -1 && (loop_signals() & 1))
+		printf("\n");
+	if (job_reap() > 0)
+		job_report();
+	notify_report();
+
+	// FIXME: backspace is applied before printing chars
+	show_prompt();
+	int multicode_state = 0;
+	buf[0] = 0;
+
+	while (1)
+	{
+		fflush(stdout);
+		c = prompt_getchar(buf, index);
+		// printf("Keycode: %u\n", c); // DEBUG: uncomment for debugging
+
+		if (c == 3) // ^C drops the line
+		{
+			index = 0;
+			multicode_state = 0;
+			show_prompt();
+			continue;
+		}
+
+		if (c == 9) // handle tab
+		{
+			buf[index++] = '?'; // autocomplete
+			break;
+		}
+
+		if (c == 127) // handle backspace
+		{
+			if (index > 0)
+			{
+				prompt_backspace();
+				index--;
+			}
+			continue;
+		}
+		if (c == 27 && multicode_state == 0) // handle multi-code keys
+		{
+			multicode_state = 1;
+			continue;
+		}
+		if (c == 91 && multicode_state == 1)
+		{
+			multicode_state = 2;
+			continue;
+		}
+		if (c == 65 && multicode_state == 2) // up arrow
+		{
+			int i;
+			while (index > 0)
+			{
+				prompt_backspace();
+				index--;
+			}
+			for (i = 0; oldbuf[i]; ++i)
+			{
+				putchar(oldbuf[i]);
+				buf[i] = oldbuf[i];
+			}
+			index = i;
+			continue;
+		}
+		else
+			multicode_state = 0;
+
+		putchar(c); // echo the character
+		buf[index++] = c;
+		if (index >= sizeof(buf) - 1)
+			break;
+		if (c == '\n') // enter key
+			break;
+		if (c == 4 || c == EOF) // Ctrl+D
+			return EXIT;
 	}
 	if (index > 0 && buf[index - 1] == '\n') // trim newline from the end
 		index--;
 	buf[index++] = 0; // null terminate string
 
-	strcpy(oldbuf, buf);
+	strcpy(oldbuf, buf);
+
+	span = trace_begin();
+	*tree = parse_line(buf);
+	trace_end("parse", span);
+
+	// print_command(command); // DEBUG: uncomment for debugging
+
+	// restore the old settings
+	span = trace_begin();
+	tcsetattr(STDIN_FILENO, TCSANOW, &backup_termios);
+	trace_end("termios", span);
+	return SUCCESS;
+}
+
+int process_command(struct command_t *command);
+int run_builtin(struct command_t *command);
+int execute_node(struct node_t *node);
+
+#ifndef SHELLFYRE_BENCH
+int main()
+{	//
+
+	
+	if(getcwd(pathToShellfyre,sizeof(pathToShellfyre)) == NULL)
+	       ("Could not get the cwd!");	
+
+
+	readFromCdhFile();
+
+	//Always-on resource accounting of external commands
+	if (getenv("SHELLFYRE_ACCOUNTING") && strcmp(getenv("SHELLFYRE_ACCOUNTING"), "0") != 0)
+		accounting = 1;
+
+	//Tracing from startup, spans are written to the given file on exit
+	if (getenv("SHELLFYRE_TRACE") && getenv("SHELLFYRE_TRACE")[0])
+		trace_start();
+
+	//Without the loop the prompt still works, only timers and job reports wait for a key
+	if (loop_init() == -1)
+		printf("-%s: event loop: %s\n", sysname, strerror(errno));
+
+	//
+	while (1)
+	{
+		struct node_t *tree = NULL;
+
+		int code;
+		code = prompt(&tree);
+		if (code == EXIT)
+			break;
+
+		code = execute_node(tree);
+		if (code == EXIT)
+			break;
+
+		free_node(tree);
+	}
+
+	if (getenv("SHELLFYRE_TRACE") && getenv("SHELLFYRE_TRACE")[0] && trace_dump(getenv("SHELLFYRE_TRACE")) == -1)
+		printf("-%s: %s: %s\n", sysname, getenv("SHELLFYRE_TRACE"), strerror(errno));
+
+	printf("\n");
+	return 0;
+}
+#endif
+
+/**
+ * Saves the cd history, removes the module, stops the notification helper and leaves the shell
+ * @param  argc
+ * @param  argv  argv[0] is the name of the builtin
+ * @param  io
+ * @return       exit status
+ */
+int builtin_exit(int argc, char **argv, struct io_t *io)
+{
+	int r;
+
+	(void)argc;
+
+	exit_requested = 1;
+
+	//A subshell or pipeline stage only leaves itself, the shell does the cleanup
+	if (in_subshell)
+		return last_status;
+	
+	//Store the cdHistory to cdFile in the same directory with shellfyre.c
+	if(cdCount != 0) {
+		//Change directory to directory in which shellfyre exist
+		r = chdir(pathToShellfyre);
+		if (r == -1)
+			fprintf(io->out, "-%s: %s: %s\n", sysname, argv[0], strerror(errno));
+		
+		//Store the cdHistory in cdFile and store the file in the same directory with shellfyre.c
+		writeToCdhFile();
+
+	}
+
+	//Removing the module it is open
+	if(module_open) {
+
+		//close(fd);	
+		char *path1 = "/usr/bin/sudo";
+		char *args1[] = {path1,"rmmod","process_module.ko", 0};
+		pid_t pid1;
+
+		pid1= shell_fork();
+
+		if(pid1 == 0) {
+		//Calling rmmod in the child
+			execv(path1,args1);
+		}
+		else {
+			waitpid(pid1, NULL, 0);
+		}
+	}
+	
+	//The helper shows what is still queued and leaves on its own
+	notify_stop();
+
+	return last_status;
+}
+
+/**
+ * Shows or switches the per-command resource accounting
+ * @param  argc
+ * @param  argv  argv[0] is the name of the builtin
+ * @param  io
+ * @return       exit status
+ */
+int builtin_stats(int argc, char **argv, struct io_t *io)
+{
+	if (argc == 1)
+		print_stats(0);
+	else if (strcmp(argv[1], "-h") == 0)
+		print_stats(1);
+	else if (strcmp(argv[1], "on") == 0)
+		accounting = 1;
+	else if (strcmp(argv[1], "off") == 0)
+		accounting = 0;
+	else if (strcmp(argv[1], "reset") == 0) {
+		while (command_stats) {
+			struct command_stats_t *next = command_stats->next;
+			free(command_stats);
+			command_stats = next;
+		}
+	}
+	else {
+		fprintf(io->out, "usage: stats [-h | on | off | reset]\n");
+		return 2;
+	}
+	return 0;
+}
+
+/**
+ * Controls the internal tracer
+ * @param  argc
+ * @param  argv  argv[0] is the name of the builtin
+ * @param  io
+ * @return       exit status
+ */
+int builtin_trace(int argc, char **argv, struct io_t *io)
+{
+	if (argc == 2 && strcmp(argv[1], "on") == 0)
+		trace_start();
+	else if (argc == 2 && strcmp(argv[1], "off") == 0)
+		trace_enabled = 0;
+	else if (argc == 2 && strcmp(argv[1], "clear") == 0)
+		trace_clear();
+	else if (argc == 3 && strcmp(argv[1], "dump") == 0) {
+		if (trace_dump(argv[2]) == -1) {
+			fprintf(io->out, "-%s: %s: %s\n", sysname, argv[2], strerror(errno));
+			return 1;
+		}
+	}
+	else {
+		fprintf(io->out, "usage: trace [on | off | clear | dump <file>]\n");
+		return 2;
+	}
+	return 0;
+}
+
+/**
+ * Changes the working directory and records it in the cd history
+ * @param  argc
+ * @param  argv  argv[0] is the name of the builtin
+ * @param  io
+ * @return       exit status
+ */
+int builtin_cd(int argc, char **argv, struct io_t *io)
+{
+	int r;
+	char *dir = argc > 1 ? argv[1] : getenv("HOME");
+
+	if (dir == NULL)
+		return 0;
+
+	r = chdir(dir);
+
+	if (r == -1) {
+		fprintf(io->out, "-%s: %s: %s\n", sysname, argv[0], strerror(errno));
+		return 1;
+	}
+
+	//Upon changing directory, add the current directory to chHistory for cdh command
+	char cwd[512];
+	if(getcwd(cwd,sizeof(cwd)) != NULL) {
+		addCdToHistory(cwd);
+	}
+	return 0;
+}
+
+/**
+ * Searches the current directory for files whose names contain a keyword
+ * @param  argc
+ * @param  argv  argv[0] is the name of the builtin
+ * @param  io
+ * @return       exit status
+ */
+int builtin_filesearch(int argc, char **argv, struct io_t *io)
+{
+	int recursive = 0;
+	int open = 0;
+	char keyword[30];
+
+	if(argv[1] == NULL || ((strcmp(argv[1],"-r") == 0 || strcmp(argv[1],"-o") == 0) && argv[2] == NULL)) {
+
+		fprintf(io->out, "Usage: filesearch 'keyword'. Options: -r, -o\n");
+		return 2;
+	}
+	//Assigning command line options to open and recursive flags
+	else if (strcmp(argv[1],"-r") == 0) {
+		recursive = 1;
+		
+		if(strcmp(argv[2], "-o") == 0) {
+			open = 1;
+			strcpy(keyword, argv[3]);
+		}
+		else {
+			strcpy(keyword, argv[2]);
+		}
+	}
+	else if (strcmp(argv[1],"-o") == 0) {
+			open = 1;
+
+		if(strcmp(argv[2], "-r") == 0) {
+			recursive = 1;
+			strcpy(keyword, argv[3]);
+		}
+		else {
+			strcpy(keyword, argv[2]);
+		}
+	}
+	else if (argc > 2) {
+		fprintf(io->out, "filesearch: bad usage\n");
+		return 2;
+	}
+	else {
+		strcpy(keyword, argv[1]);
+	}
+	
+	//Calling fileSearch function with inputs keyword, current dir (.),and options recursive and open
+	fileSearch(keyword,".", recursive, open);
+	return 0;
+}
+
+//Quiet time after the last event before onchange runs the command again
+#define ONCHANGE_DEBOUNCE_MS 50
+//A run that is still going this long after SIGTERM is killed
+#define ONCHANGE_KILL_MS 1000
+#define ONCHANGE_EVENTS (IN_CLOSE_WRITE | IN_MODIFY | IN_ATTRIB | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO)
+
+//A watched directory, either with every entry in it or for one name only
+struct onchange_watch_t {
+	int wd;
+	char *dir;
+	char *name; // NULL for every entry
+};
+
+struct onchange_t {
+	int fd; // inotify
+	struct onchange_watch_t *watches;
+	int count;
+	int capacity;
+};
+
+/**
+ * Watches a directory for changes of all its entries, or of the one given by name
+ * @return 0 on success, -1 on error
+ */
+int onchange_add(struct onchange_t *w, char *dir, char *name)
+{
+	int wd = inotify_add_watch(w->fd, dir, ONCHANGE_EVENTS | IN_ONLYDIR);
+
+	if (wd == -1)
+		return -1;
+	if (w->count == w->capacity) {
+		int capacity = w->capacity ? 2 * w->capacity : 16;
+		struct onchange_watch_t *watches = realloc(w->watches, sizeof(struct onchange_watch_t) * capacity);
+
+		if (watches == NULL)
+			return -1;
+		w->watches = watches;
+		w->capacity = capacity;
+	}
+	w->watches[w->count].wd = wd;
+	w->watches[w->count].dir = strdup(dir);
+	w->watches[w->count].name = name ? strdup(name) : NULL;
+	w->count++;
+	return 0;
+}
+
+/**
+ * Editor swap and backup files and hidden directories like .git do not count as changes
+ * @param  name
+ * @return      1 if changes of the entry are ignored
+ */
+int onchange_ignored(const char *name)
+{
+	size_t len = strlen(name);
+
+	return name[0] == '.' || (len > 0 && name[len - 1] == '~') || strcmp(name, "4913") == 0;
+}
+
+/**
+ * walkDirectory handler of onchange, watches every directory of a tree
+ */
+int onchange_visit(void *arg, char *path, struct dirent *entry)
+{
+	struct stat st;
+
+	if (onchange_ignored(entry->d_name))
+		return 0;
+	if (entry->d_type == DT_DIR || (entry->d_type == DT_UNKNOWN && lstat(path, &st) == 0 && S_ISDIR(st.st_mode)))
+		onchange_add(arg, path, NULL);
+	return 1;
+}
+
+/**
+ * Watches a directory and every directory below it
+ * @return 0 on success, -1 if the top directory could not be watched
+ */
+int onchange_add_tree(struct onchange_t *w, char *dir)
+{
+	if (onchange_add(w, dir, NULL) == -1)
+		return -1;
+	walkDirectory(dir, 1, onchange_visit, w);
+	return 0;
+}
+
+/**
+ * Watches a path given to onchange, a directory with its subtree or a file through its directory
+ * so that editors replacing the file are noticed too
+ * @return 0 on success, -1 on error
+ */
+int onchange_add_path(struct onchange_t *w, char *path)
+{
+	struct stat st;
+	char *slash, *dir;
+	int r;
+
+	if (stat(path, &st) == 0 && S_ISDIR(st.st_mode))
+		return onchange_add_tree(w, path);
+	dir = strdup(path);
+	slash = strrchr(dir, '/');
+	if (slash == NULL)
+		r = onchange_add(w, ".", path);
+	else if (slash == dir)
+		r = onchange_add(w, "/", slash + 1);
+	else {
+		*slash = '\0';
+		r = onchange_add(w, dir, slash + 1);
+	}
+	free(dir);
+	return r;
+}
+
+/**
+ * Matches an inotify event against the watches, new directories of a watched tree get watched
+ * @param  w
+ * @param  event
+ * @return       1 if the event is a change to act on
+ */
+int onchange_match(struct onchange_t *w, struct inotify_event *event)
+{
+	int matched = 0;
+
+	if (event->len == 0 || onchange_ignored(event->name))
+		return 0;
+	for (int i = 0, count = w->count; i < count; i++) {
+		struct onchange_watch_t *watch = &w->watches[i];
+
+		if (watch->wd != event->wd)
+			continue;
+		if (watch->name == NULL) {
+			if ((event->mask & IN_ISDIR) && (event->mask & (IN_CREATE | IN_MOVED_TO))) {
+				char path[512];
+
+				snprintf(path, sizeof(path), "%s/%s", watch->dir, event->name);
+				onchange_add_tree(w, path);
+			}
+			matched = 1;
+		}
+		else if (strcmp(watch->name, event->name) == 0)
+			matched = 1;
+	}
+	return matched;
+}
+
+/**
+ * Stops a run of onchange, SIGTERM to its group first and SIGKILL if it does not leave in time
+ * @param pid
+ * @return    exit code of the run
+ */
+int onchange_cancel(pid_t pid)
+{
+	struct timespec tick = { 0, 5000000 };
+	int status = 0;
+
+	kill(-pid, SIGTERM);
+	for (int waited = 0; waited < ONCHANGE_KILL_MS; waited += 5) {
+		if (waitpid(pid, &status, WNOHANG) != 0)
+			return exit_code(status);
+		nanosleep(&tick, NULL);
+	}
+	kill(-pid, SIGKILL);
+	waitpid(pid, &status, 0);
+	return exit_code(status);
+}
+
+/**
+ * Runs a command every time the given files or directory trees change, until Ctrl-C.
+ * Bursts of events are debounced and a run still going when the next one starts is cancelled.
+ * @param  argc
+ * @param  argv  argv[0] is the name of the builtin
+ * @param  io
+ * @return       exit status
+ */
+int builtin_onchange(int argc, char **argv, struct io_t *io)
+{
+	struct onchange_t w = { -1, NULL, 0, 0 };
+	long long debounce = ONCHANGE_DEBOUNCE_MS * 1000000LL, deadline = 0, started = 0;
+	char events[16384] __attribute__((aligned(__alignof__(struct inotify_event))));
+	sigset_t mask, saved;
+	int i = 1, separator, sfd, status = 0, stop = 0;
+	pid_t pid = -1;
+	char *command;
+
+	if (argc > 2 && strcmp(argv[1], "-d") == 0) {
+		if (parse_interval(argv[2], &debounce) == -1)
+			debounce = -1;
+		i = 3;
+	}
+	for (separator = i; separator < argc && strcmp(argv[separator], "--") != 0; separator++)
+		;
+	if (debounce < 0 || separator == i || separator >= argc - 1) {
+		fprintf(io->out, "usage: onchange [-d debounce] <path>... -- <command>\n");
+		return 2;
+	}
+
+	w.fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (w.fd == -1) {
+		fprintf(io->out, "-%s: %s: %s\n", sysname, argv[0], strerror(errno));
+		return 1;
+	}
+	//The shell does not expand globs, so they are expanded here
+	for (; i < separator; i++) {
+		glob_t paths;
+
+		if (glob(argv[i], GLOB_NOCHECK, NULL, &paths) != 0)
+			continue;
+		for (size_t j = 0; j < paths.gl_pathc; j++)
+			if (onchange_add_path(&w, paths.gl_pathv[j]) == -1)
+				fprintf(io->out, "-%s: %s: %s: %s\n", sysname, argv[0], paths.gl_pathv[j], strerror(errno));
+		globfree(&paths);
+	}
+	if (w.count == 0) {
+		close(w.fd);
+		return 1;
+	}
+
+	//^C and the end of a run come through a signalfd, as in the loop of the prompt
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGCHLD);
+	sigprocmask(SIG_BLOCK, &mask, &saved);
+	sfd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+	if (sfd == -1) {
+		fprintf(io->out, "-%s: %s: %s\n", sysname, argv[0], strerror(errno));
+		sigprocmask(SIG_SETMASK, &saved, NULL);
+		close(w.fd);
+		return 1;
+	}
+
+	command = join_command(argc - separator - 1, argv + separator + 1);
+	fprintf(io->out, "onchange: watching %d directories, press Ctrl-C to stop\n", w.count);
+	fflush(io->out);
+	//The first run shows the state before any change
+	deadline = now_ns();
+
+	while (!stop) {
+		struct pollfd fds[2] = { { w.fd, POLLIN, 0 }, { sfd, POLLIN, 0 } };
+		long long now = now_ns();
+		int timeout = deadline == 0 ? -1 : deadline <= now ? 0 : (int)((deadline - now + 999999) / 1000000);
+
+		if (poll(fds, 2, timeout) == -1 && errno != EINTR)
+			break;
+
+		if (fds[1].revents & POLLIN) {
+			struct signalfd_siginfo info;
+
+			while (read(sfd, &info, sizeof(info)) == sizeof(info))
+				if (info.ssi_signo == SIGINT)
+					stop = 1;
+			if (pid > 0 && waitpid(pid, &status, WNOHANG) == pid) {
+				fprintf(io->out, "onchange: exit %d in %.3f s\n", exit_code(status), (now_ns() - started) / 1e9);
+				fflush(io->out);
+				pid = -1;
+			}
+		}
+
+		if (fds[0].revents & POLLIN) {
+			ssize_t n;
+
+			while ((n = read(w.fd, events, sizeof(events))) > 0) {
+				for (char *p = events; p < events + n; p += sizeof(struct inotify_event) + ((struct inotify_event *)p)->len)
+					if (onchange_match(&w, (struct inotify_event *)p))
+						deadline = now_ns() + debounce;
+			}
+		}
+
+		if (!stop && deadline != 0 && now_ns() >= deadline) {
+			deadline = 0;
+			if (pid > 0) {
+				onchange_cancel(pid);
+				fprintf(io->out, "onchange: changed, restarting\n");
+			}
+			fflush(io->out);
+			started = now_ns();
+			pid = spawn_line(command, 0, -1);
+		}
+	}
+
+	if (pid > 0)
+		onchange_cancel(pid);
+	fprintf(io->out, "\n");
+	close(sfd);
+	sigprocmask(SIG_SETMASK, &saved, NULL);
+	close(w.fd);
+	for (i = 0; i < w.count; i++) {
+		free(w.watches[i].dir);
+		free(w.watches[i].name);
+	}
+	free(w.watches);
+	free(command);
+	return 0;
+}
+
+/**
+ * Lets the user pick one of the recently visited directories
+ * @param  argc
+ * @param  argv  argv[0] is the name of the builtin
+ * @param  io
+ * @return       exit status
+ */
+int builtin_cdh(int argc, char **argv, struct io_t *io)
+{
+	int r;
+
+	(void)argv;
+	if(argc > 1) {
+		fprintf(io->out, "cdh: Works with zero arguments.\n");
+		return 0;
+	}
+
+	else if(cdCount == 0) {
+		fprintf(io->out, "No previous directories to select from!\n");
+		return 0;
+	}
+
+	//Print cdHistory to user
+	printCdHistory(cdHistory);
+
+	char selected_dir[100];
+	char selected_dir_main[100];
+	pid_t pid;
+	int pipefds[2];
+	
+	//Scanf the input from the child and send it to parent with pipes
+	if(pipe(pipefds) == -1) {
+
+		fprintf(io->out, "Pipe failed!\n");
+	}
+
+	pid = shell_fork();
+
+	if(pid == 0) {
+
+		fprintf(io->out, "Select a directory by letter or number: ");
+		scanf("%s",selected_dir);
+
+		close(pipefds[0]);
+		write(pipefds[1],selected_dir,(strlen(selected_dir)+1));
+		exit(0);
+
+	}
+	else {
+		waitpid(pid, NULL, 0);
+
+		close(pipefds[1]);
+		read(pipefds[0],selected_dir_main,sizeof(selected_dir_main));
+
+		//Determine the index
+		if(strcmp(selected_dir_main, "a") == 0) {
+			strcpy(selected_dir_main, "1");
+		}
+		else if (strcmp(selected_dir_main, "b") == 0) {
+			strcpy(selected_dir_main, "2");
+		}
+		else if (strcmp(selected_dir_main, "c") == 0) {
+			strcpy(selected_dir_main, "3");
+		}
+		else if (strcmp(selected_dir_main, "d") == 0) {
+			strcpy(selected_dir_main, "4");
+		}
+		else if (strcmp(selected_dir_main, "e") == 0) {
+			strcpy(selected_dir_main, "5");
+		}
+		else if (strcmp(selected_dir_main, "f") == 0) {
+			strcpy(selected_dir_main, "6");
+		}
+		else if (strcmp(selected_dir_main, "g") == 0) {
+			strcpy(selected_dir_main, "7");
+		}
+		else if (strcmp(selected_dir_main, "h") == 0) {
+			strcpy(selected_dir_main, "8");
+		}
+		else if (strcmp(selected_dir_main, "i") == 0) {
+			strcpy(selected_dir_main, "9");
+		}
+		else if (strcmp(selected_dir_main, "j") == 0) {
+			strcpy(selected_dir_main, "10");
+		}
+
+		int index = atoi(selected_dir_main);	
+		
+		//Change directory and add it to cdHistory
+		r = chdir(cdHistory[cdCount - index]);
+		if (r == -1) {
+			fprintf(io->out, "Please provide a valid number or letter!\n");
+		}
+		else {
+		
+			char cwd[512];
+			if(getcwd(cwd,sizeof(cwd)) != NULL) {
+				addCdToHistory(cwd);
+			}
+		
+		}
+
+
+	}
+	return 0;
+}
+
+/**
+ * Creates the given directory path if needed and changes into it
+ * @param  argc
+ * @param  argv  argv[0] is the name of the builtin
+ * @param  io
+ * @return       exit status
+ */
+int builtin_take(int argc, char **argv, struct io_t *io)
+{
+	int r1,r2;
+	if(argc != 2) {
+		fprintf(io->out, "take: %s arguments.\n", argc > 2 ? "Too many" : "Too few");
+		fprintf(io->out, "Usage: take [DIRECTORY]\n");
+		return 2;
+	}
+	//Tokenizing the argument of take command
+	char *input = strdup(argv[1]);
+	char *token = strtok(input, "/");
+	
+	//for each token 
+	while( token != NULL ) {
+		
+		//make directory named token
+		r1 = mkdir(token, S_IRWXU);
+		if(r1 == -1) {
+			if(errno != EEXIST) {
+
+				fprintf(io->out, "-%s: %s: %s\n", sysname, argv[0], strerror(errno));
+				return 0;
+			}
+		}
+		//change directory to directory named token
+		r2 = chdir(token);
+		if (r2 == -1) {
+			fprintf(io->out, "-%s: %s: %s\n", sysname, argv[0], strerror(errno));
+			return 0;
+		}
+		//and add every directory changes to cdHistory
+		else {
+		
+			char cwd[512];
+			if(getcwd(cwd,sizeof(cwd)) != NULL) {
+				addCdToHistory(cwd);
+			}
+		
+		}
+
+		token = strtok(NULL, "/");
+	}
+	return 0;
+}
+
+//How often joker tells a joke
+#define JOKER_PERIOD (15 * 60 * 1000000000LL)
+
+//Id of the timer of joker, 0 when it was never scheduled
+int joker_timer = 0;
+
+/**
+ * Fetches a joke with curl and shows it as a notification
+ * @param  io
+ * @return    exit status
+ */
+int joker_tell(struct io_t *io)
+{
+	char joke[1024];
+	char *args[] = {"curl", "-s", "-m", "10", "-H", "Accept: text/plain", "https://icanhazdadjoke.com/", NULL};
+	size_t len = 0;
+	ssize_t n;
+	int fds[2], status;
+	pid_t pid;
+
+	if (pipe(fds) == -1) {
+		fprintf(io->out, "-%s: joker: %s\n", sysname, strerror(errno));
+		return 1;
+	}
+	fflush(NULL);
+	pid = shell_fork();
+	if (pid == 0) {
+		close(fds[0]);
+		dup2(fds[1], STDOUT_FILENO);
+		close(fds[1]);
+		execvp(args[0], args);
+		_exit(127);
+	}
+	close(fds[1]);
+	while (len < sizeof(joke) - 1 && (n = read(fds[0], joke + len, sizeof(joke) - 1 - len)) != 0) {
+		if (n == -1 && errno == EINTR)
+			continue;
+		if (n == -1)
+			break;
+		len += n;
+	}
+	close(fds[0]);
+	if (pid == -1 || waitpid(pid, &status, 0) == -1 || exit_code(status) != 0 || len == 0) {
+		fprintf(io->out, "joker: could not fetch a joke\n");
+		return 1;
+	}
+	while (len > 0 && isspace((unsigned char)joke[len - 1]))
+		len--;
+	joke[len] = '\0';
+	notify("JOKE", joke);
+	return 0;
+}
+
+/**
+ * Tells a joke every 15 minutes with a timer of the shell, joker --now tells one right away
+ * @param  argc
+ * @param  argv  argv[0] is the name of the builtin
+ * @param  io
+ * @return       exit status
+ */
+int builtin_joker(int argc, char **argv, struct io_t *io)
+{
+	if (argc == 2 && strcmp(argv[1], "--now") == 0)
+		return joker_tell(io);
+	if (argc != 1) {
+		fprintf(io->out, "usage: joker [--now]\n");
+		return 2;
+	}
+	if (joker_timer != 0 && timer_find(joker_timer) != NULL) {
+		fprintf(io->out, "joker: already telling jokes as timer %d\n", joker_timer);
+		return 0;
+	}
+	joker_timer = timer_add("joker --now", JOKER_PERIOD, JOKER_PERIOD, 0, 0);
+	if (joker_timer == -1) {
+		joker_timer = 0;
+		fprintf(io->out, "-%s: %s: %s\n", sysname, argv[0], strerror(errno));
+		return 1;
+	}
+	return 0;
+}
+
+/**
+ * Parses the options shared by every and at
+ * @param  i       index of the first option, left at the first word after them
+ * @param  jitter
+ * @param  overlap
+ * @param  cancel  id given with -d, 0 if none
+ * @return         0, or -1 for a bad option
+ */
+int timer_options(int argc, char **argv, int *i, long long *jitter, int *overlap, int *cancel)
+{
+	for (; *i < argc && argv[*i][0] == '-'; (*i)++) {
+		if (strcmp(argv[*i], "-o") == 0)
+			*overlap = 1;
+		else if (strcmp(argv[*i], "-j") == 0 && *i + 1 < argc && parse_interval(argv[*i + 1], jitter) == 0)
+			(*i)++;
+		else if (strcmp(argv[*i], "-d") == 0 && *i + 1 < argc && atoi(argv[*i + 1]) > 0)
+			*cancel = atoi(argv[++*i]);
+		else
+			return -1;
+	}
+	return 0;
+}
+
+/**
+ * Runs a command in the background at a fixed interval
+ * @param  argc
+ * @param  argv  argv[0] is the name of the builtin
+ * @param  io
+ * @return       exit status
+ */
+int builtin_every(int argc, char **argv, struct io_t *io)
+{
+	long long period, jitter = 0;
+	int i = 1, overlap = 0, cancel = 0, id;
+	char *command;
+
+	if (timer_options(argc, argv, &i, &jitter, &overlap, &cancel) == -1 || (cancel == 0 && argc - i < 2)
+		|| (cancel == 0 && (parse_interval(argv[i], &period) == -1 || period <= 0))) {
+		fprintf(io->out, "usage: every [-j jitter] [-o] <interval> <command>\n");
+		fprintf(io->out, "       every -d <id>\n");
+		return 2;
+	}
+	if (cancel) {
+		if (timer_cancel(cancel) == -1) {
+			fprintf(io->out, "every: no timer %d\n", cancel);
+			return 1;
+		}
+		return 0;
+	}
+	command = join_command(argc - i - 1, argv + i + 1);
+	id = timer_add(command, period, period, jitter, overlap);
+	free(command);
+	if (id == -1) {
+		fprintf(io->out, "-%s: %s: %s\n", sysname, argv[0], strerror(errno));
+		return 1;
+	}
+	fprintf(io->out, "[timer %d]\n", id);
+	return 0;
+}
+
+/**
+ * Runs a command once in the background, at a clock time HH:MM[:SS] or after +<interval>
+ * @param  argc
+ * @param  argv  argv[0] is the name of the builtin
+ * @param  io
+ * @return       exit status
+ */
+int builtin_at(int argc, char **argv, struct io_t *io)
+{
+	long long delay = -1, jitter = 0;
+	int i = 1, overlap = 0, cancel = 0, id, hour, minute, second = 0;
+	char *command;
+
+	if (timer_options(argc, argv, &i, &jitter, &overlap, &cancel) == 0 && cancel == 0 && argc - i >= 2) {
+		if (argv[i][0] == '+') {
+			if (parse_interval(argv[i] + 1, &delay) == -1)
+				delay = -1;
+		}
+		else if (sscanf(argv[i], "%d:%d:%d", &hour, &minute, &second) >= 2
+			&& hour >= 0 && hour < 24 && minute >= 0 && minute < 60 && second >= 0 && second < 60) {
+			time_t now = time(NULL), then;
+			struct tm tm;
+
+			//Today, or tomorrow if the time has passed
+			localtime_r(&now, &tm);
+			tm.tm_hour = hour;
+			tm.tm_min = minute;
+			tm.tm_sec = second;
+			then = mktime(&tm);
+			if (then <= now) {
+				tm.tm_mday++;
+				then = mktime(&tm);
+			}
+			delay = (long long)(then - now) * 1000000000LL;
+		}
+	}
+	if (cancel) {
+		if (timer_cancel(cancel) == -1) {
+			fprintf(io->out, "at: no timer %d\n", cancel);
+			return 1;
+		}
+		return 0;
+	}
+	if (delay < 0) {
+		fprintf(io->out, "usage: at [-j jitter] <HH:MM[:SS] | +interval> <command>\n");
+		fprintf(io->out, "       at -d <id>\n");
+		return 2;
+	}
+	command = join_command(argc - i - 1, argv + i + 1);
+	id = timer_add(command, delay, 0, jitter, overlap);
+	free(command);
+	if (id == -1) {
+		fprintf(io->out, "-%s: %s: %s\n", sysname, argv[0], strerror(errno));
+		return 1;
+	}
+	fprintf(io->out, "[timer %d]\n", id);
+	return 0;
+}
+
+/**
+ * Formats an interval with the largest unit that keeps it readable
+ * @param buf
+ * @param size
+ * @param ns
+ */
+void format_interval(char *buf, size_t size, long long ns)
+{
+	if (ns >= 86400000000000LL)
+		snprintf(buf, size, "%.1fd", ns / 86400e9);
+	else if (ns >= 3600000000000LL)
+		snprintf(buf, size, "%.1fh", ns / 3600e9);
+	else if (ns >= 60000000000LL)
+		snprintf(buf, size, "%.1fm", ns / 60e9);
+	else
+		snprintf(buf, size, "%.1fs", ns / 1e9);
+}
+
+/**
+ * Lists the background jobs, or with --timers the timers of every and at in the order they run
+ * @param  argc
+ * @param  argv  argv[0] is the name of the builtin
+ * @param  io
+ * @return       exit status
+ */
+int builtin_jobs(int argc, char **argv, struct io_t *io)
+{
+	struct shell_timer_t **sorted;
+	long long now = now_ns();
+
+	if (argc > 2 || (argc == 2 && strcmp(argv[1], "--timers") != 0)) {
+		fprintf(io->out, "usage: jobs [--timers]\n");
+		return 2;
+	}
+	if (argc == 1) {
+		job_reap();
+		for (struct job_t *job = job_list; job; job = job->next)
+			if (job->running > 0)
+				fprintf(io->out, "[%d]  Running\t\t%s &\n", job->id, job->command);
+		return 0;
+	}
+	timer_reap();
+	sorted = malloc(sizeof(struct shell_timer_t *) * (timer_count ? timer_count : 1));
+	memcpy(sorted, timer_heap, sizeof(struct shell_timer_t *) * timer_count);
+	for (size_t i = 1; i < timer_count; i++)
+		for (size_t j = i; j > 0 && sorted[j]->when < sorted[j - 1]->when; j--) {
+			struct shell_timer_t *t = sorted[j];
+			sorted[j] = sorted[j - 1];
+			sorted[j - 1] = t;
+		}
+
+	fprintf(io->out, "%4s %8s %8s %6s %7s %8s  %s\n", "ID", "NEXT", "EVERY", "RUNS", "SKIPPED", "STATE", "COMMAND");
+	for (size_t i = 0; i < timer_count; i++) {
+		struct shell_timer_t *t = sorted[i];
+		char next[32] = "-", every[32] = "once", state[32];
+
+		if (!t->done)
+			format_interval(next, sizeof(next), t->when > now ? t->when - now : 0);
+		if (t->period)
+			format_interval(every, sizeof(every), t->period);
+		if (t->running)
+			snprintf(state, sizeof(state), "running");
+		else if (t->runs)
+			snprintf(state, sizeof(state), "exit %d", t->last_status);
+		else
+			snprintf(state, sizeof(state), "waiting");
+		fprintf(io->out, "%4d %8s %8s %6lu %7lu %8s  %s\n", t->id, next, every, t->runs, t->skipped, state, t->command);
+	}
+	free(sorted);
+	return 0;
+}
+
+//Arbitrary precision integers of madmath, magnitude in base 10^9 limbs with the least significant first
+#define BN_BASE 1000000000u
+#define BN_DIGITS 9
+//Operands below this many limbs are multiplied with the schoolbook method
+#define KARATSUBA_THRESHOLD 40
+
+struct bignum_t {
+	uint32_t *d;
+	size_t len; // 0 for zero
+	size_t cap;
+	int neg;
+};
+
+/**
+ * Adds b into a, a has an >= bn limbs
+ * @return carry out of a
+ */
+uint32_t limbs_add_to(uint32_t *a, size_t an, const uint32_t *b, size_t bn)
+{
+	uint32_t carry = 0;
+	size_t i;
+
+	for (i = 0; i < bn; i++) {
+		uint32_t s = a[i] + b[i] + carry;
+		carry = s >= BN_BASE;
+		a[i] = carry ? s - BN_BASE : s;
+	}
+	for (; carry && i < an; i++) {
+		carry = ++a[i] == BN_BASE;
+		if (carry)
+			a[i] = 0;
+	}
+	return carry;
+}
+
+/**
+ * Subtracts b from a, a has an >= bn limbs and is not smaller than b
+ */
+void limbs_sub_from(uint32_t *a, size_t an, const uint32_t *b, size_t bn)
+{
+	uint32_t borrow = 0;
+	size_t i;
+
+	for (i = 0; i < bn; i++) {
+		int64_t d = (int64_t)a[i] - b[i] - borrow;
+		borrow = d < 0;
+		a[i] = borrow ? d + BN_BASE : d;
+	}
+	for (; borrow && i < an; i++) {
+		borrow = a[i] == 0;
+		a[i] = borrow ? BN_BASE - 1 : a[i] - 1;
+	}
+}
+
+/**
+ * r = a * b with the schoolbook method, r has an + bn limbs
+ */
+void limbs_mul_school(uint32_t *r, const uint32_t *a, size_t an, const uint32_t *b, size_t bn)
+{
+	memset(r, 0, sizeof(uint32_t) * (an + bn));
+	for (size_t i = 0; i < an; i++) {
+		uint64_t carry = 0, ai = a[i];
+
+		if (ai == 0)
+			continue;
+		for (size_t j = 0; j < bn; j++) {
+			uint64_t t = r[i + j] + ai * b[j] + carry;
+			carry = t / BN_BASE;
+			r[i + j] = t % BN_BASE;
+		}
+		r[i + bn] = carry;
+	}
+}
+
+/**
+ * r = a * b with Karatsuba, both have n limbs and r has 2n
+ */
+void limbs_mul_karatsuba(uint32_t *r, const uint32_t *a, const uint32_t *b, size_t n)
+{
+	size_t m = n / 2, h = n - m;
+	uint32_t *sa, *sb, *z1;
+
+	if (n < KARATSUBA_THRESHOLD) {
+		limbs_mul_school(r, a, n, b, n);
+		return;
+	}
+
+	//z0 = a0 * b0 and z2 = a1 * b1 go straight to their place in r
+	limbs_mul_karatsuba(r, a, b, m);
+	limbs_mul_karatsuba(r + 2 * m, a + m, b + m, h);
+
+	//z1 = (a0 + a1)(b0 + b1) - z0 - z2
+	sa = malloc(sizeof(uint32_t) * (4 * h + 4));
+	sb = sa + h + 1;
+	z1 = sb + h + 1;
+	memcpy(sa, a + m, sizeof(uint32_t) * h);
+	memcpy(sb, b + m, sizeof(uint32_t) * h);
+	sa[h] = sb[h] = 0;
+	limbs_add_to(sa, h + 1, a, m);
+	limbs_add_to(sb, h + 1, b, m);
+	limbs_mul_karatsuba(z1, sa, sb, h + 1);
+	limbs_sub_from(z1, 2 * h + 2, r, 2 * m);
+	limbs_sub_from(z1, 2 * h + 2, r + 2 * m, 2 * h);
+
+	//z1 < 2 * BASE^n, so its limbs above n + h are zero
+	limbs_add_to(r + m, n + h, z1, 2 * h + 2 < n + h ? 2 * h + 2 : n + h);
+	free(sa);
+}
+
+//Products with both operands at least this many limbs go through the NTT
+#define NTT_THRESHOLD 1500
+//Longest transform, 2^23 is the limit of 998244353
+#define NTT_MAX_LENGTH (1u << 23)
+
+//An NTT prime with its Montgomery constants, R = 2^32
+struct ntt_prime_t {
+	uint32_t p;
+	uint32_t pinv; // -p^-1 mod R
+	uint32_t r2;   // R^2 mod p
+};
+
+//Three primes with primitive root 3, their product bounds every coefficient up to 2^23 * 10^18
+struct ntt_prime_t ntt_primes[3] = { { .p = 998244353 }, { .p = 167772161 }, { .p = 469762049 } };
+
+uint32_t mont_reduce(uint64_t t, const struct ntt_prime_t *q)
+{
+	uint32_t m = (uint32_t)t * q->pinv;
+	uint32_t u = (t + (uint64_t)m * q->p) >> 32;
+
+	return u >= q->p ? u - q->p : u;
+}
+
+uint32_t mont_mul(uint32_t a, uint32_t b, const struct ntt_prime_t *q)
+{
+	return mont_reduce((uint64_t)a * b, q);
+}
+
+uint32_t pow_mod(uint64_t b, uint64_t e, uint32_t p)
+{
+	uint64_t r = 1;
+
+	for (b %= p; e; e >>= 1, b = b * b % p)
+		if (e & 1)
+			r = r * b % p;
+	return r;
+}
+
+void ntt_init_primes()
+{
+	for (int i = 0; i < 3; i++) {
+		struct ntt_prime_t *q = &ntt_primes[i];
+		uint32_t inv = q->p;
+
+		//Newton iteration for p^-1 mod 2^32, each step doubles the correct bits
+		for (int k = 0; k < 5; k++)
+			inv *= 2 - q->p * inv;
+		q->pinv = -inv;
+		q->r2 = ((uint64_t)1 << 32) % q->p;
+		q->r2 = (uint64_t)q->r2 * q->r2 % q->p;
+	}
+}
+
+/**
+ * In place transform of n values in Montgomery form, the inverse also divides by n and
+ * leaves the values in normal form
+ * @param roots room for n / 2 values
+ */
+void ntt_transform(uint32_t *a, size_t n, int inverse, const struct ntt_prime_t *q, uint32_t *roots)
+{
+	uint32_t p = q->p;
+
+	for (size_t i = 1, j = 0; i < n; i++) {
+		size_t bit = n >> 1;
+
+		for (; j & bit; bit >>= 1)
+			j ^= bit;
+		j ^= bit;
+		if (i < j) {
+			uint32_t t = a[i];
+			a[i] = a[j];
+			a[j] = t;
+		}
+	}
+
+	for (size_t len = 2; len <= n; len <<= 1) {
+		size_t half = len / 2;
+		uint32_t w = pow_mod(3, (p - 1) / len, p);
+
+		if (inverse)
+			w = pow_mod(w, p - 2, p);
+		w = mont_mul(w, q->r2, q);
+		roots[0] = mont_mul(1, q->r2, q);
+		for (size_t k = 1; k < half; k++)
+			roots[k] = mont_mul(roots[k - 1], w, q);
+
+		for (size_t i = 0; i < n; i += len) {
+			for (size_t k = 0; k < half; k++) {
+				uint32_t u = a[i + k];
+				uint32_t v = mont_mul(a[i + k + half], roots[k], q);
+
+				a[i + k] = u + v >= p ? u + v - p : u + v;
+				a[i + k + half] = u >= v ? u - v : u + p - v;
+			}
+		}
+	}
+
+	if (inverse) {
+		uint32_t ninv = pow_mod(n, p - 2, p);
+
+		for (size_t i = 0; i < n; i++)
+			a[i] = mont_mul(a[i], ninv, q);
+	}
+}
+
+//Convolution of the limbs modulo one prime
+struct ntt_job_t {
+	const uint32_t *a, *b;
+	size_t an, bn, n;
+	const struct ntt_prime_t *q;
+	uint32_t *out; // n values
+};
+
+void *ntt_job(void *arg)
+{
+	struct ntt_job_t *job = arg;
+	const struct ntt_prime_t *q = job->q;
+	int square = job->a == job->b && job->an == job->bn;
+	uint32_t *fa = calloc(job->n, sizeof(uint32_t));
+	uint32_t *fb = square ? fa : calloc(job->n, sizeof(uint32_t));
+	uint32_t *roots = malloc(sizeof(uint32_t) * (job->n / 2));
+
+	for (size_t i = 0; i < job->an; i++)
+		fa[i] = mont_mul(job->a[i] % q->p, q->r2, q);
+	ntt_transform(fa, job->n, 0, q, roots);
+	if (!square) {
+		for (size_t i = 0; i < job->bn; i++)
+			fb[i] = mont_mul(job->b[i] % q->p, q->r2, q);
+		ntt_transform(fb, job->n, 0, q, roots);
+	}
+	for (size_t i = 0; i < job->n; i++)
+		fa[i] = mont_mul(fa[i], fb[i], q);
+	ntt_transform(fa, job->n, 1, q, roots);
+
+	job->out = fa;
+	if (!square)
+		free(fb);
+	free(roots);
+	return NULL;
+}
+
+/**
+ * r = a * b with three NTTs in parallel and the Chinese remainder theorem, r has an + bn limbs
+ * @return 0, or -1 if the product is too long for the transform
+ */
+int limbs_mul_ntt(uint32_t *r, const uint32_t *a, size_t an, const uint32_t *b, size_t bn)
+{
+	static pthread_once_t once = PTHREAD_ONCE_INIT;
+	struct ntt_job_t jobs[3];
+	pthread_t threads[3];
+	int started[3];
+	size_t n = 1;
+	uint32_t p1 = ntt_primes[0].p, p2 = ntt_primes[1].p, p3 = ntt_primes[2].p;
+	uint64_t p1_inv_p2, p12_inv_p3, p12 = (uint64_t)p1 * p2;
+	unsigned __int128 carry = 0;
+
+	while (n < an + bn)
+		n <<= 1;
+	if (n > NTT_MAX_LENGTH)
+		return -1;
+	pthread_once(&once, ntt_init_primes);
+
+	for (int i = 0; i < 3; i++) {
+		jobs[i] = (struct ntt_job_t){ a, b, an, bn, n, &ntt_primes[i], NULL };
+		started[i] = i > 0 && pthread_create(&threads[i], NULL, ntt_job, &jobs[i]) == 0;
+		if (!started[i] && i > 0)
+			ntt_job(&jobs[i]);
+	}
+	ntt_job(&jobs[0]);
+	for (int i = 1; i < 3; i++)
+		if (started[i])
+			pthread_join(threads[i], NULL);
+
+	//x = r1 + p1 * t2 + p1 * p2 * t3, then carried into base 10^9 limbs
+	p1_inv_p2 = pow_mod(p1, p2 - 2, p2);
+	p12_inv_p3 = pow_mod(p12 % p3, p3 - 2, p3);
+	for (size_t i = 0; i < an + bn; i++) {
+		uint64_t r1 = jobs[0].out[i], r2 = jobs[1].out[i], r3 = jobs[2].out[i];
+		uint64_t t2 = (r2 + p2 - r1 % p2) % p2 * p1_inv_p2 % p2;
+		uint64_t x12 = r1 + p1 * t2;
+		uint64_t t3 = (r3 + p3 - x12 % p3) % p3 * p12_inv_p3 % p3;
+		unsigned __int128 x = (unsigned __int128)p12 * t3 + x12 + carry;
+
+		carry = x / BN_BASE;
+		r[i] = x % BN_BASE;
+	}
+	for (int i = 0; i < 3; i++)
+		free(jobs[i].out);
+	return 0;
+}
+
+/**
+ * r = a * b, r has an + bn limbs and does not overlap a or b
+ */
+void limbs_mul(uint32_t *r, const uint32_t *a, size_t an, const uint32_t *b, size_t bn)
+{
+	uint32_t *t;
+
+	if (an < bn) {
+		const uint32_t *swap = a;
+		size_t swap_n = an;
+		a = b, an = bn, b = swap, bn = swap_n;
+	}
+	if (bn < KARATSUBA_THRESHOLD) {
+		limbs_mul_school(r, a, an, b, bn);
+		return;
+	}
+	if (bn >= NTT_THRESHOLD && limbs_mul_ntt(r, a, an, b, bn) == 0)
+		return;
+	if (an == bn) {
+		limbs_mul_karatsuba(r, a, b, an);
+		return;
+	}
+
+	//Unbalanced, a is cut in pieces of the size of b
+	memset(r, 0, sizeof(uint32_t) * (an + bn));
+	t = malloc(sizeof(uint32_t) * 2 * bn);
+	for (size_t off = 0; off < an; off += bn) {
+		size_t len = an - off < bn ? an - off : bn;
+
+		limbs_mul(t, a + off, len, b, bn);
+		limbs_add_to(r + off, an + bn - off, t, len + bn);
+	}
+	free(t);
+}
+
+void bn_init(struct bignum_t *x)
+{
+	x->d = NULL;
+	x->len = x->cap = 0;
+	x->neg = 0;
+}
+
+void bn_free(struct bignum_t *x)
+{
+	free(x->d);
+	bn_init(x);
+}
+
+void bn_reserve(struct bignum_t *x, size_t n)
+{
+	if (n > x->cap) {
+		x->d = realloc(x->d, sizeof(uint32_t) * n);
+		x->cap = n;
+	}
+}
+
+//Drops leading zero limbs, zero is never negative
+void bn_trim(struct bignum_t *x)
+{
+	while (x->len > 0 && x->d[x->len - 1] == 0)
+		x->len--;
+	if (x->len == 0)
+		x->neg = 0;
+}
+
+//Replaces x with y and frees what x held
+void bn_move(struct bignum_t *x, struct bignum_t *y)
+{
+	free(x->d);
+	*x = *y;
+	bn_init(y);
+}
+
+void bn_set_u64(struct bignum_t *x, uint64_t v)
+{
+	bn_reserve(x, 3);
+	x->len = 0;
+	x->neg = 0;
+	while (v > 0) {
+		x->d[x->len++] = v % BN_BASE;
+		v /= BN_BASE;
+	}
+}
+
+void bn_copy(struct bignum_t *x, const struct bignum_t *y)
+{
+	if (x == y)
+		return;
+	bn_reserve(x, y->len);
+	if (y->len)
+		memcpy(x->d, y->d, sizeof(uint32_t) * y->len);
+	x->len = y->len;
+	x->neg = y->neg;
+}
+
+/**
+ * Parses a decimal integer with an optional sign
+ * @return 0, or -1 if s is not a number
+ */
+int bn_parse(struct bignum_t *x, const char *s)
+{
+	size_t digits, i;
+	int neg = 0;
+
+	if (*s == '-' || *s == '+')
+		neg = *s++ == '-';
+	digits = strlen(s);
+	if (digits == 0 || strspn(s, "0123456789") != digits)
+		return -1;
+
+	bn_reserve(x, digits / BN_DIGITS + 1);
+	x->len = 0;
+	//Nine digits per limb, taken from the end of the string
+	for (i = digits; i > 0;) {
+		size_t start = i > BN_DIGITS ? i - BN_DIGITS : 0;
+		uint32_t limb = 0;
+
+		for (size_t k = start; k < i; k++)
+			limb = limb * 10 + (s[k] - '0');
+		x->d[x->len++] = limb;
+		i = start;
+	}
+	x->neg = neg;
+	bn_trim(x);
+	return 0;
+}
+
+//Writes x in decimal without a newline
+void bn_write(FILE *out, const struct bignum_t *x)
+{
+	if (x->len == 0) {
+		fputc('0', out);
+		return;
+	}
+	if (x->neg)
+		fputc('-', out);
+	fprintf(out, "%u", x->d[x->len - 1]);
+	for (size_t i = x->len - 1; i-- > 0;)
+		fprintf(out, "%09u", x->d[i]);
+}
+
+void bn_print(FILE *out, const struct bignum_t *x)
+{
+	bn_write(out, x);
+	fputc('\n', out);
+}
+
+int bn_cmp_abs(const struct bignum_t *a, const struct bignum_t *b)
+{
+	if (a->len != b->len)
+		return a->len < b->len ? -1 : 1;
+	for (size_t i = a->len; i-- > 0;)
+		if (a->d[i] != b->d[i])
+			return a->d[i] < b->d[i] ? -1 : 1;
+	return 0;
+}
+
+/**
+ * r = a + b, or a - b when b_neg flips the sign of b, r may be a or b
+ */
+void bn_add_signed(struct bignum_t *r, const struct bignum_t *a, const struct bignum_t *b, int b_neg)
+{
+	struct bignum_t t;
+	const struct bignum_t *big = a, *small = b;
+	int big_neg = a->neg, small_neg = b_neg;
+
+	if (bn_cmp_abs(a, b) < 0) {
+		big = b, small = a;
+		big_neg = b_neg, small_neg = a->neg;
+	}
+	bn_init(&t);
+	bn_reserve(&t, big->len + 1);
+	if (big->len)
+		memcpy(t.d, big->d, sizeof(uint32_t) * big->len);
+	t.d[big->len] = 0;
+	t.len = big->len + 1;
+	if (big_neg == small_neg)
+		limbs_add_to(t.d, t.len, small->d, small->len);
+	else
+		limbs_sub_from(t.d, t.len, small->d, small->len);
+	t.neg = big_neg;
+	bn_trim(&t);
+	bn_move(r, &t);
+}
+
+void bn_add(struct bignum_t *r, const struct bignum_t *a, const struct bignum_t *b)
+{
+	bn_add_signed(r, a, b, b->neg);
+}
+
+void bn_sub(struct bignum_t *r, const struct bignum_t *a, const struct bignum_t *b)
+{
+	bn_add_signed(r, a, b, !b->neg && b->len);
+}
+
+//r = a * b, r may be a or b
+void bn_mul(struct bignum_t *r, const struct bignum_t *a, const struct bignum_t *b)
+{
+	struct bignum_t t;
+
+	bn_init(&t);
+	if (a->len && b->len) {
+		bn_reserve(&t, a->len + b->len);
+		limbs_mul(t.d, a->d, a->len, b->d, b->len);
+		t.len = a->len + b->len;
+		t.neg = a->neg != b->neg;
+		bn_trim(&t);
+	}
+	bn_move(r, &t);
+}
+
+//x *= m with m below BN_BASE
+void bn_mul_small(struct bignum_t *x, uint32_t m)
+{
+	uint64_t carry = 0;
+
+	for (size_t i = 0; i < x->len; i++) {
+		uint64_t t = (uint64_t)x->d[i] * m + carry;
+		x->d[i] = t % BN_BASE;
+		carry = t / BN_BASE;
+	}
+	if (carry) {
+		bn_reserve(x, x->len + 1);
+		x->d[x->len++] = carry;
+	}
+	bn_trim(x);
+}
+
+//x /= m with m below BN_BASE, returns the remainder of the magnitude
+uint32_t bn_div_small(struct bignum_t *x, uint32_t m)
+{
+	uint64_t rem = 0;
+
+	for (size_t i = x->len; i-- > 0;) {
+		uint64_t t = rem * BN_BASE + x->d[i];
+		x->d[i] = t / m;
+		rem = t % m;
+	}
+	bn_trim(x);
+	return rem;
+}
+
+/**
+ * Truncating division like C, q = a / b and r = a % b, either may be NULL
+ * Knuth's algorithm D on base 10^9 limbs
+ * @return 0, or -1 if b is zero
+ */
+int bn_divmod(struct bignum_t *q, struct bignum_t *r, const struct bignum_t *a, const struct bignum_t *b)
+{
+	struct bignum_t u, v, quot;
+	size_t n = b->len, m;
+	uint32_t f;
+
+	if (b->len == 0)
+		return -1;
+	bn_init(&u);
+	bn_init(&v);
+	bn_init(&quot);
+	bn_copy(&u, a);
+	u.neg = 0;
+
+	if (bn_cmp_abs(a, b) < 0) {
+		//quot stays zero and u is the remainder
+	}
+	else if (n == 1) {
+		uint32_t rem = bn_div_small(&u, b->d[0]);
+
+		bn_move(&quot, &u);
+		bn_set_u64(&u, rem);
+	}
+	else {
+		//Normalized so that the top limb of v is at least BASE / 2
+		f = BN_BASE / (b->d[n - 1] + 1);
+		bn_copy(&v, b);
+		v.neg = 0;
+		bn_mul_small(&u, f);
+		bn_mul_small(&v, f);
+		bn_reserve(&u, u.len + 1);
+		u.d[u.len++] = 0;
+		m = u.len - n - 1;
+		bn_reserve(&quot, m + 1);
+		quot.len = m + 1;
+
+		for (size_t j = m + 1; j-- > 0;) {
+			uint64_t num = (uint64_t)u.d[j + n] * BN_BASE + u.d[j + n - 1];
+			uint64_t qhat = num / v.d[n - 1], rhat = num % v.d[n - 1];
+			int64_t borrow = 0, t;
+			uint64_t carry = 0;
+
+			while (qhat >= BN_BASE || qhat * v.d[n - 2] > rhat * BN_BASE + u.d[j + n - 2]) {
+				qhat--;
+				rhat += v.d[n - 1];
+				if (rhat >= BN_BASE)
+					break;
+			}
+
+			//u[j..j+n] -= qhat * v
+			for (size_t i = 0; i < n; i++) {
+				uint64_t p = qhat * v.d[i] + carry;
+				carry = p / BN_BASE;
+				t = (int64_t)u.d[i + j] - (int64_t)(p % BN_BASE) - borrow;
+				borrow = t < 0;
+				u.d[i + j] = borrow ? t + BN_BASE : t;
+			}
+			t = (int64_t)u.d[j + n] - (int64_t)carry - borrow;
+			borrow = t < 0;
+			u.d[j + n] = borrow ? t + BN_BASE : t;
+
+			//qhat was one too big, add v back
+			if (borrow) {
+				qhat--;
+				u.d[j + n] = (u.d[j + n] + limbs_add_to(u.d + j, n, v.d, n)) % BN_BASE;
+			}
+			quot.d[j] = qhat;
+		}
+		bn_trim(&quot);
+		u.len = n;
+		bn_trim(&u);
+		bn_div_small(&u, f);
+	}
+
+	quot.neg = quot.len && a->neg != b->neg;
+	u.neg = u.len && a->neg;
+	if (q)
+		bn_move(q, &quot);
+	if (r)
+		bn_move(r, &u);
+	bn_free(&u);
+	bn_free(&v);
+	bn_free(&quot);
+	return 0;
+}
+
+/**
+ * r = base^exp by squaring from the top bit down
+ */
+void bn_pow(struct bignum_t *r, const struct bignum_t *base, uint64_t exp)
+{
+	struct bignum_t result;
+	int bit = 63;
+
+	bn_init(&result);
+	bn_set_u64(&result, 1);
+	while (bit >= 0 && !(exp >> bit & 1))
+		bit--;
+	for (; bit >= 0; bit--) {
+		bn_mul(&result, &result, &result);
+		if (exp >> bit & 1)
+			bn_mul(&result, &result, base);
+	}
+	bn_move(r, &result);
+}
+
+/**
+ * r = product of the factors lo up to hi, split in halves so that the operands stay balanced
+ * @param factors each below BN_BASE
+ */
+void bn_product(struct bignum_t *r, const uint32_t *factors, size_t lo, size_t hi)
+{
+	struct bignum_t right;
+
+	if (hi - lo <= 16) {
+		bn_set_u64(r, 1);
+		for (size_t i = lo; i < hi; i++)
+			bn_mul_small(r, factors[i]);
+		return;
+	}
+	bn_init(&right);
+	bn_product(r, factors, lo, (lo + hi) / 2);
+	bn_product(&right, factors, (lo + hi) / 2, hi);
+	bn_mul(r, r, &right);
+	bn_free(&right);
+}
+
+/**
+ * r = n! with the prime swing, n! = ((n / 2)!)^2 * swing(n)
+ * where swing(n) = n! / ((n / 2)!)^2 has the exponent of a prime p equal to
+ * the number of k with floor(n / p^k) odd
+ * @param sieve  sieve[i] is 1 for the composite numbers up to n
+ * @param factors room for the primes up to n
+ */
+void bn_factorial_swing(struct bignum_t *r, uint32_t n, const char *sieve, uint32_t *factors)
+{
+	struct bignum_t swing;
+	size_t count = 0;
+
+	if (n < 2) {
+		bn_set_u64(r, 1);
+		return;
+	}
+	bn_factorial_swing(r, n / 2, sieve, factors);
+	bn_mul(r, r, r);
+
+	for (uint32_t p = 2; p <= n; p++) {
+		uint64_t power = 1;
+
+		if (sieve[p])
+			continue;
+		for (uint64_t q = n / p; q > 0; q /= p)
+			if (q & 1)
+				power *= p;
+		//Prime powers of the swing never exceed n
+		if (power > 1)
+			factors[count++] = power;
+	}
+	bn_init(&swing);
+	bn_product(&swing, factors, 0, count);
+	bn_mul(r, r, &swing);
+	bn_free(&swing);
+}
+
+void bn_factorial(struct bignum_t *r, uint32_t n)
+{
+	char *sieve = calloc(n + 1, 1);
+	uint32_t *factors = malloc(sizeof(uint32_t) * (n / 2 + 2));
+
+	for (uint64_t i = 2; i * i <= n; i++)
+		if (!sieve[i])
+			for (uint64_t j = i * i; j <= n; j += i)
+				sieve[j] = 1;
+	bn_factorial_swing(r, n, sieve, factors);
+	free(sieve);
+	free(factors);
+}
+
+//x *= BASE^s for s > 0, x /= BASE^-s truncating for s < 0
+void bn_shift_limbs(struct bignum_t *x, long s)
+{
+	if (x->len == 0)
+		return;
+	if (s > 0) {
+		bn_reserve(x, x->len + s);
+		memmove(x->d + s, x->d, sizeof(uint32_t) * x->len);
+		memset(x->d, 0, sizeof(uint32_t) * s);
+		x->len += s;
+	}
+	else if (s < 0) {
+		if ((size_t)-s >= x->len) {
+			x->len = 0;
+		}
+		else {
+			memmove(x->d, x->d - s, sizeof(uint32_t) * (x->len + s));
+			x->len += s;
+		}
+		bn_trim(x);
+	}
+}
+
+//Below this many limbs of quotient or divisor bn_divide uses the long division
+#define NEWTON_THRESHOLD 400
+
+/**
+ * q = floor(n / d) for positive n and d, with a Newton reciprocal of d when both are big.
+ * The reciprocal R = BASE^(L + k) / d is refined from a few limbs with
+ * R += R * (BASE^2p - D * R) / BASE^2p where D holds the top p limbs of d, each step goes
+ * from p to 2p - 1 limbs so the rounding error stays below a limb instead of squaring too.
+ */
+void bn_divide(struct bignum_t *q, const struct bignum_t *n, const struct bignum_t *d)
+{
+	struct bignum_t r, top, e, t, one;
+	size_t L = d->len, k, p;
+
+	if (bn_cmp_abs(n, d) < 0) {
+		bn_set_u64(q, 0);
+		return;
+	}
+	k = n->len - L + 2;
+	if (L < NEWTON_THRESHOLD || k < NEWTON_THRESHOLD) {
+		bn_divmod(q, NULL, n, d);
+		return;
+	}
+	bn_init(&r);
+	bn_init(&top);
+	bn_init(&e);
+	bn_init(&t);
+	bn_init(&one);
+
+	//Start with 16 limbs by long division
+	p = 16;
+	bn_copy(&top, d);
+	bn_shift_limbs(&top, (long)p - (long)L);
+	bn_set_u64(&one, 1);
+	bn_shift_limbs(&one, 2 * p);
+	bn_divmod(&r, NULL, &one, &top);
+
+	while (p < k) {
+		size_t next = 2 * p - 1 < k ? 2 * p - 1 : k;
+
+		bn_shift_limbs(&r, next - p);
+		p = next;
+		bn_copy(&top, d);
+		bn_shift_limbs(&top, (long)p - (long)L);
+
+		//e = BASE^2p - top * r, r += r * e / BASE^2p
+		bn_set_u64(&one, 1);
+		bn_shift_limbs(&one, 2 * p);
+		bn_mul(&t, &top, &r);
+		bn_sub(&e, &one, &t);
+		bn_mul(&t, &r, &e);
+		bn_shift_limbs(&t, -(long)(2 * p));
+		bn_add(&r, &r, &t);
+	}
+
+	//q = n * r / BASE^(L + k), then corrected by the remainder
+	bn_mul(&t, n, &r);
+	bn_shift_limbs(&t, -(long)(L + k));
+	bn_mul(&e, &t, d);
+	bn_sub(&e, n, &e);
+	bn_set_u64(&one, 1);
+	while (e.neg) {
+		bn_sub(&t, &t, &one);
+		bn_add(&e, &e, d);
+	}
+	while (bn_cmp_abs(&e, d) >= 0) {
+		bn_add(&t, &t, &one);
+		bn_sub(&e, &e, d);
+	}
+	bn_move(q, &t);
+	bn_free(&r);
+	bn_free(&top);
+	bn_free(&e);
+	bn_free(&one);
+}
+
+/**
+ * z = BASE^p / sqrt(a) for a small a, refined from two limbs with
+ * z += z * (BASE^2p - a * z^2) / (2 * BASE^2p), nearly doubling the precision each step
+ */
+void bn_inverse_sqrt(struct bignum_t *z, uint32_t a, size_t p)
+{
+	struct bignum_t e, t, one;
+	double s = a;
+	size_t at = 2;
+
+	//sqrt(a) in double by Newton, good to about 16 of the 18 digits in two limbs
+	for (int i = 0; i < 64; i++)
+		s = (s + a / s) / 2;
+	bn_set_u64(z, (uint64_t)((double)BN_BASE * BN_BASE / s));
+	bn_init(&e);
+	bn_init(&t);
+	bn_init(&one);
+
+	while (at < p) {
+		size_t next = 2 * at - 1 < p ? 2 * at - 1 : p;
+
+		bn_shift_limbs(z, next - at);
+		at = next;
+		bn_set_u64(&one, 1);
+		bn_shift_limbs(&one, 2 * at);
+		bn_mul(&t, z, z);
+		bn_mul_small(&t, a);
+		bn_sub(&e, &one, &t);
+		bn_mul(&t, z, &e);
+		bn_shift_limbs(&t, -(long)(2 * at));
+		bn_div_small(&t, 2);
+		bn_add(z, z, &t);
+	}
+	bn_free(&e);
+	bn_free(&t);
+	bn_free(&one);
+}
+
+//Chudnovsky series: pi = 426880 * sqrt(10005) * Q(0, N) / T(0, N)
+#define CHUDNOVSKY_C3_OVER_24 10939058860032000ull
+//Digits each term of the series adds
+#define CHUDNOVSKY_DIGITS_PER_TERM 14.1816474627254776555
+
+//Binary splitting of the terms a up to b, the two halves run in their own threads near the top
+struct pi_split_t {
+	uint64_t a, b;
+	int depth;
+	struct bignum_t P, Q, T;
+};
+
+//Depth up to which the halves of the series are split across threads
+int pi_thread_depth = 0;
+
+void pi_split(struct pi_split_t *s);
+
+void *pi_split_thread(void *arg)
+{
+	pi_split(arg);
+	return NULL;
+}
+
+void pi_split(struct pi_split_t *s)
+{
+	bn_init(&s->P);
+	bn_init(&s->Q);
+	bn_init(&s->T);
+
+	if (s->b - s->a == 1) {
+		uint64_t a = s->a;
+		struct bignum_t c;
+
+		if (a == 0) {
+			bn_set_u64(&s->P, 1);
+			bn_set_u64(&s->Q, 1);
+		}
+		else {
+			//P = -(6a - 5)(2a - 1)(6a - 1), Q = a^3 * C^3 / 24
+			bn_set_u64(&s->P, 6 * a - 5);
+			bn_mul_small(&s->P, 2 * a - 1);
+			bn_mul_small(&s->P, 6 * a - 1);
+			s->P.neg = 1;
+			bn_set_u64(&s->Q, a);
+			bn_mul_small(&s->Q, a);
+			bn_mul_small(&s->Q, a);
+			bn_init(&c);
+			bn_set_u64(&c, CHUDNOVSKY_C3_OVER_24);
+			bn_mul(&s->Q, &s->Q, &c);
+			bn_free(&c);
+		}
+		//T = P * (13591409 + 545140134a)
+		bn_init(&c);
+		bn_set_u64(&c, 13591409 + 545140134 * a);
+		bn_mul(&s->T, &s->P, &c);
+		bn_free(&c);
+		return;
+	}
+
+	struct pi_split_t left = { .a = s->a, .b = (s->a + s->b) / 2, .depth = s->depth + 1 };
+	struct pi_split_t right = { .a = (s->a + s->b) / 2, .b = s->b, .depth = s->depth + 1 };
+	pthread_t thread;
+	int threaded = s->depth < pi_thread_depth && pthread_create(&thread, NULL, pi_split_thread, &left) == 0;
+	struct bignum_t t;
+
+	if (!threaded)
+		pi_split(&left);
+	pi_split(&right);
+	if (threaded)
+		pthread_join(thread, NULL);
+
+	//P = Pl * Pr, Q = Ql * Qr, T = Tl * Qr + Pl * Tr
+	bn_init(&t);
+	bn_mul(&s->T, &left.T, &right.Q);
+	bn_mul(&t, &left.P, &right.T);
+	bn_add(&s->T, &s->T, &t);
+	bn_mul(&s->Q, &left.Q, &right.Q);
+	if (s->depth > 0)
+		bn_mul(&s->P, &left.P, &right.P);
+	bn_free(&t);
+	bn_free(&left.P);
+	bn_free(&left.Q);
+	bn_free(&left.T);
+	bn_free(&right.P);
+	bn_free(&right.Q);
+	bn_free(&right.T);
+}
+
+/**
+ * Writes pi to the given number of decimals with the Chudnovsky series, then how long it took
+ * @param out    digits
+ * @param err    timing, NULL for none
+ * @param digits decimals after the point
+ */
+void madmath_pi(FILE *out, FILE *err, unsigned long digits)
+{
+	struct pi_split_t series = { .a = 0, .b = 0, .depth = 0 };
+	struct bignum_t z, n, pi;
+	size_t p = digits / BN_DIGITS + 3;
+	long long start = now_ns(), series_ns, sqrt_ns, div_ns;
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	char limb[16];
+
+	series.b = (uint64_t)(digits / CHUDNOVSKY_DIGITS_PER_TERM) + 2;
+	for (pi_thread_depth = 0; (1L << pi_thread_depth) < cpus && pi_thread_depth < 6; pi_thread_depth++)
+		;
+	pi_split(&series);
+	series_ns = now_ns();
+
+	//sqrt(10005) * BASE^p = 10005 * BASE^p / sqrt(10005)
+	bn_init(&z);
+	bn_inverse_sqrt(&z, 10005, p);
+	bn_mul_small(&z, 10005);
+	sqrt_ns = now_ns();
+
+	//pi * BASE^p = 426880 * sqrt(10005) * Q * BASE^p / T, Q and T are cut to the
+	//precision of the result first since only their ratio matters
+	if (series.T.len > p + 4) {
+		long cut = series.T.len - (p + 4);
+
+		bn_shift_limbs(&series.Q, -cut);
+		bn_shift_limbs(&series.T, -cut);
+	}
+	bn_init(&n);
+	bn_init(&pi);
+	bn_mul(&n, &series.Q, &z);
+	bn_mul_small(&n, 426880);
+	bn_divide(&pi, &n, &series.T);
+	div_ns = now_ns();
+
+	//The top limb is 3, the rest are the decimals, written as they are converted
+	fprintf(out, "%u.", pi.len ? pi.d[pi.len - 1] : 0);
+	for (size_t i = pi.len - 1, written = 0; i-- > 0 && written < digits; written += BN_DIGITS) {
+		snprintf(limb, sizeof(limb), "%09u", pi.d[i]);
+		fwrite(limb, 1, digits - written < BN_DIGITS ? digits - written : BN_DIGITS, out);
+	}
+	fputc('\n', out);
+	fflush(out);
+
+	if (err)
+		fprintf(err, "pi: %lu digits in %.3f s (series %.3f s, sqrt %.3f s, division %.3f s, output %.3f s) on %ld cpus\n",
+		digits, (now_ns() - start) / 1e9, (series_ns - start) / 1e9, (sqrt_ns - series_ns) / 1e9,
+		(div_ns - sqrt_ns) / 1e9, (now_ns() - div_ns) / 1e9, cpus);
+
+	bn_free(&series.P);
+	bn_free(&series.Q);
+	bn_free(&series.T);
+	bn_free(&z);
+	bn_free(&n);
+	bn_free(&pi);
+}
+
+/**
+ * Primes up to limit with a plain sieve, the base primes of the segmented sieve and of trial division
+ * @param count set to the number of primes
+ * @return the primes in increasing order, to be freed
+ */
+uint32_t *sieve_small_primes(uint32_t limit, size_t *count)
+{
+	char *composite = calloc((size_t)limit + 1, 1);
+	uint32_t *primes = malloc(sizeof(uint32_t) * (limit / 2 + 2));
+
+	*count = 0;
+	for (uint64_t i = 2; i <= limit; i++) {
+		if (composite[i])
+			continue;
+		primes[(*count)++] = i;
+		for (uint64_t j = i * i; j <= limit; j += i)
+			composite[j] = 1;
+	}
+	free(composite);
+	return primes;
+}
+
+//Bits of a sieve segment, one per odd number. 256 KB stays in L2 and holds a few multiples of
+//every base prime up to 10^5, an L1 sized segment had each of them visit four times as often
+//and was about 20% slower on 10^10.
+#define SIEVE_SEGMENT_BITS (262144 * 8)
+//Segments a thread sieves in a row, the offsets of the base primes are computed once per chunk
+#define SIEVE_CHUNK_SEGMENTS 4
+//The odd primes up to 13 are not crossed off but copied in from a pattern of this many words,
+//bit j of the sieve stands for 2j + 1 and the pattern repeats every 3 * 5 * 7 * 11 * 13 bits
+#define SIEVE_PATTERN_WORDS (3 * 5 * 7 * 11 * 13)
+//Largest N of madmath primes, the base primes go up to its square root
+#define SIEVE_MAX 100000000000000ull
+
+uint64_t sieve_pattern[SIEVE_PATTERN_WORDS];
+
+//A base prime p crosses off p * k only for the k prime to 30, which leaves out 7 of every 15 odd k.
+//The k mod 30 that are kept, and the steps in bits between them, in multiples of p.
+const uint8_t sieve_wheel[8] = { 1, 7, 11, 13, 17, 19, 23, 29 };
+const uint8_t sieve_wheel_steps[8] = { 3, 2, 1, 2, 1, 2, 3, 1 };
+
+void sieve_init_pattern()
+{
+	for (uint64_t w = 0; w < SIEVE_PATTERN_WORDS; w++) {
+		sieve_pattern[w] = ~0ull;
+		for (int k = 0; k < 64; k++) {
+			uint64_t n = 2 * (64 * w + k) + 1;
+
+			if (n % 3 == 0 || n % 5 == 0 || n % 7 == 0 || n % 11 == 0 || n % 13 == 0)
+				sieve_pattern[w] &= ~(1ull << k);
+		}
+	}
+}
+
+//A run of segments given to one thread, with its buffers kept from round to round
+struct sieve_chunk_t {
+	uint64_t first, last; // bits, the last one excluded
+	const uint32_t *primes; // base primes from 17 on
+	size_t nprimes;
+	int list;
+	uint64_t *bits;
+	uint64_t *next; // bit of the next multiple of every base prime
+	uint8_t *wheel; // index into sieve_wheel of that multiple
+	char *text;
+	size_t len, size;
+	uint64_t count;
+};
+
+//Appends the primes of one sieve word to the text of the chunk
+void sieve_list_word(struct sieve_chunk_t *chunk, uint64_t base, uint64_t word)
+{
+	char digits[24];
+
+	if (chunk->size - chunk->len < 64 * 22) {
+		chunk->size = chunk->size * 2 + 64 * 22;
+		chunk->text = realloc(chunk->text, chunk->size);
+	}
+	while (word) {
+		uint64_t n = 2 * (base + __builtin_ctzll(word)) + 1;
+		int i = sizeof(digits);
+
+		word &= word - 1;
+		digits[--i] = '\n';
+		do {
+			digits[--i] = '0' + n % 10;
+			n /= 10;
+		} while (n);
+		memcpy(chunk->text + chunk->len, digits + i, sizeof(digits) - i);
+		chunk->len += sizeof(digits) - i;
+	}
+}
+
+static inline void sieve_clear(uint64_t *bits, uint64_t j)
+{
+	bits[j / 64] &= ~(1ull << (j % 64));
+}
+
+void *sieve_chunk(void *arg)
+{
+	struct sieve_chunk_t *chunk = arg;
+	const uint32_t *primes = chunk->primes;
+	size_t used = chunk->nprimes;
+
+	chunk->count = 0;
+	chunk->len = 0;
+	//First multiple p * k of every base prime in the chunk, from p^2 on with k prime to 30
+	for (size_t i = 0; i < chunk->nprimes; i++) {
+		uint64_t p = primes[i], k = p, first = 2 * chunk->first + 1;
+		int w = 0;
+
+		if ((p * p - 1) / 2 >= chunk->last) {
+			used = i;
+			break;
+		}
+		if (k < (first + p - 1) / p)
+			k = (first + p - 1) / p;
+		while (sieve_wheel[w] != k % 30) {
+			if (++w == 8) {
+				k++;
+				w = 0;
+			}
+		}
+		chunk->next[i] = (p * k - 1) / 2;
+		chunk->wheel[i] = w;
+	}
+
+	for (uint64_t low = chunk->first; low < chunk->last; low += SIEVE_SEGMENT_BITS) {
+		uint64_t high = low + SIEVE_SEGMENT_BITS < chunk->last ? low + SIEVE_SEGMENT_BITS : chunk->last;
+		uint64_t *bits = chunk->bits;
+		size_t words = (high - low + 63) / 64;
+
+		for (size_t w = 0; w < words; w++)
+			bits[w] = sieve_pattern[(low / 64 + w) % SIEVE_PATTERN_WORDS];
+		//1 is not a prime, 3, 5, 7, 11 and 13 are
+		if (low == 0)
+			bits[0] = (bits[0] & ~1ull) | 0x6e;
+
+		for (size_t i = 0; i < used; i++) {
+			uint64_t p = primes[i], j = chunk->next[i];
+			int w = chunk->wheel[i];
+
+			for (; j < high && w != 0; w = (w + 1) & 7) {
+				sieve_clear(bits, j - low);
+				j += sieve_wheel_steps[w] * p;
+			}
+			//Whole turns of the wheel, 15p bits each, the eight offsets do not wait on each other
+			if (w == 0) {
+				for (j -= low; j + 14 * p < high - low; j += 15 * p) {
+					sieve_clear(bits, j);
+					sieve_clear(bits, j + 3 * p);
+					sieve_clear(bits, j + 5 * p);
+					sieve_clear(bits, j + 6 * p);
+					sieve_clear(bits, j + 8 * p);
+					sieve_clear(bits, j + 9 * p);
+					sieve_clear(bits, j + 11 * p);
+					sieve_clear(bits, j + 14 * p);
+				}
+				j += low;
+			}
+			for (; j < high; w = (w + 1) & 7) {
+				sieve_clear(bits, j - low);
+				j += sieve_wheel_steps[w] * p;
+			}
+			chunk->next[i] = j;
+			chunk->wheel[i] = w;
+		}
+		if ((high - low) % 64)
+			bits[words - 1] &= (1ull << ((high - low) % 64)) - 1;
+
+		for (size_t w = 0; w < words; w++) {
+			chunk->count += __builtin_popcountll(bits[w]);
+			if (chunk->list && bits[w])
+				sieve_list_word(chunk, low + 64 * w, bits[w]);
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Writes the primes up to n, or only how many there are, with a segmented sieve of the odd numbers.
+ * Chunks of segments are sieved in parallel, one per thread in each round, and written in order.
+ * @param list 0 to print the count only
+ */
+void madmath_primes(FILE *out, uint64_t n, int list)
+{
+	static pthread_once_t once = PTHREAD_ONCE_INIT;
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	int threads = cpus < 1 ? 1 : cpus > 64 ? 64 : cpus;
+	uint64_t root = n < 2 ? n : 1ull << 32, total = n < 2 ? 0 : (n - 1) / 2 + 1, count = 0;
+	uint64_t chunk_bits = (uint64_t)SIEVE_SEGMENT_BITS * SIEVE_CHUNK_SEGMENTS;
+	struct sieve_chunk_t *chunks = calloc(threads, sizeof(struct sieve_chunk_t));
+	pthread_t *ids = malloc(sizeof(pthread_t) * threads);
+	uint32_t *primes;
+	size_t nprimes, skip = 0;
+
+	//Integer Newton for the square root, from above so that it only goes down
+	while (root && root > n / root)
+		root = (root + n / root) / 2;
+	primes = sieve_small_primes(root, &nprimes);
+	while (skip < nprimes && primes[skip] <= 13)
+		skip++;
+	pthread_once(&once, sieve_init_pattern);
+
+	if (n >= 2) {
+		count = 1;
+		if (list)
+			fputs("2\n", out);
+	}
+	for (int t = 0; t < threads; t++) {
+		chunks[t].primes = primes + skip;
+		chunks[t].nprimes = nprimes - skip;
+		chunks[t].list = list;
+		chunks[t].bits = malloc(SIEVE_SEGMENT_BITS / 8);
+		chunks[t].next = malloc(sizeof(uint64_t) * (nprimes + 1));
+		chunks[t].wheel = malloc(nprimes + 1);
+	}
+
+	for (uint64_t first = 0; first < total;) {
+		int started[64] = { 0 }, used = 0;
+
+		//One chunk per thread, the last one sieved by this thread
+		for (; used < threads && first < total; used++, first += chunk_bits) {
+			chunks[used].first = first;
+			chunks[used].last = total - first < chunk_bits ? total : first + chunk_bits;
+		}
+		for (int t = 0; t < used - 1; t++)
+			started[t] = pthread_create(&ids[t], NULL, sieve_chunk, &chunks[t]) == 0;
+		for (int t = 0; t < used; t++)
+			if (!started[t])
+				sieve_chunk(&chunks[t]);
+		for (int t = 0; t < used; t++) {
+			if (started[t])
+				pthread_join(ids[t], NULL);
+			count += chunks[t].count;
+			if (list)
+				fwrite(chunks[t].text, 1, chunks[t].len, out);
+		}
+	}
+	if (!list)
+		fprintf(out, "%llu\n", (unsigned long long)count);
+	fflush(out);
+
+	for (int t = 0; t < threads; t++) {
+		free(chunks[t].bits);
+		free(chunks[t].next);
+		free(chunks[t].wheel);
+		free(chunks[t].text);
+	}
+	free(chunks);
+	free(ids);
+	free(primes);
+}
+
+//Factors of madmath factorize below this are found by trial division
+#define FACTOR_TRIAL_LIMIT 65536
+//Steps of Pollard rho on a factor above 2^64 before ECM takes over
+#define FACTOR_RHO_STEPS (1u << 20)
+//Width of the giant steps of ECM stage 2, 2 * 3 * 5 * 7
+#define ECM_WHEEL 210
+
+//Rounds of ECM with their B1 and curves, the usual ones for factors of 15 and 20 digits and a
+//third of those for 25 digits. B2 is 100 B1. A 200 bit composite that survives all of them is
+//reported after about 25 s of CPU.
+static const struct {
+	uint32_t b1;
+	uint32_t curves;
+} ecm_levels[] = { { 2000, 25 }, { 11000, 90 }, { 50000, 100 } };
+
+uint64_t mulmod64(uint64_t a, uint64_t b, uint64_t m)
+{
+	return (unsigned __int128)a * b % m;
+}
+
+uint64_t powmod64(uint64_t b, uint64_t e, uint64_t m)
+{
+	uint64_t r = 1;
+
+	for (b %= m; e; e >>= 1, b = mulmod64(b, b, m))
+		if (e & 1)
+			r = mulmod64(r, b, m);
+	return r;
+}
+
+uint64_t gcd64(uint64_t a, uint64_t b)
+{
+	while (b) {
+		uint64_t t = a % b;
+
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+//Miller-Rabin with the first twelve primes as bases, which is exact for every 64 bit n
+int is_prime64(uint64_t n)
+{
+	static const uint32_t bases[] = { 2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37 };
+	uint64_t d = n - 1;
+	int s = 0;
+
+	if (n < 2)
+		return 0;
+	for (int i = 0; i < 12; i++)
+		if (n % bases[i] == 0)
+			return n == bases[i];
+	while (d % 2 == 0) {
+		d /= 2;
+		s++;
+	}
+	for (int i = 0; i < 12; i++) {
+		uint64_t x = powmod64(bases[i], d, n);
+		int r = 1;
+
+		if (x == 1 || x == n - 1)
+			continue;
+		for (; r < s; r++) {
+			x = mulmod64(x, x, n);
+			if (x == n - 1)
+				break;
+		}
+		if (r == s)
+			return 0;
+	}
+	return 1;
+}
+
+/**
+ * Pollard rho with Brent's cycle detection on x^2 + c, the differences are multiplied
+ * together so that a gcd is taken only every 128 steps
+ * @return a factor of the composite n, n itself if this c failed
+ */
+uint64_t rho64(uint64_t n, uint64_t c)
+{
+	uint64_t x = 0, y = 2, ys = 2, q = 1, g = 1;
+
+	for (uint64_t r = 1; g == 1; r *= 2) {
+		x = y;
+		for (uint64_t i = 0; i < r; i++)
+			y = (mulmod64(y, y, n) + c) % n;
+		for (uint64_t k = 0; k < r && g == 1; k += 128) {
+			ys = y;
+			for (uint64_t i = 0; i < 128 && i < r - k; i++) {
+				y = (mulmod64(y, y, n) + c) % n;
+				q = mulmod64(q, x > y ? x - y : y - x, n);
+			}
+			g = gcd64(q, n);
+		}
+	}
+	//The batch went past the factor, step through it again one at a time
+	if (g == n) {
+		do {
+			ys = (mulmod64(ys, ys, n) + c) % n;
+			g = gcd64(x > ys ? x - ys : ys - x, n);
+		} while (g == 1);
+	}
+	return g;
+}
+
+//Prime factors found by madmath factorize, sorted before they are printed
+struct factor_list_t {
+	struct bignum_t *factors;
+	size_t count, cap;
+};
+
+void factor_list_add(struct factor_list_t *list, const struct bignum_t *f)
+{
+	if (list->count == list->cap) {
+		list->cap = list->cap ? list->cap * 2 : 16;
+		list->factors = realloc(list->factors, sizeof(struct bignum_t) * list->cap);
+	}
+	bn_init(&list->factors[list->count]);
+	bn_copy(&list->factors[list->count++], f);
+}
+
+void factor_list_add_u64(struct factor_list_t *list, uint64_t f)
+{
+	struct bignum_t t;
+
+	bn_init(&t);
+	bn_set_u64(&t, f);
+	factor_list_add(list, &t);
+	bn_free(&t);
+}
+
+int compare_factors(const void *a, const void *b)
+{
+	return bn_cmp_abs(a, b);
+}
+
+//Factors n > 1 with no factor below the trial division limit
+void factor64(uint64_t n, struct factor_list_t *list)
+{
+	uint64_t d = n;
+
+	if (n == 1)
+		return;
+	if (n < (uint64_t)FACTOR_TRIAL_LIMIT * FACTOR_TRIAL_LIMIT || is_prime64(n)) {
+		factor_list_add_u64(list, n);
+		return;
+	}
+	for (uint64_t c = 1; d == n; c++)
+		d = rho64(n, c);
+	factor64(d, list);
+	factor64(n / d, list);
+}
+
+//x mod m with m below BN_BASE, x is left alone
+uint32_t bn_mod_small(const struct bignum_t *x, uint32_t m)
+{
+	uint64_t rem = 0;
+
+	for (size_t i = x->len; i-- > 0;)
+		rem = (rem * BN_BASE + x->d[i]) % m;
+	return rem;
+}
+
+/**
+ * Converts the magnitude of x
+ * @return 0, or -1 if it does not fit in 64 bits
+ */
+int bn_get_u64(const struct bignum_t *x, uint64_t *v)
+{
+	unsigned __int128 r = 0;
+
+	if (x->len > 3)
+		return -1;
+	for (size_t i = x->len; i-- > 0;)
+		r = r * BN_BASE + x->d[i];
+	if (r > UINT64_MAX)
+		return -1;
+	*v = r;
+	return 0;
+}
+
+//r = a * b mod m for a and b below m, r may be a or b
+void bn_mulmod(struct bignum_t *r, const struct bignum_t *a, const struct bignum_t *b, const struct bignum_t *m)
+{
+	struct bignum_t t;
+
+	bn_init(&t);
+	bn_mul(&t, a, b);
+	bn_divmod(NULL, r, &t, m);
+	bn_free(&t);
+}
+
+//r = b^e mod m, the bits of e are taken off by halving a copy of it
+void bn_powmod(struct bignum_t *r, const struct bignum_t *b, const struct bignum_t *e, const struct bignum_t *m)
+{
+	struct bignum_t exp;
+	char *bits = malloc(e->len * 30 + 1);
+	size_t nbits = 0;
+
+	bn_init(&exp);
+	bn_copy(&exp, e);
+	while (exp.len)
+		bits[nbits++] = bn_div_small(&exp, 2);
+	bn_set_u64(r, 1);
+	while (nbits-- > 0) {
+		bn_mulmod(r, r, r, m);
+		if (bits[nbits])
+			bn_mulmod(r, r, b, m);
+	}
+	bn_free(&exp);
+	free(bits);
+}
+
+void bn_gcd(struct bignum_t *r, const struct bignum_t *a, const struct bignum_t *b)
+{
+	struct bignum_t x, y, t;
+
+	bn_init(&x);
+	bn_init(&y);
+	bn_init(&t);
+	bn_copy(&x, a);
+	bn_copy(&y, b);
+	x.neg = y.neg = 0;
+	while (y.len) {
+		bn_divmod(NULL, &t, &x, &y);
+		bn_move(&x, &y);
+		bn_move(&y, &t);
+	}
+	bn_move(r, &x);
+	bn_free(&y);
+}
+
+//Miller-Rabin with the primes up to 71 as bases, n is odd and above 2^64
+int bn_is_probable_prime(const struct bignum_t *n)
+{
+	static const uint32_t bases[] = { 2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 47, 53, 59, 61, 67, 71 };
+	struct bignum_t d, n1, x, base, one;
+	int s = 0, prime = 1;
+
+	bn_init(&d);
+	bn_init(&n1);
+	bn_init(&x);
+	bn_init(&base);
+	bn_init(&one);
+	bn_set_u64(&one, 1);
+	bn_sub(&n1, n, &one);
+	bn_copy(&d, &n1);
+	while (bn_mod_small(&d, 2) == 0) {
+		bn_div_small(&d, 2);
+		s++;
+	}
+	for (int i = 0; prime && i < 20; i++) {
+		int r = 1;
+
+		bn_set_u64(&base, bases[i]);
+		bn_powmod(&x, &base, &d, n);
+		if (bn_cmp_abs(&x, &one) == 0 || bn_cmp_abs(&x, &n1) == 0)
+			continue;
+		for (; r < s; r++) {
+			bn_mulmod(&x, &x, &x, n);
+			if (bn_cmp_abs(&x, &n1) == 0)
+				break;
+		}
+		prime = r < s;
+	}
+	bn_free(&d);
+	bn_free(&n1);
+	bn_free(&x);
+	bn_free(&base);
+	bn_free(&one);
+	return prime;
+}
+
+//Limbs of 64 bits of the Montgomery arithmetic, the factors rho and ECM work on stay below 2^4096
+#define MODN_LIMBS 64
+
+//Arithmetic modulo an odd n, a number x is kept as x * R mod n with R = 2^(64 len)
+struct modn_t {
+	uint64_t n[MODN_LIMBS];
+	uint64_t r2[MODN_LIMBS]; // R^2 mod n, takes a number into the form
+	uint64_t ninv; // -1 / n mod 2^64
+	int len;
+};
+
+//r = a * b / R mod n by the interleaved (CIOS) method, r may be a or b
+void modn_mul(const struct modn_t *m, uint64_t *r, const uint64_t *a, const uint64_t *b)
+{
+	uint64_t t[MODN_LIMBS + 2], carry, q;
+	unsigned __int128 x;
+	int len = m->len, i, j;
+
+	memset(t, 0, sizeof(uint64_t) * (len + 2));
+	for (i = 0; i < len; i++) {
+		carry = 0;
+		for (j = 0; j < len; j++) {
+			x = (unsigned __int128)a[j] * b[i] + t[j] + carry;
+			t[j] = x;
+			carry = x >> 64;
+		}
+		x = (unsigned __int128)t[len] + carry;
+		t[len] = x;
+		t[len + 1] = x >> 64;
+
+		//Adding q * n clears the low limb, which is then shifted out
+		q = t[0] * m->ninv;
+		x = (unsigned __int128)q * m->n[0] + t[0];
+		carry = x >> 64;
+		for (j = 1; j < len; j++) {
+			x = (unsigned __int128)q * m->n[j] + t[j] + carry;
+			t[j - 1] = x;
+			carry = x >> 64;
+		}
+		x = (unsigned __int128)t[len] + carry;
+		t[len - 1] = x;
+		t[len] = t[len + 1] + (uint64_t)(x >> 64);
+	}
+
+	for (j = len - 1; t[len] == 0 && j >= 0 && t[j] == m->n[j]; j--)
+		;
+	if (t[len] || j < 0 || t[j] > m->n[j]) {
+		carry = 0;
+		for (j = 0; j < len; j++) {
+			x = (unsigned __int128)t[j] - m->n[j] - carry;
+			t[j] = x;
+			carry = (x >> 64) & 1;
+		}
+	}
+	memcpy(r, t, sizeof(uint64_t) * len);
+}
+
+//r = a + b mod n
+void modn_add(const struct modn_t *m, uint64_t *r, const uint64_t *a, const uint64_t *b)
+{
+	unsigned __int128 x;
+	uint64_t carry = 0, borrow = 0, t[MODN_LIMBS];
+	int j;
+
+	for (j = 0; j < m->len; j++) {
+		x = (unsigned __int128)a[j] + b[j] + carry;
+		r[j] = x;
+		carry = x >> 64;
+	}
+	for (j = 0; j < m->len; j++) {
+		x = (unsigned __int128)r[j] - m->n[j] - borrow;
+		t[j] = x;
+		borrow = (x >> 64) & 1;
+	}
+	if (carry || !borrow)
+		memcpy(r, t, sizeof(uint64_t) * m->len);
+}
+
+//r = a - b mod n
+void modn_sub(const struct modn_t *m, uint64_t *r, const uint64_t *a, const uint64_t *b)
+{
+	unsigned __int128 x;
+	uint64_t borrow = 0, carry = 0;
+	int j;
+
+	for (j = 0; j < m->len; j++) {
+		x = (unsigned __int128)a[j] - b[j] - borrow;
+		r[j] = x;
+		borrow = (x >> 64) & 1;
+	}
+	if (borrow) {
+		for (j = 0; j < m->len; j++) {
+			x = (unsigned __int128)r[j] + m->n[j] + carry;
+			r[j] = x;
+			carry = x >> 64;
+		}
+	}
+}
+
+/**
+ * Splits the magnitude of x into 64 bit limbs, taken off 16 bits at a time
+ * @return limbs used, or -1 if x needs more than size
+ */
+int bn_to_limbs(uint64_t *r, int size, const struct bignum_t *x)
+{
+	struct bignum_t t;
+	int len = 0;
+
+	bn_init(&t);
+	bn_copy(&t, x);
+	memset(r, 0, sizeof(uint64_t) * size);
+	while (t.len && len < size) {
+		for (int k = 0; k < 64; k += 16)
+			r[len] |= (uint64_t)bn_div_small(&t, 65536) << k;
+		len++;
+	}
+	if (t.len)
+		len = -1;
+	bn_free(&t);
+	return len;
+}
+
+void bn_from_limbs(struct bignum_t *x, const uint64_t *a, int len)
+{
+	struct bignum_t digit;
+
+	bn_init(&digit);
+	bn_set_u64(x, 0);
+	for (int i = len; i-- > 0;) {
+		for (int k = 48; k >= 0; k -= 16) {
+			bn_mul_small(x, 65536);
+			bn_set_u64(&digit, a[i] >> k & 0xffff);
+			bn_add(x, x, &digit);
+		}
+	}
+	bn_free(&digit);
+}
+
+/**
+ * Sets up the arithmetic modulo the odd n
+ * @return 0, or -1 if n has more than MODN_LIMBS limbs
+ */
+int modn_init(struct modn_t *m, const struct bignum_t *n)
+{
+	struct bignum_t r, two;
+	uint64_t inv;
+
+	if ((m->len = bn_to_limbs(m->n, MODN_LIMBS, n)) <= 0)
+		return -1;
+	//Newton doubles the correct low bits of 1 / n each round, n is its own inverse mod 8
+	inv = m->n[0];
+	for (int i = 0; i < 5; i++)
+		inv *= 2 - m->n[0] * inv;
+	m->ninv = -inv;
+
+	bn_init(&r);
+	bn_init(&two);
+	bn_set_u64(&two, 2);
+	bn_pow(&r, &two, 128 * m->len);
+	bn_divmod(NULL, &r, &r, n);
+	bn_to_limbs(m->r2, m->len, &r);
+	bn_free(&r);
+	bn_free(&two);
+	return 0;
+}
+
+//r = v in Montgomery form
+void modn_set_u64(const struct modn_t *m, uint64_t *r, uint64_t v)
+{
+	uint64_t plain[MODN_LIMBS] = { v };
+
+	modn_mul(m, r, plain, m->r2);
+}
+
+/**
+ * Takes the gcd of n and a number kept by the arithmetic, R is prime to n so the form does not matter
+ * @return 0 with a proper factor in f, 1 if the gcd is n, -1 if it is 1
+ */
+int modn_gcd(struct bignum_t *f, const struct modn_t *m, const uint64_t *a, const struct bignum_t *n)
+{
+	bn_from_limbs(f, a, m->len);
+	bn_gcd(f, f, n);
+	if (f->len == 1 && f->d[0] == 1)
+		return -1;
+	return bn_cmp_abs(f, n) == 0;
+}
+
+/**
+ * rho64 on a Montgomery number, without the batching of the differences past a gcd that hit n
+ * @return 0 with a factor in f, 1 if the gcd hit n so another c is worth a try,
+ *         or -1 if none came up within FACTOR_RHO_STEPS
+ */
+int modn_rho(struct bignum_t *f, const struct modn_t *m, const struct bignum_t *n, uint64_t c)
+{
+	uint64_t x[MODN_LIMBS], y[MODN_LIMBS], q[MODN_LIMBS], diff[MODN_LIMBS], add[MODN_LIMBS] = { c };
+	uint64_t steps = 0;
+	int found = -1;
+
+	//x^2 / R + c is as good a map as x^2 + c, it is a polynomial modulo every prime of n too
+	modn_set_u64(m, y, 2);
+	modn_set_u64(m, q, 1);
+	for (uint64_t r = 1; found == -1 && steps < FACTOR_RHO_STEPS; r *= 2) {
+		memcpy(x, y, sizeof(uint64_t) * m->len);
+		for (uint64_t i = 0; i < r; i++) {
+			modn_mul(m, y, y, y);
+			modn_add(m, y, y, add);
+		}
+		for (uint64_t k = 0; k < r && found == -1; k += 128) {
+			for (uint64_t i = 0; i < 128 && i < r - k; i++, steps++) {
+				modn_mul(m, y, y, y);
+				modn_add(m, y, y, add);
+				modn_sub(m, diff, x, y);
+				modn_mul(m, q, q, diff);
+			}
+			found = modn_gcd(f, m, q, n);
+		}
+	}
+	return found;
+}
+
+//A point of a Montgomery curve in X:Z coordinates, the Y coordinate is never needed
+struct ecm_point_t {
+	uint64_t x[MODN_LIMBS];
+	uint64_t z[MODN_LIMBS];
+};
+
+//The curve By^2 = x^3 + Ax^2 + x of ECM, (A + 2) / 4 is kept as a fraction so no inverse is needed
+struct ecm_curve_t {
+	const struct modn_t *m;
+	uint64_t a24[MODN_LIMBS];
+	uint64_t d24[MODN_LIMBS];
+};
+
+//r = 2p, r may be p
+void ecm_double(const struct ecm_curve_t *e, struct ecm_point_t *r, const struct ecm_point_t *p)
+{
+	const struct modn_t *m = e->m;
+	uint64_t s[MODN_LIMBS], d[MODN_LIMBS], t[MODN_LIMBS];
+
+	modn_add(m, s, p->x, p->z);
+	modn_mul(m, s, s, s);
+	modn_sub(m, d, p->x, p->z);
+	modn_mul(m, d, d, d);
+	modn_sub(m, t, s, d); // 4xz
+	modn_mul(m, d, d, e->d24);
+	modn_mul(m, r->x, s, d);
+	modn_mul(m, s, t, e->a24);
+	modn_add(m, s, s, d);
+	modn_mul(m, r->z, t, s);
+}
+
+//r = p + q from their difference, r may be p or q
+void ecm_add(const struct ecm_curve_t *e, struct ecm_point_t *r, const struct ecm_point_t *p, const struct ecm_point_t *q,
+	     const struct ecm_point_t *diff)
+{
+	const struct modn_t *m = e->m;
+	uint64_t u[MODN_LIMBS], v[MODN_LIMBS], t[MODN_LIMBS];
+
+	modn_sub(m, u, p->x, p->z);
+	modn_add(m, t, q->x, q->z);
+	modn_mul(m, u, u, t);
+	modn_add(m, v, p->x, p->z);
+	modn_sub(m, t, q->x, q->z);
+	modn_mul(m, v, v, t);
+	modn_add(m, t, u, v);
+	modn_sub(m, u, u, v);
+	modn_mul(m, t, t, t);
+	modn_mul(m, u, u, u);
+	modn_mul(m, r->x, diff->z, t);
+	modn_mul(m, r->z, diff->x, u);
+}
+
+//r = k p with the Montgomery ladder, k >= 1 and r may be p
+void ecm_multiply(const struct ecm_curve_t *e, struct ecm_point_t *r, const struct ecm_point_t *p, uint64_t k)
+{
+	struct ecm_point_t p0 = *p, p1, base = *p;
+	int bit = 63;
+
+	ecm_double(e, &p1, p);
+	while (!(k >> bit & 1))
+		bit--;
+	//p1 - p0 is always base
+	while (bit-- > 0) {
+		if (k >> bit & 1) {
+			ecm_add(e, &p0, &p0, &p1, &base);
+			ecm_double(e, &p1, &p1);
+		}
+		else {
+			ecm_add(e, &p1, &p0, &p1, &base);
+			ecm_double(e, &p0, &p0);
+		}
+	}
+	*r = p0;
+}
+
+/**
+ * Sets up the curve of Suyama's family for sigma and its starting point,
+ * u = sigma^2 - 5, v = 4 sigma, x = u^3, z = v^3 and (A + 2) / 4 = (v - u)^3 (3u + v) / 16 u^3 v
+ */
+void ecm_suyama(struct ecm_curve_t *e, struct ecm_point_t *p, uint64_t sigma)
+{
+	const struct modn_t *m = e->m;
+	uint64_t u[MODN_LIMBS], v[MODN_LIMBS], t[MODN_LIMBS], w[MODN_LIMBS];
+
+	modn_set_u64(m, u, sigma * sigma - 5);
+	modn_set_u64(m, v, 4 * sigma);
+	modn_mul(m, t, u, u);
+	modn_mul(m, p->x, t, u);
+	modn_mul(m, t, v, v);
+	modn_mul(m, p->z, t, v);
+
+	modn_sub(m, t, v, u);
+	modn_mul(m, w, t, t);
+	modn_mul(m, t, w, t);
+	modn_set_u64(m, w, 3);
+	modn_mul(m, w, w, u);
+	modn_add(m, w, w, v);
+	modn_mul(m, e->a24, t, w);
+
+	modn_set_u64(m, t, 16);
+	modn_mul(m, t, t, p->x);
+	modn_mul(m, e->d24, t, v);
+}
+
+/**
+ * Stage 2 of ECM, looks for one prime q in (b1, b2] with q p = 0. The baby steps are j p for
+ * j up to ECM_WHEEL / 2, the giant steps i ECM_WHEEL p, and q = i ECM_WHEEL +- j shows up as
+ * a common factor of n and X_giant Z_baby - X_baby Z_giant.
+ * @param primes  the primes up to b2 in increasing order, from above 2 ECM_WHEEL
+ * @param product set to the product of the differences, its gcd with n is taken by the caller
+ */
+void ecm_stage2(const struct ecm_curve_t *e, const struct ecm_point_t *p, const uint32_t *primes, size_t nprimes, uint32_t b1,
+		uint64_t *product)
+{
+	const struct modn_t *m = e->m;
+	struct ecm_point_t *baby = malloc(sizeof(struct ecm_point_t) * (ECM_WHEEL / 2 + 1));
+	struct ecm_point_t giant, previous, next, step;
+	uint64_t t[MODN_LIMBS], u[MODN_LIMBS], i = 0;
+
+	//baby[j] = j p, each one from the two before it
+	baby[1] = *p;
+	ecm_double(e, &baby[2], p);
+	for (int j = 3; j <= ECM_WHEEL / 2; j++)
+		ecm_add(e, &baby[j], &baby[j - 1], p, &baby[j - 2]);
+	ecm_double(e, &step, &baby[ECM_WHEEL / 2]);
+
+	modn_set_u64(m, product, 1);
+	for (size_t k = 0; k < nprimes; k++) {
+		uint64_t q = primes[k], j;
+
+		if (q <= b1)
+			continue;
+		if (i == 0) {
+			i = (q + ECM_WHEEL / 2) / ECM_WHEEL;
+			ecm_multiply(e, &previous, p, (i - 1) * ECM_WHEEL);
+			ecm_multiply(e, &giant, p, i * ECM_WHEEL);
+		}
+		for (; (q + ECM_WHEEL / 2) / ECM_WHEEL > i; i++) {
+			ecm_add(e, &next, &giant, &step, &previous);
+			previous = giant;
+			giant = next;
+		}
+		j = q > i * ECM_WHEEL ? q - i * ECM_WHEEL : i * ECM_WHEEL - q;
+		modn_mul(m, t, giant.x, baby[j].z);
+		modn_mul(m, u, baby[j].x, giant.z);
+		modn_sub(m, t, t, u);
+		modn_mul(m, product, product, t);
+	}
+	free(baby);
+}
+
+/**
+ * The elliptic curve method on the curves of Suyama's family, for the factors rho is too slow for
+ * @return 0 with a factor in f, or -1 if none came up on any curve of ecm_levels
+ */
+int ecm(struct bignum_t *f, const struct modn_t *m, const struct bignum_t *n)
+{
+	struct ecm_curve_t e = { .m = m };
+	struct ecm_point_t p;
+	uint64_t product[MODN_LIMBS], sigma = 6;
+	int found = -1;
+
+	for (size_t level = 0; level < sizeof(ecm_levels) / sizeof(ecm_levels[0]) && found != 0; level++) {
+		uint32_t b1 = ecm_levels[level].b1;
+		size_t nprimes;
+		uint32_t *primes = sieve_small_primes(100 * b1, &nprimes);
+
+		for (uint32_t c = 0; c < ecm_levels[level].curves && found != 0; c++, sigma++) {
+			ecm_suyama(&e, &p, sigma);
+			//Stage 1 multiplies by every prime power up to b1
+			for (size_t k = 0; k < nprimes && primes[k] <= b1; k++) {
+				uint64_t q = primes[k];
+
+				while (q <= b1 / primes[k])
+					q *= primes[k];
+				ecm_multiply(&e, &p, &p, q);
+			}
+			found = modn_gcd(f, m, p.z, n);
+			if (found == -1) {
+				ecm_stage2(&e, &p, primes, nprimes, b1, product);
+				found = modn_gcd(f, m, product, n);
+			}
+		}
+		free(primes);
+	}
+	return found == 0 ? 0 : -1;
+}
+
+/**
+ * r = floor(n^(1/k)) for k >= 2 by Newton from above, x = ((k - 1)x + n / x^(k - 1)) / k
+ * starting at a power of two past the root, a limb holds less than 30 bits
+ */
+void bn_root(struct bignum_t *r, const struct bignum_t *n, uint32_t k)
+{
+	struct bignum_t x, next, t, two;
+
+	bn_init(&x);
+	bn_init(&next);
+	bn_init(&t);
+	bn_init(&two);
+	bn_set_u64(&two, 2);
+	bn_pow(&x, &two, (30 * n->len + k - 1) / k);
+	while (1) {
+		bn_pow(&t, &x, k - 1);
+		bn_divmod(&next, NULL, n, &t);
+		bn_copy(&t, &x);
+		bn_mul_small(&t, k - 1);
+		bn_add(&next, &next, &t);
+		bn_div_small(&next, k);
+		if (bn_cmp_abs(&next, &x) >= 0)
+			break;
+		bn_move(&x, &next);
+		bn_init(&next);
+	}
+	bn_move(r, &x);
+	bn_free(&next);
+	bn_free(&t);
+	bn_free(&two);
+}
+
+/**
+ * Finds n = r^k for a prime k, rho cannot split the square of a large prime
+ * @return k, or 0 if n is not a perfect power
+ */
+uint32_t bn_perfect_power(struct bignum_t *r, const struct bignum_t *n)
+{
+	struct bignum_t t;
+	uint32_t found = 0;
+
+	bn_init(&t);
+	for (uint32_t k = 2; !found && k <= 30 * n->len; k++) {
+		uint32_t d = 2;
+
+		while (d * d <= k && k % d)
+			d++;
+		if (d * d <= k)
+			continue;
+		bn_root(r, n, k);
+		bn_pow(&t, r, k);
+		if (bn_cmp_abs(&t, n) == 0)
+			found = k;
+	}
+	bn_free(&t);
+	return found;
+}
+
+/**
+ * Factors n > 1 with no factor below the trial division limit, the 64 bit cofactors go to factor64
+ * @return 0, or -1 if a composite factor could not be split, it is added to the list as it is
+ */
+int factor_big(const struct bignum_t *n, struct factor_list_t *list)
+{
+	struct modn_t m;
+	struct bignum_t f, g;
+	uint64_t small;
+	uint32_t power;
+	int status = -1;
+
+	if (bn_get_u64(n, &small) == 0) {
+		factor64(small, list);
+		return 0;
+	}
+	if (bn_is_probable_prime(n)) {
+		factor_list_add(list, n);
+		return 0;
+	}
+	bn_init(&f);
+	bn_init(&g);
+	if ((power = bn_perfect_power(&f, n)) != 0) {
+		for (status = 0; power-- > 0;)
+			status |= factor_big(&f, list);
+		bn_free(&f);
+		bn_free(&g);
+		return status;
+	}
+	if (modn_init(&m, n) == 0) {
+		for (uint32_t c = 1; (status = modn_rho(&f, &m, n, c)) == 1 && c < 16; c++)
+			;
+		if (status != 0)
+			status = ecm(&f, &m, n);
+	}
+	if (status == 0) {
+		bn_divmod(&g, NULL, n, &f);
+		status = factor_big(&f, list) | factor_big(&g, list);
+	}
+	else {
+		factor_list_add(list, n);
+	}
+	bn_free(&f);
+	bn_free(&g);
+	return status;
+}
+
+/**
+ * Writes "n: p1 p2 ..." with the prime factors of n in increasing order
+ * @param primes the primes below FACTOR_TRIAL_LIMIT
+ * @return 0, or -1 if a composite factor above 2^64 resisted Pollard rho and ECM and was written as it is
+ */
+int madmath_factorize(FILE *out, const struct bignum_t *n, const uint32_t *primes, size_t nprimes)
+{
+	struct factor_list_t list = { NULL, 0, 0 };
+	struct bignum_t rest;
+	int status = 0;
+
+	bn_init(&rest);
+	bn_copy(&rest, n);
+	//Trial division first, then Miller-Rabin and Pollard rho on what is left
+	for (size_t i = 0; i < nprimes && rest.len > 0; i++) {
+		uint64_t small;
+
+		if (bn_get_u64(&rest, &small) == 0 && (uint64_t)primes[i] * primes[i] > small)
+			break;
+		while (bn_mod_small(&rest, primes[i]) == 0) {
+			factor_list_add_u64(&list, primes[i]);
+			bn_div_small(&rest, primes[i]);
+		}
+	}
+	if (rest.len > 0 && !(rest.len == 1 && rest.d[0] == 1))
+		status = factor_big(&rest, &list);
+
+	qsort(list.factors, list.count, sizeof(struct bignum_t), compare_factors);
+	bn_write(out, n);
+	fputc(':', out);
+	for (size_t i = 0; i < list.count; i++) {
+		fputc(' ', out);
+		bn_write(out, &list.factors[i]);
+		bn_free(&list.factors[i]);
+	}
+	fputc('\n', out);
+	fflush(out);
+	free(list.factors);
+	bn_free(&rest);
+	return status;
+}
+
+//Bytes madmath stats reads at a time
+#define STATS_CHUNK (1 << 20)
+//Numbers reduced together, few enough to stay in L1 between the passes over them
+#define STATS_BATCH 2048
+//Linear sub-buckets per power of two in the quantile sketch, a bucket is at most 1 / 2^7 wide
+//relative to its lower bound so the quantiles are within 0.4%
+#define STATS_SUB_BITS 7
+//Most buckets of either sign, 512 powers of two, past that the lowest ones are merged into one
+#define STATS_MAX_BINS 65536
+
+//Buckets of one sign of the sketch, counts[i] is bucket offset + i
+struct sketch_store_t {
+	uint64_t *counts;
+	int64_t offset;
+	size_t len;
+	uint64_t total;
+};
+
+//Quantile sketch in the spirit of DDSketch, with the logarithm replaced by the exponent and the top
+//mantissa bits of the double, so a value lands in its bucket without calling log
+struct sketch_t {
+	struct sketch_store_t positive, negative;
+	uint64_t zeros;
+};
+
+//Running statistics of madmath stats, mean and m2 are merged batch by batch with Chan's formula
+struct num_stats_t {
+	uint64_t count;
+	double sum, mean, m2, min, max;
+	struct sketch_t sketch;
+	int field; // 1 based field of blanks or commas, 0 for every number
+	double batch[STATS_BATCH];
+	size_t batched;
+};
+
+//Bucket of x > 0, the bits of a positive double grow with its value
+int64_t sketch_index(double x)
+{
+	uint64_t bits;
+
+	memcpy(&bits, &x, sizeof(bits));
+	return bits >> (52 - STATS_SUB_BITS);
+}
+
+//Middle of a bucket
+double sketch_value(int64_t index)
+{
+	uint64_t low = (uint64_t)index << (52 - STATS_SUB_BITS), high = (uint64_t)(index + 1) << (52 - STATS_SUB_BITS);
+	double a, b;
+
+	memcpy(&a, &low, sizeof(a));
+	memcpy(&b, &high, sizeof(b));
+	return a + (b - a) / 2;
+}
+
+void sketch_store_add(struct sketch_store_t *store, int64_t index)
+{
+	store->total++;
+	if (store->len == 0) {
+		store->counts = calloc(1, sizeof(uint64_t));
+		store->offset = index;
+		store->len = 1;
+	}
+	else if (index < store->offset || index >= store->offset + (int64_t)store->len) {
+		//Grow the range to the new bucket, dropping the lowest buckets into one past STATS_MAX_BINS
+		int64_t low = index < store->offset ? index : store->offset;
+		int64_t high = index > store->offset + (int64_t)store->len - 1 ? index : store->offset + (int64_t)store->len - 1;
+		uint64_t *counts;
+
+		//Room for as many buckets again on the side that grew, so that a slowly drifting
+		//stream does not copy the counts for every new bucket
+		if (high - low + 1 > STATS_MAX_BINS)
+			low = high - STATS_MAX_BINS + 1;
+		else if (index < store->offset)
+			low = high - low + 1 + store->len > STATS_MAX_BINS ? high - STATS_MAX_BINS + 1 : low - (int64_t)store->len;
+		else
+			high = high - low + 1 + store->len > STATS_MAX_BINS ? low + STATS_MAX_BINS - 1 : high + (int64_t)store->len;
+		counts = calloc(high - low + 1, sizeof(uint64_t));
+		for (size_t i = 0; i < store->len; i++)
+			counts[store->offset + (int64_t)i < low ? 0 : store->offset + (int64_t)i - low] += store->counts[i];
+		free(store->counts);
+		store->counts = counts;
+		store->offset = low;
+		store->len = high - low + 1;
+	}
+	if (index < store->offset)
+		index = store->offset;
+	store->counts[index - store->offset]++;
+}
+
+void sketch_add(struct sketch_t *sketch, double x)
+{
+	if (x > 0)
+		sketch_store_add(&sketch->positive, sketch_index(x));
+	else if (x < 0)
+		sketch_store_add(&sketch->negative, sketch_index(-x));
+	else
+		sketch->zeros++;
+}
+
+//Value of rank q * (count - 1), the negatives come first from the largest magnitude down
+double sketch_quantile(const struct sketch_t *sketch, double q)
+{
+	uint64_t count = sketch->negative.total + sketch->zeros + sketch->positive.total;
+	uint64_t rank = q * (count - 1), seen = 0;
+
+	for (size_t i = sketch->negative.len; i-- > 0;)
+		if ((seen += sketch->negative.counts[i]) > rank)
+			return -sketch_value(sketch->negative.offset + i);
+	if ((seen += sketch->zeros) > rank)
+		return 0;
+	for (size_t i = 0; i < sketch->positive.len; i++)
+		if ((seen += sketch->positive.counts[i]) > rank)
+			return sketch_value(sketch->positive.offset + i);
+	return 0;
+}
+
+/**
+ * Folds the batched numbers into the totals, every pass over the batch keeps four independent
+ * sums so the loops pipeline and vectorize without reassociating floating point
+ */
+void num_stats_flush(struct num_stats_t *stats)
+{
+	const double *x = stats->batch;
+	size_t n = stats->batched, i;
+	double sum[4] = { 0 }, m2[4] = { 0 }, low, high, mean, delta;
+
+	if (n == 0)
+		return;
+	low = high = x[0];
+	for (i = 0; i + 4 <= n; i += 4)
+		for (int k = 0; k < 4; k++)
+			sum[k] += x[i + k];
+	for (; i < n; i++)
+		sum[0] += x[i];
+	mean = (sum[0] + sum[1] + sum[2] + sum[3]) / n;
+	for (i = 0; i + 4 <= n; i += 4)
+		for (int k = 0; k < 4; k++)
+			m2[k] += (x[i + k] - mean) * (x[i + k] - mean);
+	for (; i < n; i++)
+		m2[0] += (x[i] - mean) * (x[i] - mean);
+	for (i = 0; i < n; i++) {
+		low = x[i] < low ? x[i] : low;
+		high = x[i] > high ? x[i] : high;
+		sketch_add(&stats->sketch, x[i]);
+	}
+
+	if (stats->count == 0 || low < stats->min)
+		stats->min = low;
+	if (stats->count == 0 || high > stats->max)
+		stats->max = high;
+	delta = mean - stats->mean;
+	stats->sum += sum[0] + sum[1] + sum[2] + sum[3];
+	stats->mean += delta * n / (stats->count + n);
+	stats->m2 += m2[0] + m2[1] + m2[2] + m2[3] + delta * delta * stats->count * n / (stats->count + n);
+	stats->count += n;
+	stats->batched = 0;
+}
+
+void num_stats_add(struct num_stats_t *stats, double x)
+{
+	stats->batch[stats->batched++] = x;
+	if (stats->batched == STATS_BATCH)
+		num_stats_flush(stats);
+}
+
+/**
+ * Parses the decimal number at p, exact in one multiplication or division when there are at most
+ * 19 digits, they fit in 53 bits and the power of ten is exact, otherwise by strtod
+ * @return the end of the number, or p if there is none
+ */
+const char *stats_number(const char *p, const char *end, double *value)
+{
+	static const double powers[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+		1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+	const char *start = p;
+	uint64_t mantissa = 0;
+	int digits = 0, exponent = 0, neg = 0;
+
+	if (p < end && (*p == '-' || *p == '+'))
+		neg = *p++ == '-';
+	for (; p < end && (unsigned)(*p - '0') < 10; p++, digits++)
+		mantissa = mantissa * 10 + (*p - '0');
+	if (p < end && *p == '.')
+		for (p++; p < end && (unsigned)(*p - '0') < 10; p++, digits++, exponent--)
+			mantissa = mantissa * 10 + (*p - '0');
+	if (digits == 0)
+		return start;
+	if (p + 1 < end && (*p == 'e' || *p == 'E')) {
+		const char *e = p + 1;
+		int eneg = 0, power = 0;
+
+		if (e < end && (*e == '-' || *e == '+'))
+			eneg = *e++ == '-';
+		if (e < end && (unsigned)(*e - '0') < 10) {
+			for (; e < end && (unsigned)(*e - '0') < 10; e++)
+				if (power < 100000)
+					power = power * 10 + (*e - '0');
+			exponent += eneg ? -power : power;
+			p = e;
+		}
+	}
+
+	if (digits <= 19 && mantissa < (1ull << 53) && exponent >= -22 && exponent <= 22) {
+		*value = exponent < 0 ? mantissa / powers[-exponent] : mantissa * powers[exponent];
+		if (neg)
+			*value = -*value;
+	}
+	else {
+		char copy[512];
+		size_t len = p - start < (long)sizeof(copy) - 1 ? (size_t)(p - start) : sizeof(copy) - 1;
+
+		memcpy(copy, start, len);
+		copy[len] = '\0';
+		*value = strtod(copy, NULL);
+	}
+	return p;
+}
+
+//Characters a number may start with, and the ones that glue a number to the word before it
+enum { STATS_START = 1, STATS_WORD = 2 };
+unsigned char stats_class[256];
+
+void stats_init_class()
+{
+	for (int c = 0; c < 256; c++) {
+		if (isdigit(c) || c == '-' || c == '+' || c == '.')
+			stats_class[c] |= STATS_START;
+		if (isalnum(c) || c == '_' || c == '.')
+			stats_class[c] |= STATS_WORD;
+	}
+}
+
+/**
+ * Adds the numbers of the lines in buf, every number that starts a word or only the field of the stats
+ * @param arg the num_stats_t
+ */
+void stats_scan(void *arg, const char *buf, size_t len)
+{
+	struct num_stats_t *stats = arg;
+	int field = stats->field;
+	const unsigned char *p = (const unsigned char *)buf, *end = p + len;
+	unsigned char before = ' ';
+	const char *next;
+	double value;
+
+	if (field == 0) {
+		//Lines do not matter when every number is taken
+		while (p < end) {
+			unsigned char c = *p;
+
+			if ((stats_class[c] & STATS_START) && !(stats_class[before] & STATS_WORD)
+			    && (next = stats_number((const char *)p, (const char *)end, &value)) != (const char *)p) {
+				//value - value is NaN for an infinity, so overflowing numbers are left out
+				if (value - value == 0)
+					num_stats_add(stats, value);
+				p = (const unsigned char *)next;
+				before = p[-1];
+			}
+			else {
+				before = c;
+				p++;
+			}
+		}
+		return;
+	}
+
+	while (p < end) {
+		const unsigned char *line_end = memchr(p, '\n', end - p);
+
+		if (line_end == NULL)
+			line_end = end;
+		//Skip to the start of the field
+		for (int f = 1; p < line_end; f++) {
+			while (p < line_end && (*p == ' ' || *p == '\t' || *p == ','))
+				p++;
+			if (f == field)
+				break;
+			while (p < line_end && *p != ' ' && *p != '\t' && *p != ',')
+				p++;
+		}
+		if (p < line_end && stats_number((const char *)p, (const char *)line_end, &value) != (const char *)p
+		    && value - value == 0)
+			num_stats_add(stats, value);
+		p = line_end + 1;
+	}
+}
+
+//Gets whole lines of input, only the last line of the input may lack its newline
+typedef void (*lines_handler)(void *arg, const char *buf, size_t len);
+
+/**
+ * Reads fd to the end in big chunks, handing the whole lines of each chunk to consume
+ * @param buf  STATS_CHUNK bytes
+ * @return 0, or -1 with errno set if a read failed
+ */
+int read_lines(int fd, char *buf, lines_handler consume, void *arg)
+{
+	size_t kept = 0;
+	ssize_t got;
+
+	while ((got = read(fd, buf + kept, STATS_CHUNK - kept)) != 0) {
+		char *last;
+		size_t len;
+
+		if (got < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		len = kept + got;
+		last = memrchr(buf, '\n', len);
+		//A line longer than the buffer is cut where the buffer ends
+		if (last == NULL)
+			last = buf + len - 1;
+		consume(arg, buf, last + 1 - buf);
+		kept = buf + len - (last + 1);
+		memmove(buf, last + 1, kept);
+	}
+	if (kept > 0)
+		consume(arg, buf, kept);
+	return 0;
+}
+
+//Newton square root, the shell is not linked with libm
+double stats_sqrt(double x)
+{
+	double s = x > 1 ? x / 2 : 1;
+
+	if (x <= 0)
+		return 0;
+	for (int i = 0; i < 2000; i++) {
+		double next = (s + x / s) / 2;
+
+		if (next == s)
+			break;
+		s = next;
+	}
+	return s;
+}
+
+/**
+ * madmath stats [-f field] [file...]: count, sum, min, max, mean, standard deviation and
+ * quantiles of the numbers read from the files or stdin
+ * @return exit status
+ */
+int madmath_stats(int argc, char **argv, struct io_t *io)
+{
+	static pthread_once_t once = PTHREAD_ONCE_INIT;
+	struct num_stats_t *stats = calloc(1, sizeof(struct num_stats_t));
+	char *buf = malloc(STATS_CHUNK);
+	int field = 0, status = 0, first = 2;
+
+	pthread_once(&once, stats_init_class);
+	if (argc > 3 && strcmp(argv[2], "-f") == 0) {
+		field = atoi(argv[3]);
+		first = 4;
+	}
+	if (field < 0 || (first == 4 && field == 0)) {
+		fprintf(io->out, "math: stats: %s: not a field number\n", argv[3]);
+		fprintf(io->out, "usage: math stats [-f field] [file...]\n");
+		free(stats);
+		free(buf);
+		return 2;
+	}
+
+	stats->field = field;
+	if (first >= argc && read_lines(fileno(io->in), buf, stats_scan, stats) == -1) {
+		fprintf(io->out, "-%s: %s: %s\n", sysname, argv[0], strerror(errno));
+		status = 1;
+	}
+	for (int i = first; i < argc; i++) {
+		int fd = open(argv[i], O_RDONLY);
+
+		if (fd < 0 || read_lines(fd, buf, stats_scan, stats) == -1) {
+			fprintf(io->out, "-%s: %s: %s: %s\n", sysname, argv[0], argv[i], strerror(errno));
+			status = 1;
+		}
+		if (fd >= 0)
+			close(fd);
+	}
+	num_stats_flush(stats);
+
+	fprintf(io->out, "count   %llu\n", (unsigned long long)stats->count);
+	if (stats->count > 0) {
+		fprintf(io->out, "sum     %.15g\n", stats->sum);
+		fprintf(io->out, "min     %.15g\n", stats->min);
+		fprintf(io->out, "max     %.15g\n", stats->max);
+		fprintf(io->out, "mean    %.15g\n", stats->mean);
+		fprintf(io->out, "stddev  %.15g\n", stats->count > 1 ? stats_sqrt(stats->m2 / (stats->count - 1)) : 0.0);
+		//The middle of a bucket may lie past the extremes
+		for (int i = 0; i < 3; i++) {
+			double q = sketch_quantile(&stats->sketch, (double[]){ 0.50, 0.90, 0.99 }[i]);
+
+			q = q < stats->min ? stats->min : q > stats->max ? stats->max : q;
+			fprintf(io->out, "%-7s %.6g\n", (char *[]){ "p50", "p90", "p99" }[i], q);
+		}
+	}
+
+	free(stats->sketch.positive.counts);
+	free(stats->sketch.negative.counts);
+	free(stats);
+	free(buf);
+	return status;
+}
+
+//Largest n of madmath factor and number of digits madmath pow may produce
+#define MADMATH_MAX_FACTOR 10000000u
+#define MADMATH_MAX_DIGITS 100000000ull
+//Most decimals of madmath pi, bounded by the longest NTT
+#define MADMATH_MAX_PI_DIGITS 20000000ul
+
+//Values of madmath expr, integers move to bignums when they overflow and back once they fit again
+enum { EXPR_INT, EXPR_BIG, EXPR_FLOAT };
+
+struct expr_value_t {
+	int type;
+	int64_t i;
+	double f;
+	struct bignum_t b;
+};
+
+#define EXPR_MAX_FIELD 1000
+
+//Bytecode of madmath expr, a stack machine, arg is the constant of EXPR_CONST and the field of EXPR_FIELD
+enum {
+	EXPR_CONST, EXPR_FIELD, EXPR_NEG, EXPR_ADD, EXPR_SUB, EXPR_MUL, EXPR_DIV, EXPR_MOD, EXPR_POW,
+	EXPR_ABS, EXPR_SQRT, EXPR_MIN, EXPR_MAX
+};
+
+//Operands each instruction pops, it always pushes one value
+const int expr_arity[] = { 0, 0, 1, 2, 2, 2, 2, 2, 2, 1, 1, 2, 2 };
+
+struct expr_insn_t {
+	uint32_t op;
+	uint32_t arg;
+};
+
+struct expr_program_t {
+	struct expr_insn_t *code;
+	size_t len, cap;
+	struct expr_value_t *consts;
+	size_t nconsts, consts_cap;
+	size_t depth; // stack slots the program needs
+	uint32_t fields; // highest $N used, 0 when the program reads no input
+	uint64_t loaded[(EXPR_MAX_FIELD + 63) / 64]; // bit N - 1 is set when the program reads $N
+};
+
+//Recursive descent state of the compiler, name=value bindings are folded in as constants
+struct expr_parser_t {
+	const char *p;
+	struct expr_program_t *program;
+	char **bindings;
+	int nbindings;
+	char error[128];
+};
+
+void expr_value_init(struct expr_value_t *v)
+{
+	v->type = EXPR_INT;
+	v->i = 0;
+	v->f = 0;
+	bn_init(&v->b);
+}
+
+void expr_value_copy(struct expr_value_t *dst, const struct expr_value_t *src)
+{
+	dst->type = src->type;
+	dst->i = src->i;
+	dst->f = src->f;
+	if (src->type == EXPR_BIG)
+		bn_copy(&dst->b, &src->b);
+}
+
+void expr_value_write(FILE *out, const struct expr_value_t *v)
+{
+	//Integers are formatted by hand, printf is most of the time of a stream of them
+	if (v->type == EXPR_INT) {
+		char digits[24];
+		int i = sizeof(digits);
+		uint64_t n = v->i < 0 ? -(uint64_t)v->i : (uint64_t)v->i;
+
+		do {
+			digits[--i] = '0' + n % 10;
+			n /= 10;
+		} while (n);
+		if (v->i < 0)
+			digits[--i] = '-';
+		fwrite(digits + i, 1, sizeof(digits) - i, out);
+	}
+	else if (v->type == EXPR_BIG)
+		bn_write(out, &v->b);
+	else
+		fprintf(out, "%.15g", v->f);
+}
+
+//Makes a bignum of an integer value
+void expr_to_big(struct expr_value_t *v)
+{
+	if (v->type != EXPR_INT)
+		return;
+	bn_set_u64(&v->b, v->i < 0 ? -(uint64_t)v->i : (uint64_t)v->i);
+	v->b.neg = v->i < 0;
+	v->type = EXPR_BIG;
+}
+
+//Back to an int64 when the bignum fits
+void expr_demote(struct expr_value_t *v)
+{
+	uint64_t magnitude;
+
+	if (v->type == EXPR_BIG && bn_get_u64(&v->b, &magnitude) == 0
+	    && magnitude <= (v->b.neg ? (uint64_t)INT64_MAX + 1 : (uint64_t)INT64_MAX)) {
+		v->i = v->b.neg ? (int64_t)-magnitude : (int64_t)magnitude;
+		v->type = EXPR_INT;
+	}
+}
+
+double expr_to_double(const struct expr_value_t *v)
+{
+	double f = 0;
+
+	if (v->type == EXPR_INT)
+		return v->i;
+	if (v->type == EXPR_FLOAT)
+		return v->f;
+	for (size_t i = v->b.len; i-- > 0;)
+		f = f * BN_BASE + v->b.d[i];
+	return v->b.neg ? -f : f;
+}
+
+void expr_to_float(struct expr_value_t *v)
+{
+	v->f = expr_to_double(v);
+	v->type = EXPR_FLOAT;
+}
+
+//Signed comparison of two integer values
+int expr_compare_int(struct expr_value_t *a, struct expr_value_t *b)
+{
+	if (a->type == EXPR_INT && b->type == EXPR_INT)
+		return (a->i > b->i) - (a->i < b->i);
+	expr_to_big(a);
+	expr_to_big(b);
+	if (a->b.neg != b->b.neg)
+		return a->b.neg ? -1 : 1;
+	return a->b.neg ? bn_cmp_abs(&b->b, &a->b) : bn_cmp_abs(&a->b, &b->b);
+}
+
+/**
+ * Parses an unsigned decimal number, integers without a point or exponent stay exact
+ * @return the end of the number, or p if there is none
+ */
+const char *expr_number(const char *p, const char *end, struct expr_value_t *v)
+{
+	const char *q = p + (p < end && (*p == '-' || *p == '+')), *digits = q;
+
+	while (q < end && isdigit((unsigned char)*q))
+		q++;
+	if (q < end && (*q == '.' || *q == 'e' || *q == 'E')) {
+		q = stats_number(p, end, &v->f);
+		v->type = EXPR_FLOAT;
+		return q;
+	}
+	if (q == digits)
+		return p;
+	if (q - digits <= 18) {
+		int64_t i = 0;
+
+		for (const char *d = digits; d < q; d++)
+			i = i * 10 + (*d - '0');
+		v->i = *p == '-' ? -i : i;
+		v->type = EXPR_INT;
+	}
+	else {
+		char *copy = strndup(p, q - p);
+
+		bn_parse(&v->b, copy);
+		free(copy);
+		v->type = EXPR_BIG;
+		expr_demote(v);
+	}
+	return q;
+}
+
+/**
+ * a = a ^ b for an integer b, a negative b gives a float unless a is 1 or -1
+ * @return NULL, or what went wrong
+ */
+const char *expr_pow(struct expr_value_t *a, struct expr_value_t *b)
+{
+	uint64_t e;
+	int negative;
+
+	if (b->type == EXPR_FLOAT) {
+		if (b->f != (double)(int64_t)b->f)
+			return "only integer powers are supported";
+		b->i = b->f;
+		b->type = EXPR_INT;
+	}
+	if (b->type == EXPR_BIG)
+		return "power too large";
+	negative = b->i < 0;
+	e = negative ? -(uint64_t)b->i : (uint64_t)b->i;
+
+	if (a->type == EXPR_FLOAT || negative) {
+		double x = expr_to_double(a), r = 1;
+
+		if (negative && a->type == EXPR_INT && (a->i == 1 || a->i == -1)) {
+			a->i = a->i == 1 || e % 2 == 0 ? 1 : -1;
+			return NULL;
+		}
+		if (negative && x == 0)
+			return "division by zero";
+		for (; e; e >>= 1, x *= x)
+			if (e & 1)
+				r *= x;
+		a->f = negative ? 1 / r : r;
+		a->type = EXPR_FLOAT;
+		return NULL;
+	}
+
+	//Exact powers, with the digit limit of madmath pow
+	if (a->type == EXPR_INT) {
+		int64_t r = 1, x = a->i;
+		uint64_t k = e;
+		int overflow = 0;
+
+		for (; k && !overflow; k >>= 1) {
+			if (k & 1)
+				overflow |= __builtin_mul_overflow(r, x, &r);
+			if (k > 1)
+				overflow |= __builtin_mul_overflow(x, x, &x);
+		}
+		if (!overflow) {
+			a->i = r;
+			return NULL;
+		}
+	}
+	//The result has e * log10(a) digits, estimated like madmath pow does
+	expr_to_big(a);
+	double digits = (a->b.len - 1) * BN_DIGITS;
+	for (uint32_t top = a->b.d[a->b.len - 1]; top >= 10; top /= 10)
+		digits++;
+	if ((double)e * (digits ? digits : 0.3) > MADMATH_MAX_DIGITS)
+		return "result has too many digits";
+	bn_pow(&a->b, &a->b, e);
+	expr_demote(a);
+	return NULL;
+}
+
+/**
+ * a = a op b for the binary operators, a = op a for the unary ones
+ * @return NULL, or what went wrong
+ */
+const char *expr_apply(int op, struct expr_value_t *a, struct expr_value_t *b)
+{
+	int64_t r;
+
+	switch (op) {
+	case EXPR_NEG:
+	case EXPR_ABS:
+		if (a->type == EXPR_FLOAT)
+			a->f = op == EXPR_NEG || a->f < 0 ? -a->f : a->f;
+		else if (a->type == EXPR_INT && a->i != INT64_MIN)
+			a->i = op == EXPR_NEG || a->i < 0 ? -a->i : a->i;
+		else {
+			expr_to_big(a);
+			a->b.neg = op == EXPR_NEG ? !a->b.neg : 0;
+			bn_trim(&a->b);
+			expr_demote(a);
+		}
+		return NULL;
+
+	case EXPR_SQRT:
+		expr_to_float(a);
+		if (a->f < 0)
+			return "square root of a negative number";
+		a->f = stats_sqrt(a->f);
+		return NULL;
+
+	case EXPR_MIN:
+	case EXPR_MAX:
+		if (a->type == EXPR_FLOAT || b->type == EXPR_FLOAT) {
+			if ((expr_to_double(b) < expr_to_double(a)) == (op == EXPR_MIN))
+				expr_value_copy(a, b);
+		}
+		else if ((expr_compare_int(b, a) < 0) == (op == EXPR_MIN)) {
+			expr_value_copy(a, b);
+		}
+		expr_demote(a);
+		expr_demote(b);
+		return NULL;
+
+	case EXPR_POW:
+		return expr_pow(a, b);
+	}
+
+	if (a->type == EXPR_FLOAT || b->type == EXPR_FLOAT) {
+		double x = expr_to_double(a), y = expr_to_double(b);
+
+		if ((op == EXPR_DIV || op == EXPR_MOD) && y == 0)
+			return "division by zero";
+		a->type = EXPR_FLOAT;
+		switch (op) {
+		case EXPR_ADD: a->f = x + y; break;
+		case EXPR_SUB: a->f = x - y; break;
+		case EXPR_MUL: a->f = x * y; break;
+		case EXPR_DIV: a->f = x / y; break;
+		//Truncated like the integer %, x - trunc(x / y) * y
+		case EXPR_MOD: a->f = x - (double)(int64_t)(x / y) * y; break;
+		}
+		return NULL;
+	}
+
+	if (a->type == EXPR_INT && b->type == EXPR_INT) {
+		switch (op) {
+		case EXPR_ADD:
+			if (!__builtin_add_overflow(a->i, b->i, &r))
+				return a->i = r, NULL;
+			break;
+		case EXPR_SUB:
+			if (!__builtin_sub_overflow(a->i, b->i, &r))
+				return a->i = r, NULL;
+			break;
+		case EXPR_MUL:
+			if (!__builtin_mul_overflow(a->i, b->i, &r))
+				return a->i = r, NULL;
+			break;
+		case EXPR_DIV:
+		case EXPR_MOD:
+			if (b->i == 0)
+				return "division by zero";
+			if (a->i != INT64_MIN || b->i != -1)
+				return a->i = op == EXPR_DIV ? a->i / b->i : a->i % b->i, NULL;
+			break;
+		}
+	}
+
+	//Overflowed or already big
+	expr_to_big(a);
+	expr_to_big(b);
+	switch (op) {
+	case EXPR_ADD: bn_add(&a->b, &a->b, &b->b); break;
+	case EXPR_SUB: bn_sub(&a->b, &a->b, &b->b); break;
+	case EXPR_MUL: bn_mul(&a->b, &a->b, &b->b); break;
+	case EXPR_DIV:
+	case EXPR_MOD:
+		if (bn_divmod(op == EXPR_DIV ? &a->b : NULL, op == EXPR_MOD ? &a->b : NULL, &a->b, &b->b) == -1)
+			return "division by zero";
+		break;
+	}
+	expr_demote(a);
+	expr_demote(b);
+	return NULL;
+}
+
+void expr_emit(struct expr_program_t *program, uint32_t op, uint32_t arg)
+{
+	if (program->len == program->cap) {
+		program->cap = program->cap ? program->cap * 2 : 16;
+		program->code = realloc(program->code, sizeof(struct expr_insn_t) * program->cap);
+	}
+	program->code[program->len++] = (struct expr_insn_t){ op, arg };
+}
+
+void expr_emit_const(struct expr_program_t *program, const struct expr_value_t *v)
+{
+	if (program->nconsts == program->consts_cap) {
+		program->consts_cap = program->consts_cap ? program->consts_cap * 2 : 16;
+		program->consts = realloc(program->consts, sizeof(struct expr_value_t) * program->consts_cap);
+	}
+	expr_value_init(&program->consts[program->nconsts]);
+	expr_value_copy(&program->consts[program->nconsts], v);
+	expr_emit(program, EXPR_CONST, program->nconsts++);
+}
+
+/**
+ * Emits an operator, folding it into one constant when its operands are constants,
+ * the constants of the operands are always the last ones
+ * @return 0, or -1 if folding found an error
+ */
+int expr_emit_op(struct expr_parser_t *parser, uint32_t op)
+{
+	struct expr_program_t *program = parser->program;
+	int n = expr_arity[op];
+	const char *error;
+
+	for (int i = 1; i <= n; i++)
+		if (program->len < (size_t)i || program->code[program->len - i].op != EXPR_CONST) {
+			expr_emit(program, op, 0);
+			return 0;
+		}
+
+	error = expr_apply(op, &program->consts[program->nconsts - n], n == 2 ? &program->consts[program->nconsts - 1] : NULL);
+	if (error) {
+		snprintf(parser->error, sizeof(parser->error), "%s", error);
+		return -1;
+	}
+	if (n == 2) {
+		bn_free(&program->consts[--program->nconsts].b);
+		program->len--;
+	}
+	return 0;
+}
+
+int expr_parse_sum(struct expr_parser_t *parser);
+
+void expr_skip_blanks(struct expr_parser_t *parser)
+{
+	while (isspace((unsigned char)*parser->p))
+		parser->p++;
+}
+
+//Functions of madmath expr
+struct expr_function_t {
+	const char *name;
+	uint32_t op;
+};
+
+const struct expr_function_t expr_functions[] = {
+	{ "abs", EXPR_ABS }, { "sqrt", EXPR_SQRT }, { "min", EXPR_MIN }, { "max", EXPR_MAX }
+};
+
+//primary = number | $N | name | name(args) | (sum)
+int expr_parse_primary(struct expr_parser_t *parser)
+{
+	struct expr_value_t v;
+	const char *start;
+
+	expr_skip_blanks(parser);
+	start = parser->p;
+
+	if (*start == '(') {
+		parser->p++;
+		if (expr_parse_sum(parser) == -1)
+			return -1;
+		expr_skip_blanks(parser);
+		if (*parser->p != ')') {
+			snprintf(parser->error, sizeof(parser->error), "missing )");
+			return -1;
+		}
+		parser->p++;
+		return 0;
+	}
+
+	if (*start == '$') {
+		char *end;
+		unsigned long field = strtoul(start + 1, &end, 10);
+
+		if (!isdigit((unsigned char)start[1]) || field == 0 || field > EXPR_MAX_FIELD) {
+			snprintf(parser->error, sizeof(parser->error), "bad field at '%.20s'", start);
+			return -1;
+		}
+		parser->p = end;
+		if (field > parser->program->fields)
+			parser->program->fields = field;
+		parser->program->loaded[(field - 1) / 64] |= 1ull << ((field - 1) % 64);
+		expr_emit(parser->program, EXPR_FIELD, field);
+		return 0;
+	}
+
+	if (isalpha((unsigned char)*start) || *start == '_') {
+		size_t len = 0;
+
+		while (isalnum((unsigned char)start[len]) || start[len] == '_')
+			len++;
+		parser->p += len;
+		expr_skip_blanks(parser);
+
+		if (*parser->p == '(') {
+			for (size_t f = 0; f < sizeof(expr_functions) / sizeof(expr_functions[0]); f++) {
+				if (strlen(expr_functions[f].name) != len || strncmp(expr_functions[f].name, start, len))
+					continue;
+				parser->p++;
+				for (int i = 0; i < expr_arity[expr_functions[f].op]; i++) {
+					if (i > 0) {
+						expr_skip_blanks(parser);
+						if (*parser->p != ',') {
+							snprintf(parser->error, sizeof(parser->error), "%.*s takes %d arguments", (int)len, start, expr_arity[expr_functions[f].op]);
+							return -1;
+						}
+						parser->p++;
+					}
+					if (expr_parse_sum(parser) == -1)
+						return -1;
+				}
+				expr_skip_blanks(parser);
+				if (*parser->p != ')') {
+					snprintf(parser->error, sizeof(parser->error), "%.*s takes %d arguments", (int)len, start, expr_arity[expr_functions[f].op]);
+					return -1;
+				}
+				parser->p++;
+				return expr_emit_op(parser, expr_functions[f].op);
+			}
+			snprintf(parser->error, sizeof(parser->error), "unknown function %.*s", (int)len, start);
+			return -1;
+		}
+
+		//The last binding of a name wins
+		for (int i = parser->nbindings; i-- > 0;) {
+			const char *binding = parser->bindings[i], *value = binding + len + 1;
+
+			if (strncmp(binding, start, len) || binding[len] != '=')
+				continue;
+			expr_value_init(&v);
+			if (expr_number(value, value + strlen(value), &v) != value + strlen(value) || !*value) {
+				snprintf(parser->error, sizeof(parser->error), "%.*s: %s: not a number", (int)len, start, value);
+				bn_free(&v.b);
+				return -1;
+			}
+			expr_emit_const(parser->program, &v);
+			bn_free(&v.b);
+			return 0;
+		}
+		snprintf(parser->error, sizeof(parser->error), "unknown name %.*s", (int)len, start);
+		return -1;
+	}
+
+	expr_value_init(&v);
+	if ((isdigit((unsigned char)*start) || *start == '.') && (parser->p = expr_number(start, start + strlen(start), &v)) != start) {
+		expr_emit_const(parser->program, &v);
+		bn_free(&v.b);
+		return 0;
+	}
+	if (*start)
+		snprintf(parser->error, sizeof(parser->error), "unexpected '%.20s'", start);
+	else
+		snprintf(parser->error, sizeof(parser->error), "unexpected end");
+	return -1;
+}
+
+//unary = -unary | +unary | primary [^ unary], so -2^2 is -4 and 2^3^2 is 2^9
+int expr_parse_unary(struct expr_parser_t *parser)
+{
+	expr_skip_blanks(parser);
+	if (*parser->p == '-' || *parser->p == '+') {
+		int neg = *parser->p++ == '-';
+
+		if (expr_parse_unary(parser) == -1)
+			return -1;
+		return neg ? expr_emit_op(parser, EXPR_NEG) : 0;
+	}
+	if (expr_parse_primary(parser) == -1)
+		return -1;
+	expr_skip_blanks(parser);
+	if (*parser->p == '^') {
+		parser->p++;
+		if (expr_parse_unary(parser) == -1)
+			return -1;
+		return expr_emit_op(parser, EXPR_POW);
+	}
+	return 0;
+}
+
+//product = unary {(* | / | %) unary}
+int expr_parse_product(struct expr_parser_t *parser)
+{
+	if (expr_parse_unary(parser) == -1)
+		return -1;
+	while (expr_skip_blanks(parser), *parser->p == '*' || *parser->p == '/' || *parser->p == '%') {
+		uint32_t op = *parser->p == '*' ? EXPR_MUL : *parser->p == '/' ? EXPR_DIV : EXPR_MOD;
+
+		parser->p++;
+		if (expr_parse_unary(parser) == -1 || expr_emit_op(parser, op) == -1)
+			return -1;
+	}
+	return 0;
+}
+
+//sum = product {(+ | -) product}
+int expr_parse_sum(struct expr_parser_t *parser)
+{
+	if (expr_parse_product(parser) == -1)
+		return -1;
+	while (expr_skip_blanks(parser), *parser->p == '+' || *parser->p == '-') {
+		uint32_t op = *parser->p == '+' ? EXPR_ADD : EXPR_SUB;
+
+		parser->p++;
+		if (expr_parse_product(parser) == -1 || expr_emit_op(parser, op) == -1)
+			return -1;
+	}
+	return 0;
+}
+
+void expr_free(struct expr_program_t *program)
+{
+	for (size_t i = 0; i < program->nconsts; i++)
+		bn_free(&program->consts[i].b);
+	free(program->consts);
+	free(program->code);
+}
+
+/**
+ * Compiles the expression to bytecode
+ * @param bindings name=value strings
+ * @return 0, or -1 with the reason in error
+ */
+int expr_compile(struct expr_program_t *program, const char *text, char **bindings, int nbindings, char *error, size_t size)
+{
+	struct expr_parser_t parser = { text, program, bindings, nbindings, "" };
+	size_t depth = 0;
+
+	memset(program, 0, sizeof(*program));
+	if (expr_parse_sum(&parser) == 0 && (expr_skip_blanks(&parser), *parser.p)) {
+		snprintf(parser.error, sizeof(parser.error), "unexpected '%.20s'", parser.p);
+	}
+	if (parser.error[0]) {
+		snprintf(error, size, "%s", parser.error);
+		expr_free(program);
+		memset(program, 0, sizeof(*program));
+		return -1;
+	}
+	for (size_t i = 0; i < program->len; i++) {
+		depth += 1 - expr_arity[program->code[i].op];
+		if (depth > program->depth)
+			program->depth = depth;
+	}
+	return 0;
+}
+
+/**
+ * Runs the program on the given fields, the result is left in stack[0]
+ * @param stack  program->depth values
+ * @return NULL, or what went wrong
+ */
+const char *expr_run(const struct expr_program_t *program, struct expr_value_t *stack, struct expr_value_t *fields)
+{
+	size_t sp = 0;
+	const char *error;
+
+	for (const struct expr_insn_t *insn = program->code; insn < program->code + program->len; insn++) {
+		switch (insn->op) {
+		case EXPR_CONST:
+			expr_value_copy(&stack[sp++], &program->consts[insn->arg]);
+			break;
+		case EXPR_FIELD:
+			expr_value_copy(&stack[sp++], &fields[insn->arg - 1]);
+			break;
+		default:
+			//The operands are the top one or two values, the result replaces the first
+			if (expr_arity[insn->op] == 2)
+				sp--;
+			if ((error = expr_apply(insn->op, &stack[sp - 1], &stack[sp])) != NULL)
+				return error;
+		}
+	}
+	return NULL;
+}
+
+//State of madmath expr over the lines of its input
+struct expr_stream_t {
+	struct expr_program_t *program;
+	struct expr_value_t *stack, *fields;
+	FILE *out;
+	uint64_t line;
+	int status;
+};
+
+//Evaluates the program once per line, with $1, $2 ... the blank or comma separated fields.
+//Only the fields the program reads are parsed, so text columns can sit next to numeric ones.
+//Blank lines are skipped.
+void expr_lines(void *arg, const char *buf, size_t len)
+{
+	struct expr_stream_t *stream = arg;
+	const struct expr_program_t *program = stream->program;
+	const char *p = buf, *end = buf + len, *error;
+	char message[32];
+
+	while (p < end) {
+		const char *line_end = memchr(p, '\n', end - p), *field_end;
+
+		if (line_end == NULL)
+			line_end = end;
+		stream->line++;
+		for (field_end = p; field_end < line_end && (*field_end == ' ' || *field_end == '\t' || *field_end == '\r'); field_end++)
+			;
+		if (field_end == line_end) {
+			p = line_end + 1;
+			continue;
+		}
+		error = NULL;
+		for (uint32_t f = 0; f < program->fields && error == NULL; f++) {
+			while (p < line_end && (*p == ' ' || *p == '\t' || *p == ','))
+				p++;
+			for (field_end = p; field_end < line_end && *field_end != ' ' && *field_end != '\t' && *field_end != ','; field_end++)
+				;
+			if (p == field_end) {
+				snprintf(message, sizeof(message), "$%u is missing", f + 1);
+				error = message;
+			}
+			else if ((program->loaded[f / 64] >> (f % 64) & 1) && expr_number(p, field_end, &stream->fields[f]) != field_end) {
+				snprintf(message, sizeof(message), "$%u is not a number", f + 1);
+				error = message;
+			}
+			p = field_end;
+		}
+		if (error == NULL)
+			error = expr_run(stream->program, stream->stack, stream->fields);
+
+		if (error) {
+			fprintf(stream->out, "math: expr: line %llu: %s\n", (unsigned long long)stream->line, error);
+			stream->status = 1;
+		}
+		else {
+			expr_value_write(stream->out, &stream->stack[0]);
+			fputc('\n', stream->out);
+		}
+		p = line_end + 1;
+	}
+}
+
+int expr_is_binding(const char *word)
+{
+	size_t len = 0;
+
+	if (!isalpha((unsigned char)word[0]) && word[0] != '_')
+		return 0;
+	while (isalnum((unsigned char)word[len]) || word[len] == '_')
+		len++;
+	return word[len] == '=';
+}
+
+/**
+ * madmath expr '<expression>' [name=value]...: evaluates the expression once, or once per line of
+ * stdin when it uses the fields $1, $2 ... of the line
+ * @return exit status
+ */
+int madmath_expr(int argc, char **argv, struct io_t *io)
+{
+	struct expr_program_t program;
+	struct expr_stream_t stream = { &program, NULL, NULL, io->out, 0, 0 };
+	char error[128], *text;
+	size_t slots, len = 0;
+	int words = 2, failed;
+
+	//The shell splits the expression at blanks even inside quotes, so the words up to the
+	//first name=value are joined again and an outer pair of quotes is dropped
+	while (words < argc && !expr_is_binding(argv[words]))
+		len += strlen(argv[words++]) + 1;
+	if (words == 2) {
+		fprintf(io->out, "math: expr: bad usage\n");
+		fprintf(io->out, "usage: math expr '<expression>' [name=value]...\n");
+		return 2;
+	}
+	text = calloc(len + 1, 1);
+	for (int i = 2; i < words; i++) {
+		strcat(text, argv[i]);
+		if (i + 1 < words)
+			strcat(text, " ");
+	}
+	len = strlen(text);
+	if (len >= 2 && (text[0] == '\'' || text[0] == '"') && text[len - 1] == text[0]) {
+		text[len - 1] = ' ';
+		text[0] = ' ';
+	}
+	failed = expr_compile(&program, text, argv + words, argc - words, error, sizeof(error));
+	free(text);
+	if (failed == -1) {
+		fprintf(io->out, "math: expr: %s\n", error);
+		return 1;
+	}
+
+	slots = program.depth + program.fields;
+	stream.stack = malloc(sizeof(struct expr_value_t) * (slots ? slots : 1));
+	for (size_t i = 0; i < slots; i++)
+		expr_value_init(&stream.stack[i]);
+	stream.fields = stream.stack + program.depth;
+
+	if (program.fields == 0) {
+		const char *failed = expr_run(&program, stream.stack, NULL);
+
+		if (failed) {
+			fprintf(io->out, "math: expr: %s\n", failed);
+			stream.status = 1;
+		}
+		else {
+			expr_value_write(io->out, &stream.stack[0]);
+			fputc('\n', io->out);
+		}
+	}
+	else {
+		char *buf = malloc(STATS_CHUNK);
+
+		if (read_lines(fileno(io->in), buf, expr_lines, &stream) == -1) {
+			fprintf(io->out, "-%s: %s: %s\n", sysname, argv[0], strerror(errno));
+			stream.status = 1;
+		}
+		free(buf);
+	}
+
+	for (size_t i = 0; i < slots; i++)
+		bn_free(&stream.stack[i].b);
+	free(stream.stack);
+	expr_free(&program);
+	return stream.status;
+}
+
+/**
+ * Parses the two numbers of a madmath option
+ * @return 0, or 1 after printing which one is not a number
+ */
+int madmath_operands(char **argv, struct bignum_t *num1, struct bignum_t *num2, struct io_t *io)
+{
+	if(bn_parse(num1, argv[2]) == -1) {
+		fprintf(io->out, "math: %s: %s: not a number\n", argv[1], argv[2]);
+		return 1;
+	}
+	if(bn_parse(num2, argv[3]) == -1) {
+		fprintf(io->out, "math: %s: %s: not a number\n", argv[1], argv[3]);
+		return 1;
+	}
+	return 0;
+}
+
+/**
+ * Small calculator, followed by a notification from a famous mathematician
+ * @param  argc
+ * @param  argv  argv[0] is the name of the builtin
+ * @param  io
+ * @return       exit status
+ */
+int builtin_madmath(int argc, char **argv, struct io_t *io)
+{
+	struct bignum_t num1, num2, result;
+	int status = 0;
+
+	bn_init(&num1);
+	bn_init(&num2);
+	bn_init(&result);
+
+	if(argc < 2 ) {
+
+		fprintf(io->out, "math :Too few arguments\n");
+		fprintf(io->out, "usage: math <option> <number> <number>\n");
+		fprintf(io->out, "options :sub ,sum,factor !!!!!FIND OUT THE REST!!!!!!!\n");
+	}
+	//Assigning options
+	else if(strcmp(argv[1],"sub") == 0){
+	    
+	    if(argv[2] == NULL || argv[3] == NULL) {
+
+			fprintf(io->out, "math: sub: bad usage\n");
+			fprintf(io->out, "usage: math sub <num1> <num2>\n");
+			status = 2;
+	    }
+	    else if((status = madmath_operands(argv, &num1, &num2, io)) == 0) {
+			bn_sub(&result, &num1, &num2);
+			bn_print(io->out, &result);
+	    }	
+	}
+	else if(strcmp(argv[1],"sum") == 0){
+	    
+	    if(argv[2] == NULL || argv[3] == NULL) {
+
+			fprintf(io->out, "math: sum: bad usage\n");
+			fprintf(io->out, "usage: math sum <num1> <num2>\n");
+			status = 2;
+		}
+		else if((status = madmath_operands(argv, &num1, &num2, io)) == 0) {
+			bn_add(&result, &num1, &num2);
+			bn_print(io->out, &result);
+		}
+	}
+	else if(strcmp(argv[1],"factor") == 0) {
+
+		if(argv[2] == NULL) {
+			fprintf(io->out, "Please provide a number!\n");
+			status = 2;
+		}
+		else if(argc > 3) {
+			fprintf(io->out, "math: factor: bad usage\n");
+			fprintf(io->out, "usage: math factor <num> \n");;
+			status = 2;
+		}
+		else if(bn_parse(&num1, argv[2]) == -1) {
+			fprintf(io->out, "math: factor: %s: not a number\n", argv[2]);
+			status = 1;
+		}
+		else if(num1.neg) {
+        			fprintf(io->out, "Factoriel of a negative number cannot be calculated!\n");
+			status = 1;
+		}
+		else if(num1.len > 1 || (num1.len == 1 && num1.d[0] > MADMATH_MAX_FACTOR)) {
+			fprintf(io->out, "math: factor: %s: larger than %u\n", argv[2], MADMATH_MAX_FACTOR);
+			status = 1;
+		}
+    		else {
+			bn_factorial(&result, num1.len ? num1.d[0] : 0);
+			bn_print(io->out, &result);
+		}
+		
+         	}
+
+	else if(strcmp(argv[1],"primes") == 0) {
+
+		//-c only counts them, the primes up to 10^10 alone are 5 GB of text
+		int list = !(argc > 2 && strcmp(argv[2], "-c") == 0);
+		char *arg = list ? argv[2] : argv[3], *end;
+		unsigned long long n = 0;
+
+		if(arg == NULL || argc > (list ? 3 : 4)) {
+			fprintf(io->out, "math: primes: bad usage\n");
+			fprintf(io->out, "usage: math primes [-c] <num>\n");
+			status = 2;
+		}
+		else if(!isdigit((unsigned char)arg[0]) || (errno = 0, n = strtoull(arg, &end, 10), *end)) {
+			fprintf(io->out, "math: primes: %s: not a number\n", arg);
+			status = 1;
+		}
+		else if(errno == ERANGE || n > SIEVE_MAX) {
+			fprintf(io->out, "math: primes: %s: larger than %llu\n", arg, SIEVE_MAX);
+			status = 1;
+		}
+		else {
+			madmath_primes(io->out, n, list);
+		}
+	}
+
+	else if(strcmp(argv[1],"factorize") == 0) {
+
+		if(argc < 3) {
+			fprintf(io->out, "math: factorize: bad usage\n");
+			fprintf(io->out, "usage: math factorize <num>...\n");
+			status = 2;
+		}
+		else {
+			size_t nprimes;
+			uint32_t *primes = sieve_small_primes(FACTOR_TRIAL_LIMIT, &nprimes);
+
+			//Each number is written as soon as it is factored
+			for(int i = 2; i < argc; i++) {
+				if(bn_parse(&num1, argv[i]) == -1 || num1.neg) {
+					fprintf(io->out, "math: factorize: %s: not a positive integer\n", argv[i]);
+					status = 1;
+				}
+				else if(madmath_factorize(io->out, &num1, primes, nprimes) == -1) {
+					fprintf(io->out, "math: factorize: %s: a factor above 2^64 was left unsplit\n", argv[i]);
+					status = 1;
+				}
+			}
+			free(primes);
+		}
+	}
+
+	else if(strcmp(argv[1],"expr") == 0) {
+
+		status = madmath_expr(argc, argv, io);
+	}
+
+	else if(strcmp(argv[1],"stats") == 0) {
+
+		status = madmath_stats(argc, argv, io);
+	}
+
+	else if(strcmp(argv[1],"pi") == 0) {
+
+		//Ten decimals unless asked for more, then with the time it took on stderr
+		char *end;
+		unsigned long digits = argc > 2 ? strtoul(argv[2], &end, 10) : 10;
+
+		if(argc > 2 && (*end || argv[2][0] == '-' || digits == 0)) {
+			fprintf(io->out, "math: pi: %s: not a number of digits\n", argv[2]);
+			status = 1;
+		}
+		else if(digits > MADMATH_MAX_PI_DIGITS) {
+			fprintf(io->out, "math: pi: at most %lu digits\n", MADMATH_MAX_PI_DIGITS);
+			status = 1;
+		}
+		else {
+			madmath_pi(io->out, argc > 2 ? io->err : NULL, digits);
+		}
+
+	}
+	
+	else if(strcmp(argv[1],"pow") == 0) {
+
+		if(argv[2] == NULL || argv[3] == NULL) {
+
+			fprintf(io->out, "math: pow: bad usage\n");
+			fprintf(io->out, "usage: math pow <base> <power>\n");
+			status = 2;
+		}
+		else if((status = madmath_operands(argv, &num1, &num2, io)) != 0) {
+		}
+		else if(num2.neg) {
+			fprintf(io->out, "math: pow: negative powers are not integers\n");
+			status = 1;
+		}
+		else {
+			//The result has power * log10(base) digits, log10(base) is at least
+			//one less than the digits of the base and at least 0.3 for 2 to 9
+			unsigned long long power = 0;
+			double digits = 0;
+
+			for(size_t i = num2.len; i-- > 0 && power <= MADMATH_MAX_DIGITS * 4;)
+				power = power * BN_BASE + num2.d[i];
+			if(num1.len > 1 || (num1.len == 1 && num1.d[0] > 1)) {
+				digits = (num1.len - 1) * BN_DIGITS;
+				for(uint32_t top = num1.d[num1.len - 1]; top >= 10; top /= 10)
+					digits++;
+				if(digits == 0)
+					digits = 0.3;
+			}
+
+			if(power * digits > MADMATH_MAX_DIGITS) {
+				fprintf(io->out, "math: pow: result would have more than %llu digits\n", MADMATH_MAX_DIGITS);
+				status = 1;
+			}
+			else {
+				bn_pow(&result, &num1, power);
+				bn_print(io->out, &result);
+			}
+		}
+
+	}
+
+	else if(strcmp(argv[1],"mod") == 0) {
+
+		if(argv[2] == NULL || argv[3] == NULL) {
+
+			fprintf(io->out, "math: mod: bad usage\n");
+			fprintf(io->out, "usage: math mod <num1> <num2>\n");
+			status = 2;
+		}
+		else if((status = madmath_operands(argv, &num1, &num2, io)) != 0) {
+		}
+		else if(bn_divmod(NULL, &result, &num1, &num2) == -1) {
+			fprintf(io->out, "math: mod: division by zero\n");
+			status = 1;
+		}
+		else {
+			bn_print(io->out, &result);
+		}
+	}
+	bn_free(&num1);
+	bn_free(&num2);
+	bn_free(&result);
+	
+	//Chosing the message to be displayed randomly
+	char *header,*message;
+	int num;
+	num = rand() % 11;
+	
+	switch (num) {
+	    
+	    case 1:
+	        header = "BEST REGARDS";
+	        message = "FROM YOUR MIDDLE SCHOOL MATH TEACHER";
+	        break;
+
+	    case 2:
+	        header = "Tesla Business Offer";
+	        message = "HEY DUDE, THIS IS ELON WANT U";
+	        break;
+	    
+	    case 3:
+	        header = "NASA";
+	        message = "WANNA BECOME A ASTRONAUT";
+	        break;
+	    
+	    case 4:
+	        header = "Leonhard Euler";
+	        message = "I am proud of you son!";
+	        break;
+	        
+	    case 5:
+	        header = "Abel Prize";
+	        message = "We want to give you The Abel Prize sir";
+	        break;
+	    
+	    case 6:
+	        header = "***CONGRATS***";
+	        message = "YOU ARE CHOOSEN AS GOAT MATHEMATICIAN!";
+	        break;    
+	    
+	    case 7:
+	        header = "Pythagoras";
+	        message = "Like your triangle right triangle";
+	        break; 
+	        
+	    case 8:
+	        header = "Guinness World Records";
+	        message = "NEW WORLD RECORD: The most genius mathematician is you!!!";
+	        break; 
+	    case 9:
+	        header = "***FATAL WARNING***";
+	        message = "I AM NOT A CALCULATOR, I AM A COMPUTER!!!";
+	        break; 
+	    default:
+	        header = "***FATAL WARNING***";
+	        message = "I AM NOT A CALCULATOR, I AM A COMPUTER!!!";
+	        break;   
+    		}  
+	 
+	//Displaying the message with the notify-send, the helper shows it while the shell goes on
+	fflush(io->out);
+	notify(header, message);
+
+	return status;
+}
+
+//A command of parallel with the output it has written so far
+struct parallel_job_t {
+	char *command;
+	pid_t pid;	 // 0 once reaped
+	int fd;		 // read end of its output pipe, -1 at the end of the output
+	int status;
+	int finished;
+	char *out;
+	size_t len;
+	size_t capacity;
+};
+
+//Arguments of parallel read from stdin, one per line
+struct parallel_args_t {
+	char **args;
+	int count;
+	int capacity;
+};
+
+//read_lines handler of parallel, keeps every non-empty line as an argument
+void parallel_lines(void *arg, const char *buf, size_t len)
+{
+	struct parallel_args_t *list = arg;
+	const char *end = buf + len;
+
+	while (buf < end) {
+		const char *newline = memchr(buf, '\n', end - buf);
+		const char *stop = newline ? newline : end;
+
+		if (stop > buf) {
+			if (list->count == list->capacity) {
+				list->capacity = list->capacity ? 2 * list->capacity : 64;
+				list->args = realloc(list->args, sizeof(char *) * list->capacity);
+			}
+			list->args[list->count++] = strndup(buf, stop - buf);
+		}
+		buf = stop + 1;
+	}
+}
+
+/**
+ * Replaces {} in a word of the template with the argument, {.} with the argument without its
+ * extension and {/} with its last path component
+ * @param  word
+ * @param  arg
+ * @param  used set to 1 if the word has one of them
+ * @return      the word, to be freed
+ */
+char *parallel_substitute(const char *word, char *arg, int *used)
+{
+	char *base = strrchr(arg, '/'), *dot = strrchr(arg, '.');
+	size_t arglen = strlen(arg), stem = dot && (base == NULL || dot > base) ? (size_t)(dot - arg) : arglen;
+	char *result, *out;
+
+	base = base ? base + 1 : arg;
+	out = result = malloc(strlen(word) * (arglen + 1) + 1);
+	for (const char *p = word; *p;) {
+		if (strncmp(p, "{}", 2) == 0) {
+			out = stpcpy(out, arg);
+			p += 2;
+			*used = 1;
+		}
+		else if (strncmp(p, "{.}", 3) == 0) {
+			memcpy(out, arg, stem);
+			out += stem;
+			p += 3;
+			*used = 1;
+		}
+		else if (strncmp(p, "{/}", 3) == 0) {
+			out = stpcpy(out, base);
+			p += 3;
+			*used = 1;
+		}
+		else
+			*out++ = *p++;
+	}
+	*out = '\0';
+	return result;
+}
+
+/**
+ * Substitutes the argument into the words of a parsed template. This happens after parsing so
+ * that an argument always stays one word, blanks, ; or | in it are not seen by the parser.
+ * @param node
+ * @param arg
+ */
+void parallel_bind(struct node_t *node, char *arg)
+{
+	char *word;
+	int used;
+
+	if (node == NULL)
+		return;
+	for (struct command_t *stage = node->command; stage; stage = stage->next) {
+		word = parallel_substitute(stage->name, arg, &used);
+		free(stage->name);
+		stage->name = word;
+		for (int i = 0; i < stage->arg_count; i++) {
+			word = parallel_substitute(stage->args[i], arg, &used);
+			free(stage->args[i]);
+			stage->args[i] = word;
+		}
+		for (int i = 0; i < 3; i++) {
+			if (stage->redirects[i] == NULL)
+				continue;
+			word = parallel_substitute(stage->redirects[i], arg, &used);
+			free(stage->redirects[i]);
+			stage->redirects[i] = word;
+		}
+	}
+	for (int i = 0; i < 3; i++) {
+		if (node->redirects[i] == NULL)
+			continue;
+		word = parallel_substitute(node->redirects[i], arg, &used);
+		free(node->redirects[i]);
+		node->redirects[i] = word;
+	}
+	parallel_bind(node->left, arg);
+	parallel_bind(node->right, arg);
+}
+
+/**
+ * Joins the words of the template into a command line, {} is appended when the template uses
+ * none of {}, {.} and {/}
+ * @return the line, to be freed
+ */
+char *parallel_template(int argc, char **argv)
+{
+	char *line = join_command(argc, argv), *word;
+	int used = 0;
+
+	word = parallel_substitute(line, "", &used);
+	free(word);
+	if (!used) {
+		line = realloc(line, strlen(line) + 4);
+		strcat(line, " {}");
+	}
+	return line;
+}
+
+/**
+ * Writes the output of a finished job and reports a failure
+ * @param out
+ * @param job
+ */
+void parallel_report(FILE *out, struct parallel_job_t *job)
+{
+	if (job->len)
+		fwrite(job->out, 1, job->len, out);
+	if (job->status != 0)
+		fprintf(out, "parallel: exit %d: %s\n", job->status, job->command);
+	fflush(out);
+	free(job->out);
+	job->out = NULL;
+}
+
+/**
+ * Runs a command template for every argument with at most N commands at a time. Each command
+ * writes into a buffer of its own that is printed when it finishes, in the order the commands
+ * finish or with -k in the order of the arguments. -u lets them write straight to the terminal.
+ * @param  argc
+ * @param  argv  argv[0] is the name of the builtin
+ * @param  io
+ * @return       exit status, the number of failed commands up to 101
+ */
+int builtin_parallel(int argc, char **argv, struct io_t *io)
+{
+	struct parallel_args_t list = { NULL, 0, 0 };
+	struct parallel_job_t *jobs;
+	struct pollfd *fds;
+	long slots = sysconf(_SC_NPROCESSORS_ONLN);
+	int i = 1, keep = 0, ungrouped = 0, separator, next = 0, printed = 0, running = 0, failed = 0, stop = 0, sfd;
+	char *template;
+	sigset_t mask, saved;
+
+	for (; i < argc && argv[i][0] == '-'; i++) {
+		if (strcmp(argv[i], "-k") == 0)
+			keep = 1;
+		else if (strcmp(argv[i], "-u") == 0)
+			ungrouped = 1;
+		else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc && atoi(argv[i + 1]) >= 0) {
+			if (atoi(argv[++i]) > 0)
+				slots = atoi(argv[i]);
+		}
+		else
+			break;
+	}
+	for (separator = i; separator < argc && strcmp(argv[separator], ":::") != 0; separator++)
+		;
+	if (separator == i || (i < argc && argv[i][0] == '-')) {
+		fprintf(io->out, "usage: parallel [-j N] [-k] [-u] <command> [::: argument...]\n");
+		fprintf(io->out, "       {} is the argument, {.} without extension, {/} without directory\n");
+		return 2;
+	}
+	if (slots < 1)
+		slots = 1;
+
+	//The arguments after :::, or the lines of stdin without it
+	if (separator < argc) {
+		for (int j = separator + 1; j < argc; j++)
+			parallel_lines(&list, argv[j], strlen(argv[j]));
+	}
+	else {
+		char *buf = malloc(STATS_CHUNK);
+
+		if (read_lines(fileno(io->in), buf, parallel_lines, &list) == -1)
+			fprintf(io->out, "-%s: %s: %s\n", sysname, argv[0], strerror(errno));
+		free(buf);
+	}
+	if (list.count == 0) {
+		free(list.args);
+		return 0;
+	}
+
+	//^C and the end of a job come through a signalfd, as in the loop of the prompt
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGCHLD);
+	sigprocmask(SIG_BLOCK, &mask, &saved);
+	sfd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+	if (sfd == -1) {
+		fprintf(io->out, "-%s: %s: %s\n", sysname, argv[0], strerror(errno));
+		sigprocmask(SIG_SETMASK, &saved, NULL);
+		return 1;
+	}
+	jobs = calloc(list.count, sizeof(struct parallel_job_t));
+	fds = malloc(sizeof(struct pollfd) * (slots + 1));
+	template = parallel_template(separator - i, argv + i);
+	fflush(io->out);
+
+	while (next < list.count || running > 0) {
+		int n = 1;
+
+		//Keep every slot busy
+		while (!stop && running < slots && next < list.count) {
+			struct parallel_job_t *job = &jobs[next++];
+			int pipefds[2] = { -1, -1 };
+
+			char *buf = strdup(template);
+			struct node_t *tree = parse_line(buf);
+			int used;
+
+			//The command as it is reported, the job itself runs from the parsed template
+			job->command = parallel_substitute(template, list.args[next - 1], &used);
+			job->fd = -1;
+			parallel_bind(tree, list.args[next - 1]);
+			if (!ungrouped && pipe2(pipefds, O_CLOEXEC) == -1)
+				job->pid = -1;
+			else
+				job->pid = spawn_node(tree, 0, pipefds[1]);
+			free_node(tree);
+			free(buf);
+			if (pipefds[1] != -1)
+				close(pipefds[1]);
+			if (job->pid == -1) {
+				if (pipefds[0] != -1)
+					close(pipefds[0]);
+				job->pid = 0;
+				job->status = 126;
+				job->finished = 1;
+				continue;
+			}
+			job->fd = pipefds[0];
+			running++;
+		}
+		if (running == 0 && (stop || next == list.count))
+			break;
+
+		fds[0] = (struct pollfd){ sfd, POLLIN, 0 };
+		for (int j = printed; j < next; j++)
+			if (jobs[j].fd != -1)
+				fds[n++] = (struct pollfd){ jobs[j].fd, POLLIN, 0 };
+		if (poll(fds, n, -1) == -1 && errno != EINTR)
+			break;
+
+		//Output of the jobs into their buffers
+		for (int j = printed, k = 1; j < next && k < n; j++) {
+			struct parallel_job_t *job = &jobs[j];
+			ssize_t got;
+
+			if (job->fd == -1 || job->fd != fds[k].fd)
+				continue;
+			if (fds[k++].revents == 0)
+				continue;
+			if (job->capacity - job->len < 4096) {
+				job->capacity = job->capacity ? 2 * job->capacity : 8192;
+				job->out = realloc(job->out, job->capacity);
+			}
+			got = read(job->fd, job->out + job->len, job->capacity - job->len);
+			if (got > 0)
+				job->len += got;
+			else if (got == 0 || errno != EINTR) {
+				close(job->fd);
+				job->fd = -1;
+			}
+		}
+
+		if (fds[0].revents & POLLIN) {
+			struct signalfd_siginfo info;
+
+			while (read(sfd, &info, sizeof(info)) == sizeof(info)) {
+				if (info.ssi_signo == SIGINT && !stop) {
+					stop = 1;
+					fprintf(io->out, "\n");
+					for (int j = printed; j < next; j++)
+						if (jobs[j].pid > 0)
+							kill(-jobs[j].pid, SIGTERM);
+				}
+			}
+		}
+		for (int j = printed; j < next; j++) {
+			struct parallel_job_t *job = &jobs[j];
+			int status;
+
+			if (job->pid > 0 && waitpid(job->pid, &status, WNOHANG) == job->pid) {
+				job->pid = 0;
+				job->status = exit_code(status);
+			}
+			//Done when it has been reaped and its output is closed, a leftover background
+			//process holding the pipe keeps it going
+			if (!job->finished && job->pid == 0 && job->fd == -1) {
+				job->finished = 1;
+				running--;
+			}
+		}
+
+		//Finished jobs are printed at once, or with -k once the jobs before them are printed
+		for (int j = printed; j < next; j++) {
+			if (!jobs[j].finished)
+				continue;
+			if (keep && j != printed)
+				break;
+			if (jobs[j].command) {
+				failed += jobs[j].status != 0;
+				parallel_report(io->out, &jobs[j]);
+				free(jobs[j].command);
+				jobs[j].command = NULL;
+			}
+			if (j == printed)
+				printed++;
+		}
+		while (printed < next && jobs[printed].finished && jobs[printed].command == NULL)
+			printed++;
+	}
+
+	if (stop)
+		fprintf(io->out, "parallel: interrupted, %d of %d commands not run\n", list.count - next, list.count);
+	else if (failed)
+		fprintf(io->out, "parallel: %d of %d commands failed\n", failed, list.count);
+	close(sfd);
+	sigprocmask(SIG_SETMASK, &saved, NULL);
+	for (int j = 0; j < list.count; j++) {
+		free(list.args[j]);
+		free(jobs[j].command);
+		free(jobs[j].out);
+	}
+	free(list.args);
+	free(jobs);
+	free(fds);
+	free(template);
+	return failed > 101 ? 101 : failed;
+}
+
+//SHA-256 of the cache, kept here since the shell links nothing but pthreads
+struct sha256_t {
+	uint32_t h[8];
+	uint64_t len;
+	uint8_t buf[64];
+	size_t fill;
+};
+
+const uint32_t sha256_k[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static inline uint32_t sha256_ror(uint32_t x, int n)
+{
+	return (x >> n) | (x << (32 - n));
+}
+
+void sha256_block(struct sha256_t *s, const uint8_t *p)
+{
+	uint32_t w[64], a, b, c, d, e, f, g, h;
+
+	for (int i = 0; i < 16; i++)
+		w[i] = (uint32_t)p[4 * i] << 24 | (uint32_t)p[4 * i + 1] << 16 | (uint32_t)p[4 * i + 2] << 8 | p[4 * i + 3];
+	for (int i = 16; i < 64; i++) {
+		uint32_t s0 = sha256_ror(w[i - 15], 7) ^ sha256_ror(w[i - 15], 18) ^ (w[i - 15] >> 3);
+		uint32_t s1 = sha256_ror(w[i - 2], 17) ^ sha256_ror(w[i - 2], 19) ^ (w[i - 2] >> 10);
+
+		w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+	}
+	a = s->h[0], b = s->h[1], c = s->h[2], d = s->h[3];
+	e = s->h[4], f = s->h[5], g = s->h[6], h = s->h[7];
+	for (int i = 0; i < 64; i++) {
+		uint32_t t1 = h + (sha256_ror(e, 6) ^ sha256_ror(e, 11) ^ sha256_ror(e, 25)) + ((e & f) ^ (~e & g)) + sha256_k[i] + w[i];
+		uint32_t t2 = (sha256_ror(a, 2) ^ sha256_ror(a, 13) ^ sha256_ror(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+
+		h = g, g = f, f = e, e = d + t1;
+		d = c, c = b, b = a, a = t1 + t2;
+	}
+	s->h[0] += a, s->h[1] += b, s->h[2] += c, s->h[3] += d;
+	s->h[4] += e, s->h[5] += f, s->h[6] += g, s->h[7] += h;
+}
+
+void sha256_init(struct sha256_t *s)
+{
+	static const uint32_t h[8] = { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 };
+
+	memcpy(s->h, h, sizeof(h));
+	s->len = 0;
+	s->fill = 0;
+}
+
+void sha256_update(struct sha256_t *s, const void *data, size_t len)
+{
+	const uint8_t *p = data;
+
+	s->len += len;
+	if (s->fill) {
+		size_t n = 64 - s->fill < len ? 64 - s->fill : len;
+
+		memcpy(s->buf + s->fill, p, n);
+		s->fill += n;
+		p += n;
+		len -= n;
+		if (s->fill < 64)
+			return;
+		sha256_block(s, s->buf);
+		s->fill = 0;
+	}
+	for (; len >= 64; p += 64, len -= 64)
+		sha256_block(s, p);
+	memcpy(s->buf, p, len);
+	s->fill = len;
+}
+
+/**
+ * Finishes a hash and writes it as 64 hex digits
+ * @param s
+ * @param hex room for 65 characters
+ */
+void sha256_hex(struct sha256_t *s, char *hex)
+{
+	uint64_t bits = s->len * 8;
+	uint8_t pad[72] = { 0x80 };
+	size_t padlen = (s->fill < 56 ? 56 : 120) - s->fill;
+
+	for (int i = 0; i < 8; i++)
+		pad[padlen + i] = bits >> (56 - 8 * i);
+	sha256_update(s, pad, padlen + 8);
+	for (int i = 0; i < 8; i++)
+		sprintf(hex + 8 * i, "%08x", s->h[i]);
+}
+
+//Bound of the output cache when SHELLFYRE_CACHE_MAX is not set
+#define CACHE_DEFAULT_MAX (256ull << 20)
+//Part of every key, changing it drops what older versions of the shell stored
+#define CACHE_VERSION "shellfyre-cache-1"
+//Most -i, -c and -e options of one cached command
+#define CACHE_MAX_DECLARED 64
+
+/**
+ * Path of the cache, $XDG_CACHE_HOME/shellfyre or ~/.cache/shellfyre, created if needed
+ * together with its keys and objects directories
+ * @return 0 on success, -1 on error
+ */
+int cache_dir(char *dir, size_t size)
+{
+	char path[1024];
+
+	if (getenv("XDG_CACHE_HOME") && getenv("XDG_CACHE_HOME")[0] == '/')
+		snprintf(dir, size, "%s/shellfyre", getenv("XDG_CACHE_HOME"));
+	else if (getenv("HOME"))
+		snprintf(dir, size, "%s/.cache/shellfyre", getenv("HOME"));
+	else {
+		errno = ENOENT;
+		return -1;
+	}
+	//Every component of the path, as take does
+	for (char *p = dir + 1; ; p++) {
+		if (*p == '/' || *p == '\0') {
+			char c = *p;
+
+			*p = '\0';
+			if (mkdir(dir, S_IRWXU) == -1 && errno != EEXIST)
+				return -1;
+			*p = c;
+			if (c == '\0')
+				break;
+		}
+	}
+	snprintf(path, sizeof(path), "%s/keys", dir);
+	if (mkdir(path, S_IRWXU) == -1 && errno != EEXIST)
+		return -1;
+	snprintf(path, sizeof(path), "%s/objects", dir);
+	if (mkdir(path, S_IRWXU) == -1 && errno != EEXIST)
+		return -1;
+	return 0;
+}
+
+/**
+ * Adds a declared input to the key, by its metadata or with contents set by its contents
+ * @param key
+ * @param path
+ * @param contents
+ */
+void cache_input(struct sha256_t *key, char *path, int contents)
+{
+	struct stat st;
+	char meta[128];
+	char buf[65536];
+	ssize_t n;
+	int fd;
+
+	sha256_update(key, path, strlen(path) + 1);
+	if (lstat(path, &st) == -1) {
+		sha256_update(key, "missing", 8);
+		return;
+	}
+	if (!contents || !S_ISREG(st.st_mode) || (fd = open(path, O_RDONLY)) == -1) {
+		snprintf(meta, sizeof(meta), "%o %lld %lld.%09ld %llu", st.st_mode, (long long)st.st_size,
+			(long long)st.st_mtim.tv_sec, st.st_mtim.tv_nsec, (unsigned long long)st.st_ino);
+		sha256_update(key, meta, strlen(meta) + 1);
+		return;
+	}
+	while ((n = read(fd, buf, sizeof(buf))) > 0)
+		sha256_update(key, buf, n);
+	close(fd);
+}
+
+//What walkDirectory adds to a key for the entries of a declared input directory
+struct cache_walk_t {
+	struct sha256_t *key;
+	int contents;
+};
+
+int cache_visit(void *arg, char *path, struct dirent *entry)
+{
+	struct cache_walk_t *walk = arg;
+
+	(void)entry;
+	cache_input(walk->key, path, walk->contents);
+	return 1;
+}
+
+//A key of the cache, for cache_trim
+struct cache_entry_t {
+	char name[65];
+	char object[65];
+	long long size;
+	long long used; // mtime of the key, touched on every hit
+	int group;		// index of its object in the reference counts
+};
+
+int compare_cache_object(const void *a, const void *b)
+{
+	return strcmp(((const struct cache_entry_t *)a)->object, ((const struct cache_entry_t *)b)->object);
+}
+
+int compare_cache_used(const void *a, const void *b)
+{
+	long long x = ((const struct cache_entry_t *)a)->used, y = ((const struct cache_entry_t *)b)->used;
+
+	return x < y ? -1 : x > y;
+}
+
+/**
+ * Removes the least recently used keys until the objects they leave fit into max bytes,
+ * objects go once no key refers to them
+ * @param dir
+ * @param max
+ */
+void cache_trim(char *dir, unsigned long long max)
+{
+	struct cache_entry_t *entries = NULL;
+	int count = 0, capacity = 0, groups = 0, *refs;
+	unsigned long long total = 0;
+	char path[1200];
+	struct dirent *entry;
+	DIR *d;
+
+	snprintf(path, sizeof(path), "%s/keys", dir);
+	if ((d = opendir(path)) == NULL)
+		return;
+	while ((entry = readdir(d)) != NULL) {
+		struct cache_entry_t *e;
+		struct stat st;
+		FILE *fp;
+
+		if (strlen(entry->d_name) != 64)
+			continue;
+		if (count == capacity) {
+			capacity = capacity ? 2 * capacity : 256;
+			entries = realloc(entries, sizeof(struct cache_entry_t) * capacity);
+		}
+		e = &entries[count];
+		snprintf(path, sizeof(path), "%s/keys/%s", dir, entry->d_name);
+		if ((fp = fopen(path, "r")) == NULL)
+			continue;
+		if (fscanf(fp, "%64s %lld", e->object, &e->size) == 2 && fstat(fileno(fp), &st) == 0) {
+			strcpy(e->name, entry->d_name);
+			e->used = st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+			count++;
+		}
+		fclose(fp);
+	}
+	closedir(d);
+
+	//Keys sharing an object count it once
+	qsort(entries, count, sizeof(struct cache_entry_t), compare_cache_object);
+	refs = calloc(count + 1, sizeof(int));
+	for (int i = 0; i < count; i++) {
+		if (i == 0 || strcmp(entries[i].object, entries[i - 1].object) != 0) {
+			groups++;
+			total += entries[i].size;
+		}
+		entries[i].group = groups - 1;
+		refs[groups - 1]++;
+	}
+
+	qsort(entries, count, sizeof(struct cache_entry_t), compare_cache_used);
+	for (int i = 0; i < count && total > max; i++) {
+		struct cache_entry_t *e = &entries[i];
+
+		snprintf(path, sizeof(path), "%s/keys/%s", dir, e->name);
+		unlink(path);
+		if (--refs[e->group] == 0) {
+			snprintf(path, sizeof(path), "%s/objects/%.2s/%s", dir, e->object, e->object + 2);
+			unlink(path);
+			total -= e->size;
+		}
+	}
+	free(refs);
+	free(entries);
+}
+
+/**
+ * Writes the output stored under a key and marks it as used
+ * @return 0 on a hit, -1 if the key or its object is missing
+ */
+int cache_replay(char *dir, char *key, FILE *out)
+{
+	char path[1200], object[65], buf[65536];
+	long long size;
+	ssize_t n;
+	FILE *fp;
+	int fd;
+
+	snprintf(path, sizeof(path), "%s/keys/%s", dir, key);
+	if ((fp = fopen(path, "r")) == NULL)
+		return -1;
+	n = fscanf(fp, "%64s %lld", object, &size);
+	fclose(fp);
+	if (n != 2)
+		return -1;
+	//The time of the key is its last use for cache_trim
+	utimensat(AT_FDCWD, path, NULL, 0);
+	snprintf(path, sizeof(path), "%s/objects/%.2s/%s", dir, object, object + 2);
+	if ((fd = open(path, O_RDONLY)) == -1)
+		return -1;
+	while ((n = read(fd, buf, sizeof(buf))) > 0)
+		fwrite(buf, 1, n, out);
+	close(fd);
+	fflush(out);
+	return 0;
+}
+
+/**
+ * Runs a command line with its stdout written through and, when it succeeds, stored under
+ * a key as a content-addressed object
+ * @param  dir  the cache, NULL to only run the command
+ * @return      exit code of the command
+ */
+int cache_run(char *dir, char *key, char *line, FILE *out)
+{
+	char tmp[1200], path[1200], object[65], buf[65536];
+	struct sha256_t hash;
+	long long size = 0;
+	int fds[2], fd, status = 0, failed = 0;
+	ssize_t n;
+	pid_t pid;
+
+	if (pipe2(fds, O_CLOEXEC) == -1)
+		return 126;
+	fflush(NULL);
+	pid = shell_fork();
+	if (pid == 0) {
+		dup2(fds[1], STDOUT_FILENO);
+		in_subshell = 1;
+		last_status = 0;
+		execute_node(parse_line(line));
+		fflush(stdout);
+		_exit(last_status);
+	}
+	close(fds[1]);
+	if (pid == -1) {
+		close(fds[0]);
+		return 126;
+	}
+
+	if (dir) {
+		snprintf(tmp, sizeof(tmp), "%s/tmp.%d", dir, getpid());
+		fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, S_IRUSR | S_IWUSR);
+	}
+	else
+		fd = -1;
+	sha256_init(&hash);
+	while ((n = read(fds[0], buf, sizeof(buf))) != 0) {
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			failed = 1;
+			break;
+		}
+		fwrite(buf, 1, n, out);
+		fflush(out);
+		sha256_update(&hash, buf, n);
+		if (fd == -1 || write(fd, buf, n) != n)
+			failed = 1;
+		size += n;
+	}
+	close(fds[0]);
+	waitpid(pid, &status, 0);
+	status = exit_code(status);
+	if (fd != -1 && close(fd) == -1)
+		failed = 1;
+
+	if (dir == NULL)
+		return status;
+
+	//Only runs that succeed are kept, the object is named by its hash and the key points to it
+	if (status == 0 && !failed) {
+		sha256_hex(&hash, object);
+		snprintf(path, sizeof(path), "%s/objects/%.2s", dir, object);
+		mkdir(path, S_IRWXU);
+		snprintf(path, sizeof(path), "%s/objects/%.2s/%s", dir, object, object + 2);
+		if (rename(tmp, path) == 0) {
+			FILE *fp = fopen(tmp, "w");
+
+			if (fp) {
+				fprintf(fp, "%s %lld\n", object, size);
+				if (fclose(fp) == 0) {
+					snprintf(path, sizeof(path), "%s/keys/%s", dir, key);
+					rename(tmp, path);
+				}
+			}
+		}
+	}
+	unlink(tmp);
+	return status;
+}
+
+/**
+ * Parses a size like 512, 64K, 256M or 2G
+ * @return bytes, 0 if the text is not a size
+ */
+unsigned long long parse_size(const char *text)
+{
+	char *end;
+	unsigned long long size = strtoull(text, &end, 10);
+
+	if (end == text)
+		return 0;
+	switch (toupper((unsigned char)*end)) {
+	case 'G':
+		size <<= 10;
+		//fall through
+	case 'M':
+		size <<= 10;
+		//fall through
+	case 'K':
+		size <<= 10;
+		end++;
+	}
+	return *end == '\0' || strcmp(end, "B") == 0 ? size : 0;
+}
+
+/**
+ * Runs a deterministic command once and replays its output afterwards. The key covers the
+ * words of the command, the working directory, PATH and the locale, the -e variables and the
+ * -i inputs by metadata or the -c inputs by contents, directories with everything below them.
+ * @param  argc
+ * @param  argv  argv[0] is the name of the builtin
+ * @param  io
+ * @return       exit status
+ */
+int builtin_cached(int argc, char **argv, struct io_t *io)
+{
+	char *inputs[CACHE_MAX_DECLARED], *env[CACHE_MAX_DECLARED + 3] = { "PATH", "LANG", "LC_ALL" };
+	int contents[CACHE_MAX_DECLARED], ninputs = 0, nenv = 3, i = 1, status;
+	char dir[1024], cwd[4096], key[65], *line;
+	unsigned long long max = CACHE_DEFAULT_MAX;
+	struct sha256_t hash;
+
+	for (; i + 1 < argc && argv[i][0] == '-'; i += 2) {
+		if ((strcmp(argv[i], "-i") == 0 || strcmp(argv[i], "-c") == 0) && ninputs < CACHE_MAX_DECLARED) {
+			contents[ninputs] = argv[i][1] == 'c';
+			inputs[ninputs++] = argv[i + 1];
+		}
+		else if (strcmp(argv[i], "-e") == 0 && nenv < CACHE_MAX_DECLARED + 3)
+			env[nenv++] = argv[i + 1];
+		else
+			break;
+	}
+	if (i < argc && strcmp(argv[i], "--") == 0)
+		i++;
+	if (i >= argc || argv[i][0] == '-') {
+		fprintf(io->out, "usage: cached [-i path] [-c path] [-e name]... <command>\n");
+		return 2;
+	}
+	line = join_command(argc - i, argv + i);
+	if (cache_dir(dir, sizeof(dir)) == -1) {
+		//Without a cache the command still runs
+		fprintf(io->out, "-%s: %s: no cache: %s\n", sysname, argv[0], strerror(errno));
+		status = cache_run(NULL, NULL, line, io->out);
+		free(line);
+		return status;
+	}
+
+	sha256_init(&hash);
+	sha256_update(&hash, CACHE_VERSION, sizeof(CACHE_VERSION));
+	for (int j = i; j < argc; j++)
+		sha256_update(&hash, argv[j], strlen(argv[j]) + 1);
+	if (getcwd(cwd, sizeof(cwd)))
+		sha256_update(&hash, cwd, strlen(cwd) + 1);
+	for (int j = 0; j < nenv; j++) {
+		char *value = getenv(env[j]);
+
+		sha256_update(&hash, env[j], strlen(env[j]) + 1);
+		sha256_update(&hash, value ? value : "", value ? strlen(value) + 1 : 1);
+	}
+	for (int j = 0; j < ninputs; j++) {
+		struct cache_walk_t walk = { &hash, contents[j] };
+		struct stat st;
+
+		cache_input(&hash, inputs[j], contents[j]);
+		if (stat(inputs[j], &st) == 0 && S_ISDIR(st.st_mode))
+			walkDirectory(inputs[j], 1, cache_visit, &walk);
+	}
+	sha256_hex(&hash, key);
+
+	if (cache_replay(dir, key, io->out) == 0) {
+		free(line);
+		return 0;
+	}
+	fflush(io->out);
+	status = cache_run(dir, key, line, io->out);
+	if (getenv("SHELLFYRE_CACHE_MAX") && parse_size(getenv("SHELLFYRE_CACHE_MAX")))
+		max = parse_size(getenv("SHELLFYRE_CACHE_MAX"));
+	cache_trim(dir, max);
+	free(line);
+	return status;
+}
+
+//A child in the sorted tree of pstraverse -a
+struct pst_child_t {
+	unsigned int parent;
+	unsigned int index;
+	unsigned long long rss;
+};
+
+/**
+ * Orders children by parent, then by subtree RSS with the biggest first
+ */
+int compare_pst_child(const void *a, const void *b)
+{
+	const struct pst_child_t *x = a, *y = b;
+
+	if (x->parent != y->parent)
+		return x->parent < y->parent ? -1 : 1;
+	if (x->rss != y->rss)
+		return x->rss > y->rss ? -1 : 1;
+	return x->index < y->index ? -1 : x->index > y->index;
+}
+
+/**
+ * Prints the records of a PST_FLAG_USAGE query as a tree, the children of every
+ * process sorted by the RSS of their subtree
+ * @param out
+ * @param records in dfs order
+ * @param count
+ */
+void print_pst_tree(FILE *out, struct pst_record *records, unsigned int count)
+{
+	struct pst_child_t *children = malloc(sizeof(struct pst_child_t) * count);
+	unsigned int *path = malloc(sizeof(unsigned int) * count);
+	unsigned int *first = calloc(count + 1, sizeof(unsigned int));
+	unsigned int *stack = malloc(sizeof(unsigned int) * count);
+	unsigned int i, top = 0;
+
+	//In dfs order the parent of a record is the last record one level above it
+	for (i = 0; i < count; i++) {
+		path[records[i].depth] = i;
+		children[i].parent = i == 0 ? count : path[records[i].depth - 1];
+		children[i].index = i;
+		children[i].rss = records[i].subtree_rss;
+	}
+	qsort(children, count, sizeof(struct pst_child_t), compare_pst_child);
+
+	//The children of p are children[first[p]] up to children[first[p + 1]]
+	for (i = 0; i < count; i++)
+		if (children[i].parent < count)
+			first[children[i].parent + 1]++;
+	for (i = 0; i < count; i++)
+		first[i + 1] += first[i];
+
+	if (count > 0)
+		stack[top++] = 0;
+	while (top > 0) {
+		unsigned int p = stack[--top];
+		struct pst_record *r = &records[p];
+
+		fprintf(out, "%*sPID: %d Executable: %s State: %c Threads: %u RSS: %llu KB CPU: %.2fs",
+			r->depth * 2, "", r->pid, r->comm, r->state, r->threads,
+			(unsigned long long)r->rss / 1024, (r->utime + r->stime) / 1e9);
+		if (r->subtree_tasks > 1)
+			fprintf(out, " | Subtree: %u tasks %u threads RSS: %llu KB CPU: %.2fs",
+				r->subtree_tasks, r->subtree_threads, (unsigned long long)r->subtree_rss / 1024,
+				(r->subtree_utime + r->subtree_stime) / 1e9);
+		fputc('\n', out);
+
+		//Pushed in reverse so that the biggest child is printed first
+		for (i = first[p + 1]; i > first[p]; i--)
+			stack[top++] = children[i - 1].index;
+	}
+	free(children);
+	free(path);
+	free(first);
+	free(stack);
+}
+
+//A process read from /proc/<pid>/stat by the userspace pstraverse engine
+struct proc_task_t {
+	int valid; // 0 if the process exited before its stat was read
+	struct pst_record record;
+	int first_child, next_sibling; // indexes into the task array, -1 for none
+	unsigned long long start; // clock ticks after boot the process started at
+};
+
+//A slice of /proc that one scanning thread reads
+struct proc_scan_t {
+	int proc_fd;
+	pid_t *pids;
+	struct proc_task_t *tasks;
+	long begin, end;
+	long tick_ns, page_size;
+};
+
+/**
+ * Reads /proc/<pid>/stat relative to the /proc descriptor with a single read
+ * @param  scan
+ * @param  pid
+ * @param  task
+ * @return       0, or -1 if the process is gone
+ */
+int read_proc_stat(struct proc_scan_t *scan, pid_t pid, struct proc_task_t *task)
+{
+	char path[32], buf[4096], *p, *end;
+	unsigned long long value;
+	ssize_t n;
+	int fd, field;
+
+	snprintf(path, sizeof(path), "%d/stat", pid);
+	fd = openat(scan->proc_fd, path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		return -1;
+	n = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (n <= 0)
+		return -1;
+	buf[n] = 0;
+
+	//The name is between the first ( and the last ), it may contain both
+	p = strchr(buf, '(');
+	end = strrchr(buf, ')');
+	if (p == NULL || end == NULL || end[1] == 0)
+		return -1;
+
+	memset(&task->record, 0, sizeof(struct pst_record));
+	task->record.pid = pid;
+	n = end - p - 1 < PST_COMM_LEN - 1 ? end - p - 1 : PST_COMM_LEN - 1;
+	memcpy(task->record.comm, p + 1, n);
+	task->record.state = end[2];
+
+	//Fields after the state are numbers, counted as in proc(5)
+	p = end + 3;
+	for (field = 4; field <= 24 && *p; field++) {
+		value = strtoull(p, &p, 10);
+		switch (field) {
+		case 4: task->record.ppid = value; break;
+		case 14: task->record.utime = value * scan->tick_ns; break;
+		case 15: task->record.stime = value * scan->tick_ns; break;
+		case 20: task->record.threads = value; break;
+		case 22: task->start = value; break;
+		case 24: task->record.rss = value * scan->page_size; break;
+		}
+	}
+	task->record.subtree_tasks = 1;
+	task->record.subtree_threads = task->record.threads;
+	task->record.subtree_rss = task->record.rss;
+	task->record.subtree_utime = task->record.utime;
+	task->record.subtree_stime = task->record.stime;
+	task->valid = 1;
+	return 0;
+}
+
+/**
+ * Finds the process of a thread from /proc/<tid>/status, /proc lists processes only
+ * @param  tid
+ * @return     its tgid, or -1 if it is gone
+ */
+pid_t proc_tgid(pid_t tid)
+{
+	char path[32], line[256];
+	pid_t tgid = -1;
+	FILE *file;
+
+	snprintf(path, sizeof(path), "/proc/%d/status", tid);
+	file = fopen(path, "r");
+	if (file == NULL)
+		return -1;
+	while (fgets(line, sizeof(line), file) != NULL)
+		if (sscanf(line, "Tgid: %d", &tgid) == 1)
+			break;
+	fclose(file);
+	return tgid;
+}
+
+//A process in the order the /proc engine links children in
+struct proc_order_t {
+	unsigned long long start;
+	pid_t pid;
+	int index;
+};
+
+/**
+ * Orders processes by start time, then by pid, which is the order they were forked in
+ * as long as pids did not wrap around within a clock tick
+ */
+int compare_proc_order(const void *a, const void *b)
+{
+	const struct proc_order_t *x = a, *y = b;
+
+	if (x->start != y->start)
+		return x->start < y->start ? -1 : 1;
+	return x->pid < y->pid ? -1 : x->pid > y->pid;
+}
+
+void *proc_scan_thread(void *arg)
+{
+	struct proc_scan_t *scan = arg;
+
+	for (long i = scan->begin; i < scan->end; i++)
+		scan->tasks[i].valid = read_proc_stat(scan, scan->pids[i], &scan->tasks[i]) == 0;
+	return NULL;
+}
+
+/**
+ * Adds the subtree totals of every record to its parent, the records must be in dfs order
+ * @param records
+ * @param count
+ */
+void rollup_pst_records(struct pst_record *records, unsigned int count)
+{
+	//sums[d] holds the finished subtrees at depth d whose parent was not reached yet
+	struct pst_record *sums = calloc(count + 1, sizeof(struct pst_record));
+
+	for (unsigned int i = count; i-- > 0;) {
+		struct pst_record *r = &records[i], *below = &sums[r->depth + 1], *level = &sums[r->depth];
+
+		r->subtree_tasks += below->subtree_tasks;
+		r->subtree_threads += below->subtree_threads;
+		r->subtree_rss += below->subtree_rss;
+		r->subtree_utime += below->subtree_utime;
+		r->subtree_stime += below->subtree_stime;
+		memset(below, 0, sizeof(struct pst_record));
+
+		level->subtree_tasks += r->subtree_tasks;
+		level->subtree_threads += r->subtree_threads;
+		level->subtree_rss += r->subtree_rss;
+		level->subtree_utime += r->subtree_utime;
+		level->subtree_stime += r->subtree_stime;
+	}
+	free(sums);
+}
+
+/**
+ * Answers a pst_query from /proc when process_module is not available.
+ * /proc/<pid>/stat is read by several threads, the children of every process are
+ * found through a pid hash map and then traversed like the module does.
+ * A thread id as root stands for its process and children come in fork order, as in the module.
+ * @param  query    root_pid, mode, max_depth and flags are used, count and total are set
+ * @param  records  set to a malloced array of query->count records
+ * @return          0, or -1 with errno set
+ */
+int proc_pst_query(struct pst_query *query, struct pst_record **records)
+{
+	struct proc_task_t *tasks;
+	struct proc_order_t *order;
+	struct proc_scan_t scans[8];
+	pthread_t threads[8];
+	struct dirent *entry;
+	pid_t *pids = NULL;
+	int *map, *stack;
+	long count = 0, size = 0, nthreads, mask, root = -1, ordered = 0;
+	pid_t root_pid = query->root_pid;
+	unsigned int total = 0;
+	DIR *dir;
+
+	dir = opendir("/proc");
+	if (dir == NULL)
+		return -1;
+	while ((entry = readdir(dir)) != NULL) {
+		if (!isdigit((unsigned char)entry->d_name[0]))
+			continue;
+		if (count == size) {
+			size = size ? size * 2 : 1024;
+			pids = realloc(pids, sizeof(pid_t) * size);
+		}
+		pids[count++] = atoi(entry->d_name);
+	}
+	tasks = calloc(count ? count : 1, sizeof(struct proc_task_t));
+
+	//About 256 processes per thread, one thread is enough for a small system
+	nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (nthreads > count / 256 + 1)
+		nthreads = count / 256 + 1;
+	if (nthreads > 8)
+		nthreads = 8;
+	if (nthreads < 1)
+		nthreads = 1;
+	for (long t = 0; t < nthreads; t++) {
+		scans[t].proc_fd = dirfd(dir);
+		scans[t].pids = pids;
+		scans[t].tasks = tasks;
+		scans[t].begin = count * t / nthreads;
+		scans[t].end = count * (t + 1) / nthreads;
+		scans[t].tick_ns = 1000000000L / sysconf(_SC_CLK_TCK);
+		scans[t].page_size = sysconf(_SC_PAGESIZE);
+		if (t == 0 || pthread_create(&threads[t], NULL, proc_scan_thread, &scans[t]) != 0)
+			threads[t] = 0;
+	}
+	proc_scan_thread(&scans[0]);
+	for (long t = 1; t < nthreads; t++) {
+		if (threads[t])
+			pthread_join(threads[t], NULL);
+		else
+			proc_scan_thread(&scans[t]);
+	}
+	closedir(dir);
+
+	//pid to task index, open addressing with at most half of the slots used
+	for (mask = 1; mask < count * 2; mask <<= 1)
+		;
+	map = malloc(sizeof(int) * mask);
+	memset(map, -1, sizeof(int) * mask);
+	mask--;
+	for (long i = 0; i < count; i++) {
+		long slot = (unsigned int)pids[i] * 2654435761u & mask;
+
+		tasks[i].first_child = tasks[i].next_sibling = -1;
+		if (!tasks[i].valid)
+			continue;
+		while (map[slot] != -1)
+			slot = (slot + 1) & mask;
+		map[slot] = i;
+		if (pids[i] == root_pid)
+			root = i;
+	}
+	if (root == -1 && (root_pid = proc_tgid(root_pid)) != -1)
+		for (long i = 0; i < count; i++)
+			if (tasks[i].valid && pids[i] == root_pid)
+				root = i;
+
+	order = malloc(sizeof(struct proc_order_t) * (count ? count : 1));
+	for (long i = 0; i < count; i++)
+		if (tasks[i].valid)
+			order[ordered++] = (struct proc_order_t){ tasks[i].start, pids[i], i };
+	qsort(order, ordered, sizeof(struct proc_order_t), compare_proc_order);
+
+	//Linked backwards so that the children end up in the order they were forked in
+	for (long o = ordered - 1; o >= 0; o--) {
+		long i = order[o].index, slot;
+
+		if (i == root)
+			continue;
+		slot = (unsigned int)tasks[i].record.ppid * 2654435761u & mask;
+		while (map[slot] != -1 && pids[map[slot]] != tasks[i].record.ppid)
+			slot = (slot + 1) & mask;
+		if (map[slot] == -1)
+			continue;
+		tasks[i].next_sibling = tasks[map[slot]].first_child;
+		tasks[map[slot]].first_child = i;
+	}
+	free(order);
+	free(map);
+
+	if (root == -1) {
+		free(tasks);
+		free(pids);
+		errno = ESRCH;
+		return -1;
+	}
+
+	//Same order as the module, dfs with an explicit stack or bfs with a queue
+	*records = malloc(sizeof(struct pst_record) * count);
+	stack = malloc(sizeof(int) * count);
+	if (query->mode == PST_MODE_BFS) {
+		long head = 0, tail = 0;
+
+		stack[tail++] = root;
+		tasks[root].record.depth = 0;
+		while (head < tail) {
+			struct proc_task_t *task = &tasks[stack[head++]];
+
+			(*records)[total++] = task->record;
+			if (query->max_depth && task->record.depth >= query->max_depth)
+				continue;
+			for (int c = task->first_child; c != -1; c = tasks[c].next_sibling) {
+				tasks[c].record.depth = task->record.depth + 1;
+				stack[tail++] = c;
+			}
+		}
+	}
+	else {
+		long top = 0;
+
+		stack[top++] = root;
+		tasks[root].record.depth = 0;
+		while (top > 0) {
+			struct proc_task_t *task = &tasks[stack[--top]];
+			long first = top;
+
+			(*records)[total++] = task->record;
+			if (query->max_depth && task->record.depth >= query->max_depth)
+				continue;
+			for (int c = task->first_child; c != -1; c = tasks[c].next_sibling) {
+				tasks[c].record.depth = task->record.depth + 1;
+				stack[top++] = c;
+			}
+			//Reversed so that the first child is on top of the stack
+			for (long a = first, b = top - 1; a < b; a++, b--) {
+				int swap = stack[a];
+				stack[a] = stack[b];
+				stack[b] = swap;
+			}
+		}
+	}
+	free(stack);
+	free(tasks);
+	free(pids);
 
-	parse_command(buf, command);
+	if (query->flags & PST_FLAG_USAGE)
+		rollup_pst_records(*records, total);
+	query->count = query->total = total;
+	return 0;
+}
 
-	// print_command(command); // DEBUG: uncomment for debugging
+//Set by SIGINT while pstraverse -w is waiting for events
+volatile sig_atomic_t pst_watch_interrupted = 0;
 
-	// restore the old settings
-	tcsetattr(STDIN_FILENO, TCSANOW, &backup_termios);
-	return SUCCESS;
+void pst_watch_sigint(int sig)
+{
+	(void)sig;
+	pst_watch_interrupted = 1;
 }
 
-int process_command(struct command_t *command);
+/**
+ * Checks whether a fork event is of a process the printed tree already has
+ * @param  e
+ * @param  snapshot records of the tree
+ * @param  count
+ * @param  taken    time the tree was queried at
+ * @return          1 if it is
+ */
+int pst_event_in_snapshot(struct pst_event *e, struct pst_record *snapshot, unsigned int count, long long taken)
+{
+	//Only forks queued before the query can be in it, a later one with the same pid is a reuse
+	if(e->type != PST_EVENT_FORK || (long long)e->time_ns > taken)
+		return 0;
+	for(unsigned int i = 0; i < count; i++)
+		if(snapshot[i].pid == e->pid)
+			return 1;
+	return 0;
+}
 
-int main()
-{	//
+/**
+ * Prints fork, exec and exit events under a PID until Ctrl-C or until the PID exits.
+ * The watch is issued before the tree is queried so that nothing in between is lost,
+ * forks of processes the tree already has are dropped.
+ * @param  fd       open process_device, PST_IOC_WATCH already issued
+ * @param  root
+ * @param  snapshot records of the printed tree
+ * @param  count
+ * @param  start    time the watch was issued at
+ * @param  taken    time the tree was queried at
+ * @param  io
+ * @return          exit status
+ */
+int watch_pst_events(int fd, int root, struct pst_record *snapshot, unsigned int count, long long start, long long taken, struct io_t *io)
+{
+	struct pst_event events[64];
+	struct sigaction action, saved;
+	sigset_t unblock, blocked;
+	struct pollfd pfd = { fd, POLLIN, 0 };
+	ssize_t n;
+	int status = 0;
+
+	//SIGINT only ends the watch, without SA_RESTART so that poll returns, and is let through
+	//while watching since the loop of the prompt keeps it blocked
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = pst_watch_sigint;
+	sigaction(SIGINT, &action, &saved);
+	sigemptyset(&unblock);
+	sigaddset(&unblock, SIGINT);
+	sigprocmask(SIG_UNBLOCK, &unblock, &blocked);
+	pst_watch_interrupted = 0;
+
+	fprintf(io->out, "Watching %d, press Ctrl-C to stop\n", root);
+	fflush(io->out);
+
+	while(!pst_watch_interrupted) {
+		if(poll(&pfd, 1, -1) == -1) {
+			if(errno == EINTR)
+				continue;
+			fprintf(io->out, "-%s: pstraverse: %s\n", sysname, strerror(errno));
+			status = 1;
+			break;
+		}
+		n = read(fd, events, sizeof(events));
+		if(n == -1) {
+			if(errno == EINTR || errno == EAGAIN)
+				continue;
+			fprintf(io->out, "-%s: pstraverse: %s\n", sysname, strerror(errno));
+			status = 1;
+			break;
+		}
+		if(n == 0)
+			break;
 
-	
-	if(getcwd(pathToShellfyre,sizeof(pathToShellfyre)) == NULL)
-	       ("Could not get the cwd!");	
+		for(int i = 0; i < n / (ssize_t)sizeof(struct pst_event); i++) {
+			struct pst_event *e = &events[i];
+			char mark = e->type == PST_EVENT_FORK ? '+' : e->type == PST_EVENT_EXEC ? '*' : '-';
+
+			if(e->lost)
+				fprintf(io->out, "(%u events lost)\n", e->lost);
+			if(pst_event_in_snapshot(e, snapshot, count, taken))
+				continue;
+			fprintf(io->out, "[%9.3f] %c PID: %d PPID: %d Executable: %s\n",
+				((long long)e->time_ns - start) / 1e9, mark, e->pid, e->ppid, e->comm);
+			if(e->type == PST_EVENT_EXIT && e->pid == root)
+				pst_watch_interrupted = 1;
+		}
+		fflush(io->out);
+	}
+	sigprocmask(SIG_SETMASK, &blocked, NULL);
+	sigaction(SIGINT, &saved, NULL);
+	return status;
+}
+
+/**
+ * Prints the process tree under a PID, read from the process_module kernel module
+ * pstraverse -a <PID> [depth] adds the resources of every process and of its subtree
+ * pstraverse -w <PID> prints the tree, then every fork, exec and exit below it as it happens
+ * @param  argc
+ * @param  argv  argv[0] is the name of the builtin
+ * @param  io
+ * @return       exit status
+ */
+int builtin_pstraverse(int argc, char **argv, struct io_t *io)
+{
+	struct pst_query query;
+	struct pst_record *records = NULL;
+	unsigned int capacity = 1024;
+	int aggregate = argc > 1 && strcmp(argv[1], "-a") == 0;
+	int watch = argc > 1 && strcmp(argv[1], "-w") == 0;
+	int fd, status = 0;
+
+	if(argc < 3) {
+		fprintf(io->out, "pstraverse: Too few arguments.\n");
+		fprintf(io->out, "Usage: pstraverse <PID> <-d or -b> [depth]\n");
+		fprintf(io->out, "       pstraverse -a <PID> [depth]\n");
+		fprintf(io->out, "       pstraverse -w <PID>\n");
+
+		return 2;
+	}
 
+	//The module is used when it is loaded or can be loaded, otherwise the tree is read from /proc
+	//SHELLFYRE_PSTRAVERSE=proc always uses /proc
+	char *engine = getenv("SHELLFYRE_PSTRAVERSE");
+	int use_module = engine == NULL || strcmp(engine, "proc") != 0;
 
-	readFromCdhFile();
+	fd = use_module ? open("/dev/process_device", O_RDWR) : -1;
 
-	//
-	while (1)
-	{
-		struct command_t *command = malloc(sizeof(struct command_t));
-		memset(command, 0, sizeof(struct command_t)); // set all bytes to 0
+	//if module is not loaded then installing it, sudo must not ask for a password
+	if(fd < 0 && use_module && !module_tried && access("process_module.ko", R_OK) == 0) {
+		//Path and argument resolving
+		char *path = "/usr/bin/sudo";
+		char *args[] = {path,"-n","insmod","process_module.ko",NULL};
+		int wstatus = 0;
 
-		int code;
-		code = prompt(command);
-		if (code == EXIT)
+		pid_t pid = shell_fork();
+
+		if(pid == 0) {
+
+		//Calling in the child
+		execv(path,args);
+		_exit(127);
+
+		}
+		else {
+			waitpid(pid, &wstatus, 0);
+		}
+		module_tried = 1;
+		if(WIFEXITED(wstatus) && WEXITSTATUS(wstatus) == 0) {
+			module_open = 1;
+			fd = open("/dev/process_device", O_RDWR);
+		}
+	}
+
+	if(fd < 0 && watch) {
+		fprintf(io->out, "pstraverse: -w needs the process_module kernel module\n");
+		return 1;
+	}
+
+	memset(&query, 0, sizeof(query));
+	query.version = PST_ABI_VERSION;
+	if(aggregate) {
+		query.root_pid = atoi(argv[2]);
+		query.mode = PST_MODE_DFS;
+		query.flags = PST_FLAG_USAGE;
+	}
+	else if(watch) {
+		query.root_pid = atoi(argv[2]);
+		query.mode = PST_MODE_DFS;
+	}
+	else {
+		query.root_pid = atoi(argv[1]);
+		query.mode = strcmp(argv[2], "-b") == 0 ? PST_MODE_BFS : PST_MODE_DFS;
+	}
+	query.max_depth = argc > 3 ? atoi(argv[3]) : 0;
+
+	//Watching starts before the query so that no fork or exit between the two is missed
+	long long start = now_ns(), taken;
+	if(watch) {
+		struct pst_watch request = { PST_ABI_VERSION, query.root_pid, 0, 0 };
+
+		if(ioctl(fd, PST_IOC_WATCH, &request) == -1) {
+			fprintf(io->out, "-%s: %s: %s\n", sysname, argv[0], strerror(errno));
+			close(fd);
+			return 1;
+		}
+	}
+
+	//One ioctl returns the whole subtree, retried with a bigger buffer if it did not fit
+	while(fd >= 0) {
+		records = realloc(records, sizeof(struct pst_record) * capacity);
+		query.capacity = capacity;
+		query.records = (uintptr_t)records;
+
+		if(ioctl(fd, PST_IOC_QUERY, &query) == -1) {
+			//A module built from older sources does not speak this ABI
+			if(!watch && (errno == ENOTTY || errno == EPROTO)) {
+				close(fd);
+				fd = -1;
+				break;
+			}
+			fprintf(io->out, "-%s: %s: %s\n", sysname, argv[0], strerror(errno));
+			free(records);
+			close(fd);
+			return 1;
+		}
+		if(query.total <= query.count)
 			break;
+		capacity = query.total + query.total / 4;
+	}
+	taken = now_ns();
 
-		code = process_command(command);
-		if (code == EXIT)
+	if(fd < 0) {
+		free(records);
+		if(proc_pst_query(&query, &records) == -1) {
+			fprintf(io->out, "-%s: %s: %s\n", sysname, argv[0], strerror(errno));
+			return 1;
+		}
+	}
+
+	if(aggregate)
+		print_pst_tree(io->out, records, query.count);
+	else
+		for(unsigned int i = 0; i < query.count; i++)
+			fprintf(io->out, "%*sPID: %d Executable: %s\n", records[i].depth * 2, "", records[i].pid, records[i].comm);
+
+	if(watch)
+		status = watch_pst_events(fd, query.root_pid, records, query.count, start, taken, io);
+	free(records);
+	if(fd >= 0)
+		close(fd);
+	return status;
+}
+
+/**
+ * Writes a backslash escape of echo -e or printf %b
+ * @param  out
+ * @param  s     points after the backslash
+ * @param  stop  set when \c ends the output
+ * @return       number of characters consumed after the backslash
+ */
+int put_escape(FILE *out, const char *s, int *stop)
+{
+	int i = 0, value = 0;
+
+	switch (s[0]) {
+	case 'a': fputc('\a', out); return 1;
+	case 'b': fputc('\b', out); return 1;
+	case 'c': *stop = 1; return 1;
+	case 'e': fputc(27, out); return 1;
+	case 'f': fputc('\f', out); return 1;
+	case 'n': fputc('\n', out); return 1;
+	case 'r': fputc('\r', out); return 1;
+	case 't': fputc('\t', out); return 1;
+	case 'v': fputc('\v', out); return 1;
+	case '\\': fputc('\\', out); return 1;
+	case '0':
+		for (i = 1; i < 4 && s[i] >= '0' && s[i] <= '7'; i++)
+			value = value * 8 + s[i] - '0';
+		fputc(value, out);
+		return i;
+	case 'x':
+		for (i = 1; i < 3 && isxdigit((unsigned char)s[i]); i++)
+			value = value * 16 + (isdigit((unsigned char)s[i]) ? s[i] - '0' : tolower((unsigned char)s[i]) - 'a' + 10);
+		if (i == 1) {
+			fputs("\\x", out);
+			return 1;
+		}
+		fputc(value, out);
+		return i;
+	case 0:
+		fputc('\\', out);
+		return 0;
+	default:
+		fputc('\\', out);
+		fputc(s[0], out);
+		return 1;
+	}
+}
+
+/**
+ * echo [-neE] [string ...], in-process version of /bin/echo
+ * */
+int builtin_echo(int argc, char **argv, struct io_t *io)
+{
+	int newline = 1, escapes = 0, stop = 0;
+	int i = 1;
+
+	//Options are only taken while every character is one of n, e, E
+	for (; i < argc && argv[i][0] == '-' && argv[i][1]; i++) {
+		if (strspn(argv[i] + 1, "neE") != strlen(argv[i] + 1))
 			break;
+		for (char *c = argv[i] + 1; *c; c++) {
+			if (*c == 'n')
+				newline = 0;
+			else
+				escapes = *c == 'e';
+		}
+	}
 
-		free_command(command);
+	for (int first = i; i < argc && !stop; i++) {
+		if (i > first)
+			fputc(' ', io->out);
+		if (!escapes) {
+			fputs(argv[i], io->out);
+			continue;
+		}
+		for (char *c = argv[i]; *c && !stop; c++) {
+			if (*c == '\\')
+				c += put_escape(io->out, c + 1, &stop);
+			else
+				fputc(*c, io->out);
+		}
 	}
+	if (newline && !stop)
+		fputc('\n', io->out);
+	return 0;
+}
 
-	printf("\n");
+int builtin_true(int argc, char **argv, struct io_t *io)
+{
+	(void)argc, (void)argv, (void)io;
 	return 0;
 }
 
-int process_command(struct command_t *command)
+int builtin_false(int argc, char **argv, struct io_t *io)
 {
-	int r;
-	if (strcmp(command->name, "") == 0)
-		return SUCCESS;
+	(void)argc, (void)argv, (void)io;
+	return 1;
+}
 
-	if (strcmp(command->name, "exit") == 0) {
-		
-		//Store the cdHistory to cdFile in the same directory with shellfyre.c
-		if(cdCount != 0) {
-			//Change directory to directory in which shellfyre exist
-			r = chdir(pathToShellfyre);
-			if (r == -1)
-				printf("-%s: %s: %s\n", sysname, command->name, strerror(errno));
-			
-			//Store the cdHistory in cdFile and store the file in the same directory with shellfyre.c
-			writeToCdhFile();
+/**
+ * pwd [-L | -P], in-process version of /bin/pwd
+ * */
+int builtin_pwd(int argc, char **argv, struct io_t *io)
+{
+	char cwd[4096];
+	char *logical = getenv("PWD");
+	int physical = argc > 1 && strcmp(argv[argc - 1], "-P") == 0;
+	struct stat a, b;
+
+	if (getcwd(cwd, sizeof(cwd)) == NULL) {
+		fprintf(io->err, "pwd: %s\n", strerror(errno));
+		return 1;
+	}
+	//-L prints $PWD as long as it still names the current directory
+	if (!physical && logical && logical[0] == '/' && stat(logical, &a) == 0 && stat(".", &b) == 0 &&
+		a.st_dev == b.st_dev && a.st_ino == b.st_ino)
+		fprintf(io->out, "%s\n", logical);
+	else
+		fprintf(io->out, "%s\n", cwd);
+	return 0;
+}
 
-		}
+//Arguments of the test expression being evaluated
+struct test_t
+{
+	char **argv;
+	int argc;
+	int pos;
+	int error;
+	FILE *err;
+};
 
-		//Removing the module it is open
-		if(module_open) {
+int test_or(struct test_t *test);
 
-			//close(fd);	
-			char *path1 = "/usr/bin/sudo";
-			char *args1[] = {path1,"rmmod","process_module.ko", 0};
-			pid_t pid1;
+/**
+ * Parses an integer operand of test
+ * */
+long long test_integer(struct test_t *test, const char *s)
+{
+	char *end;
+	long long value;
+
+	errno = 0;
+	value = strtoll(s, &end, 10);
+	while (*end == ' ' || *end == '\t')
+		end++;
+	if (*s == 0 || *end || errno) {
+		fprintf(test->err, "test: %s: integer expression expected\n", s);
+		test->error = 1;
+	}
+	return value;
+}
 
-			pid1= fork();
+/**
+ * Evaluates a unary file or string primary
+ * */
+int test_unary(const char *op, const char *arg)
+{
+	struct stat st;
+
+	switch (op[1]) {
+	case 'n': return strlen(arg) != 0;
+	case 'z': return strlen(arg) == 0;
+	case 't': return isatty(atoi(arg));
+	case 'h':
+	case 'L': return lstat(arg, &st) == 0 && S_ISLNK(st.st_mode);
+	case 'r': return access(arg, R_OK) == 0;
+	case 'w': return access(arg, W_OK) == 0;
+	case 'x': return access(arg, X_OK) == 0;
+	}
+	if (stat(arg, &st) != 0)
+		return 0;
+	switch (op[1]) {
+	case 'e': return 1;
+	case 'f': return S_ISREG(st.st_mode);
+	case 'd': return S_ISDIR(st.st_mode);
+	case 's': return st.st_size > 0;
+	case 'p': return S_ISFIFO(st.st_mode);
+	case 'S': return S_ISSOCK(st.st_mode);
+	case 'b': return S_ISBLK(st.st_mode);
+	case 'c': return S_ISCHR(st.st_mode);
+	case 'u': return (st.st_mode & S_ISUID) != 0;
+	case 'g': return (st.st_mode & S_ISGID) != 0;
+	case 'k': return (st.st_mode & S_ISVTX) != 0;
+	}
+	return 0;
+}
 
-			if(pid1 == 0) {
-			//Calling rmmod in the child
-				execv(path1,args1);
-			}
-			else {
-				wait(NULL);
-			}
-		}
-		
-		//Removing the crontab job if there is any
-		if(has_crontab) {
-			char *user;
-			user = getlogin();
-			char *path = "/usr/bin/crontab";
-			char *args[] = {path,"-u",user,"-r",NULL};
-			pid_t pid;
+int is_test_unary(const char *op)
+{
+	return op[0] == '-' && op[1] && !op[2] && strchr("nztLhrwxefdspSbcugk", op[1]);
+}
 
-			pid= fork();
+int is_test_binary(const char *op)
+{
+	const char *ops[] = {"=", "==", "!=", "<", ">", "-eq", "-ne", "-lt", "-le", "-gt", "-ge", "-nt", "-ot", "-ef", NULL};
+	for (int i = 0; ops[i]; i++)
+		if (strcmp(op, ops[i]) == 0)
+			return 1;
+	return 0;
+}
 
-			if(pid == 0) {
-				execv(path,args);
-			}
-			else {
-				wait(NULL);
-			}
+/**
+ * Evaluates a binary primary
+ * */
+int test_binary(struct test_t *test, const char *left, const char *op, const char *right)
+{
+	struct stat a, b;
+
+	if (strcmp(op, "=") == 0 || strcmp(op, "==") == 0)
+		return strcmp(left, right) == 0;
+	if (strcmp(op, "!=") == 0)
+		return strcmp(left, right) != 0;
+	if (strcmp(op, "<") == 0)
+		return strcmp(left, right) < 0;
+	if (strcmp(op, ">") == 0)
+		return strcmp(left, right) > 0;
+	if (strcmp(op, "-nt") == 0 || strcmp(op, "-ot") == 0 || strcmp(op, "-ef") == 0) {
+		int has_a = stat(left, &a) == 0, has_b = stat(right, &b) == 0;
+		if (op[1] == 'e')
+			return has_a && has_b && a.st_dev == b.st_dev && a.st_ino == b.st_ino;
+		if (op[1] == 'n')
+			return has_a && (!has_b || a.st_mtime > b.st_mtime);
+		return has_b && (!has_a || a.st_mtime < b.st_mtime);
+	}
+
+	long long l = test_integer(test, left), r = test_integer(test, right);
+	if (strcmp(op, "-eq") == 0) return l == r;
+	if (strcmp(op, "-ne") == 0) return l != r;
+	if (strcmp(op, "-lt") == 0) return l < r;
+	if (strcmp(op, "-le") == 0) return l <= r;
+	if (strcmp(op, "-gt") == 0) return l > r;
+	return l >= r;
+}
 
-			remove("cronFile");
-			has_crontab = 0;
+/**
+ * primary := ! primary | ( or ) | unary arg | arg binary arg | arg
+ * */
+int test_primary(struct test_t *test)
+{
+	char **argv = test->argv;
+	int left = test->argc - test->pos;
+
+	if (left <= 0) {
+		fprintf(test->err, "test: argument expected\n");
+		test->error = 1;
+		return 0;
+	}
+	if (strcmp(argv[test->pos], "!") == 0) {
+		test->pos++;
+		return !test_primary(test);
+	}
+	if (left >= 3 && is_test_binary(argv[test->pos + 1])) {
+		test->pos += 3;
+		return test_binary(test, argv[test->pos - 3], argv[test->pos - 2], argv[test->pos - 1]);
+	}
+	if (strcmp(argv[test->pos], "(") == 0 && left >= 2) {
+		test->pos++;
+		int value = test_or(test);
+		if (test->pos >= test->argc || strcmp(argv[test->pos], ")") != 0) {
+			fprintf(test->err, "test: ')' expected\n");
+			test->error = 1;
 		}
+		test->pos++;
+		return value;
+	}
+	if (left >= 2 && is_test_unary(argv[test->pos])) {
+		test->pos += 2;
+		return test_unary(argv[test->pos - 2], argv[test->pos - 1]);
+	}
+	return argv[test->pos++][0] != 0;
+}
 
-		return EXIT;
+int test_and(struct test_t *test)
+{
+	int value = test_primary(test);
+	while (test->pos < test->argc && strcmp(test->argv[test->pos], "-a") == 0) {
+		test->pos++;
+		value = test_primary(test) && value;
 	}
+	return value;
+}
 
-	if (strcmp(command->name, "cd") == 0)
-	{
-		if (command->arg_count > 0)
-		{
-			r = chdir(command->args[0]);
-			
-			if (r == -1)
-				printf("-%s: %s: %s\n", sysname, command->name, strerror(errno));
+int test_or(struct test_t *test)
+{
+	int value = test_and(test);
+	while (test->pos < test->argc && strcmp(test->argv[test->pos], "-o") == 0) {
+		test->pos++;
+		value = test_and(test) || value;
+	}
+	return value;
+}
 
-			//Upon changing directory, add the current directory to chHistory for cdh command
-			else {
-			
-				char cwd[512];
-				if(getcwd(cwd,sizeof(cwd)) != NULL) {
-					addCdToHistory(cwd);
-				}
-			
-			}
-			/////////////////
-			return SUCCESS;
+/**
+ * test expression / [ expression ], in-process version of /bin/test
+ * @return 0 if true, 1 if false, 2 on error
+ * */
+int builtin_test(int argc, char **argv, struct io_t *io)
+{
+	struct test_t test = {argv, argc, 1, 0, io->err};
+	int value;
+
+	if (strcmp(argv[0], "[") == 0) {
+		if (strcmp(argv[argc - 1], "]") != 0) {
+			fprintf(io->err, "[: missing ']'\n");
+			return 2;
 		}
+		test.argc--;
+	}
+	if (test.argc == 1)
+		return 1;
+
+	//Up to four arguments are decided by their count as POSIX requires, e.g. test -n is true
+	if (test.argc == 2)
+		return argv[1][0] == 0;
+	if (test.argc == 3 && strcmp(argv[1], "!") == 0)
+		return argv[2][0] != 0;
+
+	value = test_or(&test);
+	if (!test.error && test.pos != test.argc) {
+		fprintf(io->err, "test: %s: unexpected argument\n", argv[test.pos]);
+		test.error = 1;
 	}
+	if (test.error)
+		return 2;
+	return !value;
+}
 
-	// TODO: Implement your custom commands here
-	
-	if(strcmp(command->name, "filesearch") == 0) {
+/**
+ * Converts a printf argument to a number, 'c or "c give the code of c
+ * */
+long long printf_integer(const char *arg, int *status, FILE *err)
+{
+	char *end;
+	long long value;
+
+	if (arg[0] == '\'' || arg[0] == '"')
+		return (unsigned char)arg[1];
+	errno = 0;
+	value = strtoll(arg, &end, 0);
+	if (*arg == 0)
+		return 0;
+	if (*end || errno) {
+		fprintf(err, "printf: %s: invalid number\n", arg);
+		*status = 1;
+	}
+	return value;
+}
 
-		int recursive = 0;
-		int open = 0;
-		char keyword[30];
+/**
+ * printf format [argument ...], in-process version of /usr/bin/printf.
+ * The format is reused as long as arguments remain.
+ * */
+int builtin_printf(int argc, char **argv, struct io_t *io)
+{
+	int status = 0, next = 2, stop = 0;
 
-		if(command->args[0] == NULL) {
+	if (argc < 2) {
+		fprintf(io->err, "usage: printf format [arguments]\n");
+		return 2;
+	}
 
-			printf("Usage: filesearch 'keyword'. Options: -r, -o");
-			return SUCCESS;
-		}
-		//Assigning command line options to open and recursive flags
-		else if (strcmp(command->args[0],"-r") == 0) {
-			recursive = 1;
-			
-			if(strcmp(command->args[1], "-o") == 0) {
-				open = 1;
-				strcpy(keyword, command->args[2]);
+	do {
+		int used = next;
+		for (char *f = argv[1]; *f && !stop; f++) {
+			if (*f == '\\') {
+				f += put_escape(io->out, f + 1, &stop);
+				continue;
 			}
-			else {
-				strcpy(keyword, command->args[1]);
+			if (*f != '%') {
+				fputc(*f, io->out);
+				continue;
 			}
-		}
-		else if (strcmp(command->args[0],"-o") == 0) {
-				open = 1;
-
-			if(strcmp(command->args[1], "-r") == 0) {
-				recursive = 1;
-				strcpy(keyword, command->args[2]);
+			if (f[1] == '%') {
+				fputc('%', io->out);
+				f++;
+				continue;
 			}
-			else {
-				strcpy(keyword, command->args[1]);
+
+			//Copy flags, width and precision into a format for a single conversion
+			char spec[64];
+			int len = 0;
+			spec[len++] = *f++;
+			while (*f && strchr("-+ #0123456789.", *f) && len < 40)
+				spec[len++] = *f++;
+			char *arg = next < argc ? argv[next++] : NULL;
+
+			switch (*f) {
+			case 'd':
+			case 'i':
+				strcpy(spec + len, "lld");
+				fprintf(io->out, spec, arg ? printf_integer(arg, &status, io->err) : 0LL);
+				break;
+			case 'u':
+			case 'o':
+			case 'x':
+			case 'X':
+				spec[len++] = 'l';
+				spec[len++] = 'l';
+				spec[len++] = *f;
+				spec[len] = 0;
+				fprintf(io->out, spec, arg ? (unsigned long long)printf_integer(arg, &status, io->err) : 0ULL);
+				break;
+			case 'f':
+			case 'F':
+			case 'e':
+			case 'E':
+			case 'g':
+			case 'G':
+				spec[len++] = 'L';
+				spec[len++] = *f;
+				spec[len] = 0;
+				fprintf(io->out, spec, arg ? strtold(arg, NULL) : 0.0L);
+				break;
+			case 'c':
+				strcpy(spec + len, "c");
+				fprintf(io->out, spec, arg && arg[0] ? arg[0] : 0);
+				break;
+			case 's':
+				strcpy(spec + len, "s");
+				fprintf(io->out, spec, arg ? arg : "");
+				break;
+			case 'b':
+				for (char *c = arg ? arg : ""; *c && !stop; c++) {
+					if (*c == '\\')
+						c += put_escape(io->out, c + 1, &stop);
+					else
+						fputc(*c, io->out);
+				}
+				break;
+			default:
+				fprintf(io->err, "printf: %%%c: invalid directive\n", *f ? *f : ' ');
+				return 1;
 			}
+			if (*f == 0)
+				break;
 		}
-		else if (command->arg_count > 1) {
-			printf("filesearch: bad usage\n");
+		if (next == used)
+			break; // the format consumed no arguments
+	} while (next < argc && !stop);
+
+	return status;
+}
+
+//Every builtin of the shell, a new builtin only needs its handler and an entry here
+const struct builtin_t builtins[] = {
+	{"at", builtin_at},
+	{"cached", builtin_cached},
+	{"cd", builtin_cd},
+	{"cdh", builtin_cdh},
+	{"every", builtin_every},
+	{"exit", builtin_exit},
+	{"filesearch", builtin_filesearch},
+	{"jobs", builtin_jobs},
+	{"joker", builtin_joker},
+	{"madmath", builtin_madmath},
+	{"onchange", builtin_onchange},
+	{"parallel", builtin_parallel},
+	{"pstraverse", builtin_pstraverse},
+	{"stats", builtin_stats},
+	{"take", builtin_take},
+	{"trace", builtin_trace},
+	//In-process versions of common programs, command <name> runs the real program
+	{"[", builtin_test},
+	{"echo", builtin_echo},
+	{"false", builtin_false},
+	{"printf", builtin_printf},
+	{"pwd", builtin_pwd},
+	{"test", builtin_test},
+	{"true", builtin_true},
+};
+
+#define BUILTIN_COUNT (sizeof(builtins) / sizeof(builtins[0]))
+//Size of the builtin hash table, a power of two well above BUILTIN_COUNT
+#define BUILTIN_SLOTS 64
+
+const struct builtin_t *builtin_slots[BUILTIN_SLOTS];
+unsigned int builtin_seed = 0;
+int builtin_slots_ready = 0;
+
+/**
+ * Seeded FNV-1a hash of a builtin name
+ * @param  name
+ * @param  seed
+ * @return
+ */
+unsigned int builtin_hash(const char *name, unsigned int seed)
+{
+	unsigned int hash = 2166136261u ^ seed;
+	while (*name)
+		hash = (hash ^ (unsigned char)*name++) * 16777619u;
+	//The low bits of a product only depend on the low bits, so the high ones are folded in
+	//or the seed would have just BUILTIN_SLOTS different outcomes
+	return (hash ^ (hash >> 16)) & (BUILTIN_SLOTS - 1);
+}
+
+//Seeds tried before giving up, a table with a few dozen builtins in BUILTIN_SLOTS needs a few hundred
+#define BUILTIN_SEED_TRIES 65536
+
+/**
+ * Searches for a seed under which every builtin lands in its own slot,
+ * so that a lookup is one hash and one strcmp. The builtins are fixed at build time,
+ * so a table that cannot be made fails the same way on every run.
+ * */
+void build_builtin_slots()
+{
+	for (builtin_seed = 0; builtin_seed < BUILTIN_SEED_TRIES; builtin_seed++) {
+		unsigned int i;
+		memset(builtin_slots, 0, sizeof(builtin_slots));
+		for (i = 0; i < BUILTIN_COUNT; i++) {
+			unsigned int slot = builtin_hash(builtins[i].name, builtin_seed);
+			if (builtin_slots[slot])
+				break;
+			builtin_slots[slot] = &builtins[i];
 		}
-		else {
-			strcpy(keyword, command->args[0]);
+		if (i == BUILTIN_COUNT) {
+			builtin_slots_ready = 1;
+			return;
 		}
-		
-		//Calling fileSearch function with inputs keyword, current dir (.),and options recursive and open
-		fileSearch(keyword,".", recursive, open);
-		return SUCCESS;	
 	}
+	fprintf(stderr, "-%s: no seed in %d tries gives each of the %d builtins its own slot of %d, raise BUILTIN_SLOTS\n",
+		sysname, BUILTIN_SEED_TRIES, (int)BUILTIN_COUNT, BUILTIN_SLOTS);
+	exit(1);
+}
 
-	if(strcmp(command->name, "cdh") == 0) {
+/**
+ * Looks up a builtin by name
+ * @param  name
+ * @return      NULL if there is no such builtin
+ */
+const struct builtin_t *find_builtin(const char *name)
+{
+	const struct builtin_t *builtin;
+
+	if (!builtin_slots_ready)
+		build_builtin_slots();
+	builtin = builtin_slots[builtin_hash(name, builtin_seed)];
+	if (builtin && strcmp(builtin->name, name) == 0)
+		return builtin;
+	return NULL;
+}
 
-		if(command->arg_count > 0) {
-			printf("cdh: Works with zero arguments.\n");
-			return SUCCESS;
-		}
+/**
+ * Runs the command if it is a builtin, its exit status is left in last_status
+ * @param  command [description]
+ * @return         NOT_BUILTIN if the command should be run as a program, EXIT if the shell should exit
+ */
+int run_builtin(struct command_t *command)
+{
+	const struct builtin_t *builtin = find_builtin(command->name);
+	struct io_t io = {stdin, stdout, stderr};
 
-		else if(cdCount == 0) {
-			printf("No previous directories to select from!\n");
-			return SUCCESS;
-		}
+	if (builtin == NULL)
+		return NOT_BUILTIN;
 
-		//Print cdHistory to user
-		printCdHistory(cdHistory);
+	//argv view of the command, args are shared with the command struct
+	char *argv[command->arg_count + 2];
+	argv[0] = command->name;
+	for (int i = 0; i < command->arg_count; i++)
+		argv[i + 1] = command->args[i];
+	argv[command->arg_count + 1] = NULL;
 
-		char selected_dir[100];
-		char selected_dir_main[100];
-		pid_t pid;
-		int pipefds[2];
-		
-		//Scanf the input from the child and send it to parent with pipes
-		if(pipe(pipefds) == -1) {
+	last_status = builtin->handler(command->arg_count + 1, argv, &io);
+	fflush(io.out);
+
+	return exit_requested ? EXIT : SUCCESS;
+}
+
+/**
+ * Converts a status returned by waitpid into a shell exit code
+ * @param  status [description]
+ * @return        exit code, 128 + signal number for killed children
+ */
+int exit_code(int status)
+{
+	if (WIFEXITED(status))
+		return WEXITSTATUS(status);
+	if (WIFSIGNALED(status))
+		return 128 + WTERMSIG(status);
+	return 1;
+}
+
+double timeval_seconds(struct timeval tv)
+{
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
 
-			printf("Pipe failed!\n");
-		}
+/**
+ * Adds the usage of one process to a sum
+ * @param sum
+ * @param usage
+ * */
+void add_usage(struct usage_t *sum, struct usage_t *usage)
+{
+	sum->wall += usage->wall;
+	sum->user += usage->user;
+	sum->sys += usage->sys;
+	if (usage->max_rss > sum->max_rss)
+		sum->max_rss = usage->max_rss;
+	sum->minflt += usage->minflt;
+	sum->majflt += usage->majflt;
+	sum->nvcsw += usage->nvcsw;
+	sum->nivcsw += usage->nivcsw;
+}
 
-		pid = fork();
+/**
+ * Converts an rusage into a usage_t, for RUSAGE_SELF deltas pass the earlier sample as before
+ * @param usage
+ * @param after
+ * @param before can be NULL
+ * */
+void fill_usage(struct usage_t *usage, struct rusage *after, struct rusage *before)
+{
+	usage->user = timeval_seconds(after->ru_utime);
+	usage->sys = timeval_seconds(after->ru_stime);
+	usage->max_rss = after->ru_maxrss;
+	usage->minflt = after->ru_minflt;
+	usage->majflt = after->ru_majflt;
+	usage->nvcsw = after->ru_nvcsw;
+	usage->nivcsw = after->ru_nivcsw;
+	if (before) {
+		usage->user -= timeval_seconds(before->ru_utime);
+		usage->sys -= timeval_seconds(before->ru_stime);
+		usage->minflt -= before->ru_minflt;
+		usage->majflt -= before->ru_majflt;
+		usage->nvcsw -= before->ru_nvcsw;
+		usage->nivcsw -= before->ru_nivcsw;
+	}
+}
 
-		if(pid == 0) {
+/**
+ * Adds a run of a command to the session statistics
+ * @param name
+ * @param usage
+ * */
+void record_usage(char *name, struct usage_t *usage)
+{
+	struct command_stats_t *stats;
+	int bucket = 0;
+	long us = usage->wall * 1e6;
 
-			printf("Select a directory by letter or number: ");
-			scanf("%s",selected_dir);
+	for (stats = command_stats; stats; stats = stats->next)
+		if (strcmp(stats->name, name) == 0)
+			break;
+	if (stats == NULL) {
+		stats = calloc(1, sizeof(struct command_stats_t));
+		snprintf(stats->name, sizeof(stats->name), "%s", name);
+		stats->next = command_stats;
+		command_stats = stats;
+	}
 
-			close(pipefds[0]);
-			write(pipefds[1],selected_dir,(strlen(selected_dir)+1));
-			exit(0);
+	while (us > 1 && bucket < HISTOGRAM_SIZE - 1) {
+		us >>= 1;
+		bucket++;
+	}
+	stats->histogram[bucket]++;
+	stats->count++;
+	if (usage->wall > stats->max_wall)
+		stats->max_wall = usage->wall;
+	add_usage(&stats->total, usage);
+}
 
+/**
+ * Approximates a percentile of the latency of a command from its histogram
+ * @param stats
+ * @param fraction
+ * @return upper bound of the bucket in seconds
+ */
+double histogram_percentile(struct command_stats_t *stats, double fraction)
+{
+	long seen = 0;
+	for (int i = 0; i < HISTOGRAM_SIZE; i++) {
+		seen += stats->histogram[i];
+		if (seen >= fraction * stats->count) {
+			double bound = (1L << (i + 1)) / 1e6;
+			return bound < stats->max_wall ? bound : stats->max_wall;
 		}
-		else {
-			wait(NULL);
-
-			close(pipefds[1]);
-			read(pipefds[0],selected_dir_main,sizeof(selected_dir_main));
+	}
+	return stats->max_wall;
+}
 
-			//Determine the index
-			if(strcmp(selected_dir_main, "a") == 0) {
-				strcpy(selected_dir_main, "1");
-			}
-			else if (strcmp(selected_dir_main, "b") == 0) {
-				strcpy(selected_dir_main, "2");
-			}
-			else if (strcmp(selected_dir_main, "c") == 0) {
-				strcpy(selected_dir_main, "3");
-			}
-			else if (strcmp(selected_dir_main, "d") == 0) {
-				strcpy(selected_dir_main, "4");
-			}
-			else if (strcmp(selected_dir_main, "e") == 0) {
-				strcpy(selected_dir_main, "5");
-			}
-			else if (strcmp(selected_dir_main, "f") == 0) {
-				strcpy(selected_dir_main, "6");
-			}
-			else if (strcmp(selected_dir_main, "g") == 0) {
-				strcpy(selected_dir_main, "7");
-			}
-			else if (strcmp(selected_dir_main, "h") == 0) {
-				strcpy(selected_dir_main, "8");
-			}
-			else if (strcmp(selected_dir_main, "i") == 0) {
-				strcpy(selected_dir_main, "9");
-			}
-			else if (strcmp(selected_dir_main, "j") == 0) {
-				strcpy(selected_dir_main, "10");
-			}
+/**
+ * Prints the session statistics, with the latency histogram of every command if requested
+ * @param histograms
+ * */
+void print_stats(int histograms)
+{
+	struct command_stats_t *stats;
 
-			int index = atoi(selected_dir_main);	
-			
-			//Change directory and add it to cdHistory
-			r = chdir(cdHistory[cdCount - index]);
-			if (r == -1) {
-				printf("Please provide a valid number or letter!\n");
-			}
-			else {
-			
-				char cwd[512];
-				if(getcwd(cwd,sizeof(cwd)) != NULL) {
-					addCdToHistory(cwd);
-				}
-			
-			}
+	if (command_stats == NULL) {
+		printf("stats: no commands recorded%s\n", accounting ? "" : ", enable with stats on");
+		return;
+	}
 
+	printf("%-16s %7s %10s %10s %10s %10s %10s %10s %10s\n", "command", "runs", "mean", "p50<=", "p90<=", "max", "user", "sys", "maxrss");
+	for (stats = command_stats; stats; stats = stats->next) {
+		printf("%-16s %7ld %9.3fs %9.3fs %9.3fs %9.3fs %9.3fs %9.3fs %8ldKB\n", stats->name, stats->count,
+			stats->total.wall / stats->count, histogram_percentile(stats, 0.5), histogram_percentile(stats, 0.9),
+			stats->max_wall, stats->total.user, stats->total.sys, stats->total.max_rss);
+	}
 
+	if (!histograms)
+		return;
+	for (stats = command_stats; stats; stats = stats->next) {
+		long most = 0;
+		printf("\n%s (faults %ld/%ld, context switches %ld/%ld)\n", stats->name,
+			stats->total.minflt, stats->total.majflt, stats->total.nvcsw, stats->total.nivcsw);
+		for (int i = 0; i < HISTOGRAM_SIZE; i++)
+			if (stats->histogram[i] > most)
+				most = stats->histogram[i];
+		for (int i = 0; i < HISTOGRAM_SIZE; i++) {
+			if (stats->histogram[i] == 0)
+				continue;
+			int bar = stats->histogram[i] * 40 / most;
+			printf("  %10ld-%-10ld us %6ld |%.*s\n", 1L << i, 1L << (i + 1), stats->histogram[i],
+				bar ? bar : 1, "########################################");
 		}
-		return SUCCESS;
 	}
+}
 
-	if(strcmp(command->name, "take") == 0) {
-	
-		int r1,r2;
-		if(command->arg_count > 1) {
-			printf("take: Too many arguments.");
-			printf("Usage: take [DIRECTORY]");
-			return SUCCESS;
-		}
-		//Tokenizing the argument of take command
-		char *input = strdup(command->args[0]);
-		char *token = strtok(input, "/");
-		
-		//for each token 
-		while( token != NULL ) {
-			
-			//make directory named token
-			r1 = mkdir(token, S_IRWXU);
-			if(r1 == -1) {
-				if(errno != EEXIST) {
+/**
+ * Prints the usage collected for a time prefixed command to stderr
+ * @param usage
+ * */
+void print_usage(struct usage_t *usage)
+{
+	fflush(stdout);
+	fprintf(stderr, "\nreal\t%dm%.3fs\n", (int)usage->wall / 60, usage->wall - 60 * ((int)usage->wall / 60));
+	fprintf(stderr, "user\t%dm%.3fs\n", (int)usage->user / 60, usage->user - 60 * ((int)usage->user / 60));
+	fprintf(stderr, "sys\t%dm%.3fs\n", (int)usage->sys / 60, usage->sys - 60 * ((int)usage->sys / 60));
+	fprintf(stderr, "maxrss\t%ldKB\nfaults\t%ld minor, %ld major\nctxsw\t%ld voluntary, %ld involuntary\n",
+		usage->max_rss, usage->minflt, usage->majflt, usage->nvcsw, usage->nivcsw);
+}
 
-					printf("-%s: %s: %s\n", sysname, command->name, strerror(errno));
-					return SUCCESS;
-				}
-			}
-			//change directory to directory named token
-			r2 = chdir(token);
-			if (r2 == -1) {
-				printf("-%s: %s: %s\n", sysname, command->name, strerror(errno));
-				return SUCCESS;
-			}
-			//and add every directory changes to cdHistory
-			else {
-			
-				char cwd[512];
-				if(getcwd(cwd,sizeof(cwd)) != NULL) {
-					addCdToHistory(cwd);
-				}
-			
-			}
+/**
+ * Opens the redirect files of a command or group over stdin and stdout
+ * @param  redirects in/out redirection, NULL entries are left alone
+ * @return           0 on success, -1 if a file could not be opened
+ */
+int apply_redirects(char *redirects[3])
+{
+	int fd;
+	int flags[3] = {O_RDONLY, O_WRONLY | O_CREAT | O_TRUNC, O_WRONLY | O_CREAT | O_APPEND};
 
-			token = strtok(NULL, "/");
+	for (int i = 0; i < 3; i++)
+	{
+		if (redirects[i] == NULL)
+			continue;
+		fd = open(redirects[i], flags[i], 0644);
+		if (fd < 0)
+		{
+			printf("-%s: %s: %s\n", sysname, redirects[i], strerror(errno));
+			return -1;
 		}
-		return SUCCESS;
+		dup2(fd, i == 0 ? STDIN_FILENO : STDOUT_FILENO);
+		close(fd);
 	}
+	return 0;
+}
 
+/**
+ * Applies redirects to the shell itself, for builtins and groups that run in it
+ * @param  redirects in/out redirection
+ * @param  saved     stdin and stdout of the shell, handed to restore_redirects
+ * @return           0 on success, -1 if a file could not be opened
+ */
+int shell_redirects(char *redirects[3], int saved[2])
+{
+	fflush(stdout);
+	saved[0] = dup(STDIN_FILENO);
+	saved[1] = dup(STDOUT_FILENO);
+	return apply_redirects(redirects);
+}
 
+/**
+ * Puts back the stdin and stdout saved by shell_redirects
+ * @param saved [description]
+ */
+void restore_redirects(int saved[2])
+{
+	fflush(stdout);
+	dup2(saved[0], STDIN_FILENO);
+	dup2(saved[1], STDOUT_FILENO);
+	close(saved[0]);
+	close(saved[1]);
+}
 
-	if(strcmp(command->name, "joker") == 0) {
-
-		char currentPath[100];
+/**
+ * Drops the name of a prefixed command like time or command, the first argument becomes the name
+ * @param command [description]
+ */
+void shift_command(struct command_t *command)
+{
+	free(command->name);
+	command->name = command->args[0];
+	memmove(command->args, command->args + 1, sizeof(char *) * --command->arg_count);
+}
 
-		if(getcwd(currentPath,sizeof(currentPath)) == NULL)
-			printf("Could not get the cwd!\n");
+/**
+ * Replaces the current process with the external program of the command
+ * @param command [description]
+ */
+void exec_external(struct command_t *command)
+{
+	//command <name> skips the builtins and always runs the program
+	if (strcmp(command->name, "command") == 0 && command->arg_count > 0)
+		shift_command(command);
+
+	// increase args size by 2
+	command->args = (char **)realloc(
+		command->args, sizeof(char *) * (command->arg_count += 2));
+
+	// shift everything forward by 1
+	for (int i = command->arg_count - 2; i > 0; --i)
+		command->args[i] = command->args[i - 1];
+
+	// set args[0] as a copy of name
+	command->args[0] = strdup(command->name);
+	// set args[arg_count-1] (last) to NULL
+	command->args[command->arg_count - 1] = NULL;
+
+	//path resolving and calling execv
+	char path[1024] = "/bin/";
+	if (strchr(command->name, '/'))
+		strcpy(path, command->name);
+	else
+		strcat(path, command->name);
+	execv(path, command->args);
 
-		//Change directory to store cronFile in the the same directory with shellfyre.c
-		int r1 = chdir(pathToShellfyre);
-			if (r1 == -1) 
-				printf("-%s: %s: %s\n", sysname, command->name, strerror(errno));
+	printf("-%s: %s: command not found\n", sysname, command->name);
+	fflush(stdout);
+	_exit(127);
+}
 
-		//opening the cronFile at writing the job
-		FILE *cronFile = fopen("cronFile", "w");
-		fprintf(cronFile,"*/15 * * * * XDG_RUNTIME_DIR=/run/user/$(id -u) /usr/bin/notify-send \"JOKE\" \"$(/snap/bin/curl https://icanhazdadjoke.com/)\"\n");
-		fclose(cronFile);
+/**
+ * Reaps one stage of a foreground pipeline and accounts for it
+ * @param  stage
+ * @param  pid     set to 0 once reaped
+ * @param  started fork time of the stage
+ * @param  status  wait status of the stage
+ * @param  options WNOHANG to only reap a stage that has exited
+ * @return         1 if the stage was reaped
+ */
+int reap_stage(struct command_t *stage, pid_t *pid, long long started, int *status, int options)
+{
+	struct rusage rusage;
+	struct usage_t usage;
+	pid_t r = wait4(*pid, status, options, &rusage);
+
+	if (r == 0)
+		return 0;
+	*pid = 0;
+	//Reaped elsewhere, nothing is known about it
+	if (r == -1)
+		return 1;
+	fill_usage(&usage, &rusage, NULL);
+	usage.wall = (now_ns() - started) / 1e9;
+	add_usage(&pipeline_usage, &usage);
+	if (accounting)
+		record_usage(stage->name, &usage);
+	return 1;
+}
 
+/**
+ * Ends the exec span of a stage once its close-on-exec pipe is closed
+ * @param execfd read end, set to -1
+ * @param forked start of the fork span of the stage
+ */
+void trace_exec(int *execfd, long long forked)
+{
+	trace_end("exec", forked);
+	close(*execfd);
+	*execfd = -1;
+}
 
-		//calling crontab in the child with cronFile
-		char *path = "/usr/bin/crontab";
-		char *args[] = {path,"cronFile",NULL};
+/**
+ * Waits for the stages of a foreground pipeline, each one is reaped as soon as it exits so that
+ * its wall time ends with it and not with the slower stages before it
+ * @param  command first stage
+ * @param  pids    one per forked stage, set to 0 as they are reaped
+ * @param  execs   exec pipes of the stages while tracing, -1 for none, closed here
+ * @param  forked  start of the fork span of every stage, which its exec span shares
+ * @param  started fork time of every stage
+ * @param  count   number of forked stages
+ * @return         wait status of the last stage
+ */
+int wait_pipeline(struct command_t *command, pid_t *pids, int *execs, long long *forked, long long *started, int count)
+{
+	struct command_t *stage;
+	struct pollfd fds[count + 2];
+	int left = count, last = 0, sfd = signal_fd, seen = 0;
+	sigset_t mask, saved;
+
+	//SIGCHLD is read from signal_fd in the shell, a subshell makes a signalfd of its own
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGCHLD);
+	sigprocmask(SIG_BLOCK, &mask, &saved);
+	if (sfd == -1)
+		sfd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+
+	while (left > 0) {
+		int reaped = 0, n = 2;
+
+		stage = command;
+		for (int j = 0; j < count; j++, stage = stage->next) {
+			int status = 0;
+
+			if (pids[j] == 0 || !reap_stage(stage, &pids[j], started[j], &status, WNOHANG))
+				continue;
+			if (j == count - 1)
+				last = status;
+			reaped++;
+			left--;
+		}
+		if (left == 0)
+			break;
 
-		pid_t pid = fork();
+		//Without a signalfd, blocking on the first stage left is all that can be done
+		if (sfd == -1) {
+			int j = 0, status = 0;
 
-		if(pid == 0) {
-		execv(path,args);
+			for (stage = command; pids[j] == 0; j++)
+				stage = stage->next;
+			reap_stage(stage, &pids[j], started[j], &status, 0);
+			if (j == count - 1)
+				last = status;
+			left--;
+			continue;
 		}
+
+		//The sweep above runs with SIGCHLD blocked, an exit after it is still waiting in sfd.
+		//The exec pipes are watched along, so that the parent never blocks on one of them,
+		//and in the shell the timers keep running while the command does
+		fds[0] = (struct pollfd){ sfd, POLLIN, 0 };
+		fds[1] = (struct pollfd){ sfd == signal_fd ? timer_fd : -1, POLLIN, 0 };
+		for (int j = 0; j < count; j++)
+			if (execs[j] != -1)
+				fds[n++] = (struct pollfd){ execs[j], POLLIN, 0 };
+		if (poll(fds, n, reaped > 0 ? 0 : -1) == -1 && errno != EINTR)
+			break;
+		if (fds[1].revents)
+			timer_fire();
+		for (int k = 2; k < n; k++)
+			for (int j = 0; fds[k].revents && j < count; j++)
+				if (execs[j] == fds[k].fd)
+					trace_exec(&execs[j], forked[j]);
+		if (!fds[0].revents)
+			continue;
+		if (sfd == signal_fd)
+			seen |= loop_signals();
 		else {
-			wait(NULL);
+			struct signalfd_siginfo info;
+			while (read(sfd, &info, sizeof(info)) == sizeof(info))
+				;
 		}
-
-		int r2 = chdir(currentPath);
-		if (r2 == -1) 
-			printf("-%s: %s: %s\n", sysname, command->name, strerror(errno));
-		
-		has_crontab = 1;
-		return SUCCESS;
 	}
 
-	if(strcmp(command->name, "madmath") == 0) {
-		
-		if(command->arg_count < 1 ) {
-
-			printf("math :Too few arguments\n");
-			printf("usage: math <option> <number> <number>\n");
-			printf("options :sub ,sum,factor !!!!!FIND OUT THE REST!!!!!!!\n");
-		}
-		//Assigning options
-		else if(strcmp(command->args[0],"sub") == 0){
-		    
-		    if(command->args[1] == NULL || command->args[2] == NULL) {
-
-				printf("math: sub: bad usage\n");
-				printf("usage: math sub <num1> <num2>\n");
-		    }
-		    else {
-                		int num1 = atoi(command->args[1]);
-    				int num2 = atoi(command->args[2]);
-    				int sub = num1 - num2;
-    				printf("%d\n",sub);
-		    }	
-		}
-		else if(strcmp(command->args[0],"sum") == 0){
-		    
-		    if(command->args[1] == NULL || command->args[2] == NULL) {
-
-				printf("math: sum: bad usage\n");
-				printf("usage: math sum <num1> <num2>\n");
-			}
-			else {
-    		    		int num1 = atoi(command->args[1]);
-    				int num2 = atoi(command->args[2]);
-    				int sum = num1 + num2;
-    				printf("%d\n",sum);
-			}
-		}
-		else if(strcmp(command->args[0],"factor") == 0) {
-
-			int sum = 1;
-			if(command->args[1] == NULL) {
-				printf("Please provide a number!\n");
+	//The stage is gone, so its exec was over by now
+	for (int j = 0; j < count; j++)
+		if (execs[j] != -1)
+			trace_exec(&execs[j], forked[j]);
+	if (sfd != signal_fd)
+		close(sfd);
+	sigprocmask(SIG_SETMASK, &saved, NULL);
+	//The ^C went to the command, the prompt after it starts on a line of its own
+	if (seen & 1)
+		printf("\n");
+	return last;
+}
 
-			}
-			else if(command->arg_count > 2) {
-				printf("math: factor: bad usage\n");
-				printf("usage: math factor <num> \n");;
-			}
+/**
+ * Forks every stage of a pipeline with its pipes and redirects and waits for it
+ * unless it runs in the background. Builtins in a pipeline run in their own child.
+ * @param  command first stage of the pipeline
+ * @return         SUCCESS, exit status of the last stage is left in last_status
+ */
+int run_pipeline(struct command_t *command)
+{
+	struct command_t *stage;
+	int stages = 0, i = 0, status = 0;
+	int pipefds[2], prev_read = -1;
+
+	for (stage = command; stage; stage = stage->next)
+		stages++;
+	pid_t *pids = malloc(sizeof(pid_t) * stages);
+	long long *started = malloc(sizeof(long long) * stages);
+	long long *forked = malloc(sizeof(long long) * stages);
+	int *execs = malloc(sizeof(int) * stages);
+	memset(&pipeline_usage, 0, sizeof(pipeline_usage));
+
+	fflush(stdout);
+	for (stage = command; stage; stage = stage->next, i++)
+	{
+		if (stage->next && pipe(pipefds) == -1)
+		{
+			printf("-%s: %s: %s\n", sysname, stage->name, strerror(errno));
+			break;
+		}
 
-			else if(command->args[1] < 0)
-        			printf("Factoriel of a negative number cannot be calculated!\n");
+		//While tracing, a close-on-exec pipe reports when the child has finished its exec.
+		//A builtin never execs and would hold the pipe open until it exits, so it gets none
+		int execfds[2] = {-1, -1};
+		if (trace_enabled && find_builtin(stage->name) == NULL && pipe2(execfds, O_CLOEXEC) == -1)
+			execfds[0] = execfds[1] = -1;
+		execs[i] = execfds[0];
 
-    			else {
-        			for (int i = 1; i <= atoi(command->args[1]); ++i) {
-           				 sum *= i;
-        			}
+		forked[i] = trace_begin();
+		started[i] = now_ns();
+		pids[i] = shell_fork();
+		trace_end("fork", forked[i]);
 
-				printf("%d\n",sum);
+		//The stages forked so far are still waited for, as when pipe() fails
+		if (pids[i] == -1)
+		{
+			printf("-%s: %s: %s\n", sysname, stage->name, strerror(errno));
+			if (stage->next)
+			{
+				close(pipefds[0]);
+				close(pipefds[1]);
 			}
-			
-         	}
-
-		else if(strcmp(command->args[0],"pi") == 0) {
-
-			long double pi = M_PI;	
-    			printf("%.10Lf\n", pi);
-
-		}
-		
-		else if(strcmp(command->args[0],"pow") == 0) {
-
-			if(command->args[1] == NULL || command->args[2] == NULL) {
-
-				printf("math: pow: bad usage\n");
-				printf("usage: math pow <base> <power>\n");
+			if (execfds[0] != -1)
+			{
+				close(execfds[0]);
+				close(execfds[1]);
+				execs[i] = -1;
 			}
-			else {  int result = 1;
-    				int base = atoi(command->args[1]);
-    				int power = atoi(command->args[2]);
-    				for (power; power>0; power--){
-    
-    					result = result * base;
-    				}
-				printf("%d\n",result );
-            		}
-
+			break;
 		}
 
-		else if(strcmp(command->args[0],"mod") == 0) {
+		//A background pipeline gets a process group of its own so that ^C at the prompt misses it
+		if (command->background && pids[i] > 0)
+			setpgid(pids[i], pids[0]);
 
-			if(command->args[1] == NULL || command->args[2] == NULL) {
-
-				printf("math: mod: bad usage\n");
-				printf("usage: math mod <num1> <num2>\n");
+		if (pids[i] == 0) // child
+		{
+			in_subshell = 1;
+			if (command->background)
+				setpgid(0, i == 0 ? 0 : pids[0]);
+			if (execfds[0] != -1)
+				close(execfds[0]);
+			if (prev_read != -1)
+			{
+				dup2(prev_read, STDIN_FILENO);
+				close(prev_read);
 			}
-			else {
-    		   		int num1 = atoi(command->args[1]);
-    				int num2 = atoi(command->args[2]);
-    				int mod = num2 % num1;
-    				printf("%d\n",mod);
+			if (stage->next)
+			{
+				close(pipefds[0]);
+				dup2(pipefds[1], STDOUT_FILENO);
+				close(pipefds[1]);
+			}
+			if (apply_redirects(stage->redirects) == -1)
+				_exit(1);
+
+			last_status = 0;
+			if (run_builtin(stage) != NOT_BUILTIN)
+			{
+				fflush(stdout);
+				_exit(last_status);
 			}
+			exec_external(stage);
 		}
-		
-		//Chosing the message to be displayed randomly
-		char *header,*message;
-		int num;
-		num = rand() % 11;
-		
-		switch (num) {
-		    
-		    case 1:
-		        header = "BEST REGARDS";
-		        message = "FROM YOUR MIDDLE SCHOOL MATH TEACHER";
-		        break;
-
-		    case 2:
-		        header = "Tesla Business Offer";
-		        message = "HEY DUDE, THIS IS ELON WANT U";
-		        break;
-		    
-		    case 3:
-		        header = "NASA";
-		        message = "WANNA BECOME A ASTRONAUT";
-		        break;
-		    
-		    case 4:
-		        header = "Leonhard Euler";
-		        message = "I am proud of you son!";
-		        break;
-		        
-		    case 5:
-		        header = "Abel Prize";
-		        message = "We want to give you The Abel Prize sir";
-		        break;
-		    
-		    case 6:
-		        header = "***CONGRATS***";
-		        message = "YOU ARE CHOOSEN AS GOAT MATHEMATICIAN!";
-		        break;    
-		    
-		    case 7:
-		        header = "Pythagoras";
-		        message = "Like your triangle right triangle";
-		        break; 
-		        
-		    case 8:
-		        header = "Guinness World Records";
-		        message = "NEW WORLD RECORD: The most genius mathematician is you!!!";
-		        break; 
-		    case 9:
-		        header = "***FATAL WARNING***";
-		        message = "I AM NOT A CALCULATOR, I AM A COMPUTER!!!";
-		        break; 
-		    default:
-		        header = "***FATAL WARNING***";
-		        message = "I AM NOT A CALCULATOR, I AM A COMPUTER!!!";
-		        break;   
-    		}  
-		 
-		//Displaying the message with the notify-send    		 
-		char *path = "/usr/bin/notify-send";
-		char *args[] = {path,header,message,NULL};
-		pid_t pid;
 
-		pid = fork();
+		//The read end is watched by wait_pipeline
+		if (execfds[1] != -1)
+			close(execfds[1]);
 
-		if(pid == 0) {
-			execv(path,args);
+		if (prev_read != -1)
+			close(prev_read);
+		prev_read = -1;
+		if (stage->next)
+		{
+			close(pipefds[1]);
+			prev_read = pipefds[0];
 		}
-		else {
-			wait(NULL);
-		}	
-		
-		return SUCCESS;
 	}
-	
-	if(strcmp(command->name, "pstraverse") == 0) {
-
-		//module parameters
-		char PID[20] ="PID=";
-		char option[20];
-		char data[100];
+	//Left open when the loop stopped early
+	if (prev_read != -1)
+		close(prev_read);
+
+	if (command->background) {
+		//Nobody waits for a background pipeline, so it has no exec spans
+		for (int j = 0; j < i; j++)
+			if (execs[j] != -1)
+				close(execs[j]);
+		if (i > 0)
+			job_add(command, pids, i);
+	}
+	else
+	{
+		//Waiting for every stage, the exit status of the pipeline is the one of the last stage
+		long long span = trace_begin();
+		status = wait_pipeline(command, pids, execs, forked, started, i);
+		last_status = i == stages ? exit_code(status) : 1;
+		trace_end("wait", span);
+	}
+	free(pids);
+	free(started);
+	free(forked);
+	free(execs);
+	return SUCCESS;
+}
 
+/**
+ * Runs a single pipeline, builtins run inside the shell unless they are piped or in background
+ * @param  command [description]
+ * @return         EXIT if the shell should exit
+ */
+int process_command(struct command_t *command)
+{
+	int r;
+	if (strcmp(command->name, "") == 0)
+		return SUCCESS;
 
-		if(command->arg_count < 2) {
-			("pstravers: Too few arguments.\n");
-			("Usage: pstraverse <PID> <-d or -b>\n");
+	//time prefix, measures the whole pipeline that follows it
+	if (strcmp(command->name, "time") == 0)
+	{
+		struct usage_t usage;
+		struct rusage before, after;
+		long long started;
 
+		if (command->arg_count == 0) {
+			printf("usage: time <command>\n");
 			return SUCCESS;
 		}
+		shift_command(command);
+
+		getrusage(RUSAGE_SELF, &before);
+		started = now_ns();
+		memset(&pipeline_usage, 0, sizeof(pipeline_usage));
+		r = process_command(command);
+		getrusage(RUSAGE_SELF, &after);
+
+		//Builtins run in the shell itself, pipelines are accounted by their children
+		fill_usage(&usage, &after, &before);
+		usage.max_rss = 0;
+		add_usage(&usage, &pipeline_usage);
+		usage.wall = (now_ns() - started) / 1e9;
+		print_usage(&usage);
+		if (!accounting)
+			record_usage(command->name, &usage);
+		return r;
+	}
 
-		//assigning module paramters
-		strcat(PID,command->args[0]);
-		sprintf(option, "option=\"%s\" ", command->args[1]);
-
-
-		//if device is not open then opening or installing it
-		if(!module_open) {
-			//Path and argument resolving
-			char *path = "/usr/bin/sudo";
-			char *args[] = {path,"insmod","process_module.ko",PID,option,NULL};
-
-			pid_t pid = fork();
-
-			if(pid == 0) {
-
-			//Calling in the child
-			execv(path,args);
+	last_status = 0;
+	if (command->next == NULL && !command->background)
+	{
+		int saved[2];
 
+		//Builtins with redirects write to the files through the shell's own descriptors. The
+		//files of a program are opened in its child only, a fifo or a truncation must see one open.
+		if ((command->redirects[0] || command->redirects[1] || command->redirects[2]) && find_builtin(command->name))
+		{
+			if (shell_redirects(command->redirects, saved) == -1) {
+				r = SUCCESS;
+				last_status = 1;
 			}
-			else {
-				wait(NULL);
-			}
-			module_open = 1;
-
+			else
+				r = run_builtin(command);
+			restore_redirects(saved);
+			return r;
 		}
-		else {
-			int fd;
-			fd = open("/dev/process_device", O_RDWR);
-
-			if(fd < 0) {
-				printf("-%s: %s\n", sysname,strerror(errno));
-				printf("Cannot open the file\n");
-			}
-		       	strcat(data,command->args[0]);
-			strcat(data, " ");
-			strcat(data, command->args[1]);	
-			write(fd,data, strlen(data) +1);
-			close(fd);
+		if (!command->redirects[0] && !command->redirects[1] && !command->redirects[2]) {
+			long long span = trace_begin();
+			r = run_builtin(command);
+			trace_end("dispatch", span);
+			if (r != NOT_BUILTIN)
+				return r;
 		}
-		strcpy(data,"");
-		return SUCCESS;
 	}
+	return run_pipeline(command);
+}
 
+/**
+ * Walks a command list tree, && and || are short-circuited on last_status
+ * @param  node [description]
+ * @return      EXIT if the shell should exit
+ */
+int execute_node(struct node_t *node)
+{
+	int code, saved[2];
+	pid_t pid;
 
-	pid_t pid = fork();
+	if (node == NULL)
+		return SUCCESS;
 
-	if (pid == 0) // child
+	switch (node->type)
 	{
-		// increase args size by 2
-		command->args = (char **)realloc(
-			command->args, sizeof(char *) * (command->arg_count += 2));
-
-		// shift everything forward by 1
-		for (int i = command->arg_count - 2; i > 0; --i)
-			command->args[i] = command->args[i - 1];
-
-		// set args[0] as a copy of name
-		command->args[0] = strdup(command->name);
-		// set args[arg_count-1] (last) to NULL
-		command->args[command->arg_count - 1] = NULL;
+	case NODE_COMMAND:
+		return process_command(node->command);
 
+	case NODE_SEQUENCE:
+		code = execute_node(node->left);
+		if (code == EXIT)
+			return code;
+		return execute_node(node->right);
 
-		//path resolving and calling execv
-		char path[1024] = "/bin/";
-		strcat(path,command->name);
-		execv(path,command->args);
-	}
-	else {
-		//Waiting for child to finish if command is not running in background
-		if(command->args[command->arg_count-2] != "&") {
-			wait(NULL);
+	case NODE_AND:
+	case NODE_OR:
+		code = execute_node(node->left);
+		if (code == EXIT)
+			return code;
+		if ((node->type == NODE_AND) != (last_status == 0))
+			return code;
+		return execute_node(node->right);
+
+	case NODE_GROUP:
+		if (!node->redirects[0] && !node->redirects[1] && !node->redirects[2])
+			return execute_node(node->left);
+		//The whole group shares one open of each file, its programs inherit it
+		if (shell_redirects(node->redirects, saved) == -1)
+		{
+			code = SUCCESS;
+			last_status = 1;
+		}
+		else
+			code = execute_node(node->left);
+		restore_redirects(saved);
+		return code;
+
+	case NODE_SUBSHELL:
+		fflush(stdout);
+		pid = shell_fork();
+		if (pid == 0)
+		{
+			in_subshell = 1;
+			if (apply_redirects(node->redirects) == -1)
+				_exit(1);
+			execute_node(node->left);
+			fflush(stdout);
+			_exit(last_status);
+		}
+		else if (pid == -1)
+		{
+			printf("-%s: %s\n", sysname, strerror(errno));
+			last_status = 1;
+		}
+		else
+		{
+			int status;
+			waitpid(pid, &status, 0);
+			last_status = exit_code(status);
 		}
 		return SUCCESS;
 	}
-
-	printf("-%s: %s: command not found\n", sysname, command->name);
-	return UNKNOWN;
+	return SUCCESS;
 }
 
 
-void fileSearch(char *keyword, char *current_dir,int recursive, int open) {
+/**
+ * Walks the entries of a directory and, when recursive, of its subdirectories, symbolic links
+ * are not followed into
+ * @param current_dir
+ * @param recursive
+ * @param visit       called with the path of every entry, returns 0 to skip a subdirectory
+ * @param arg         handed to visit
+ */
+void walkDirectory(char *current_dir, int recursive, walk_handler visit, void *arg) {
 	struct dirent *dir;
 	DIR *d = opendir(current_dir);
 	char next_dir[512];
-	char directory[512];
 
-	if(d != NULL) {
+	if(d == NULL)
+		return;
+
+	while((dir = readdir(d)) != NULL) {
 
-		while((dir = readdir(d)) != NULL) {
-		
 		//If it is current or previous directory then ignore otherwise creates infinite loop
-			if(strcmp(dir->d_name, ".") != 0 && strcmp(dir->d_name, "..") != 0) {			
+		if(strcmp(dir->d_name, ".") == 0 || strcmp(dir->d_name, "..") == 0)
+			continue;
 
-				if(strstr(dir->d_name,keyword)) {
-	
-					printf("%s/%s\n",current_dir,dir->d_name);
-
-					if (open) {
-						
-						//directory resolving
-						strcpy(directory,current_dir);
-						strcat(directory,"/");
-						strcat(directory,dir->d_name);
-						
-						//Calling xdg-open in the child	
-						char *path = "/bin/xdg-open";
-						char *args[] = {path,directory,NULL};
-						pid_t pid = fork();
-
-						if(pid == 0) {
-
-							execv(path, args);
-						}
-						else {
-							wait(NULL);
-						}
-					}
-				}
-				
-				//Next_dir resolving and calling recursively
-				if(recursive) {
-					strcpy(next_dir,current_dir);
-					strcat(next_dir,"/");
-					strcat(next_dir,dir->d_name);
-					fileSearch(keyword, next_dir,recursive,open);
+		//Next_dir resolving and calling recursively
+		snprintf(next_dir, sizeof(next_dir), "%s/%s", current_dir, dir->d_name);
+		if(visit(arg, next_dir, dir) && recursive && (dir->d_type == DT_DIR || dir->d_type == DT_UNKNOWN))
+			walkDirectory(next_dir, recursive, visit, arg);
+	}
+	closedir(d);
+}
 
-				}
+//Keyword and options of a fileSearch
+struct file_search_t {
+	char *keyword;
+	int open;
+};
+
+/**
+ * walkDirectory handler of fileSearch, prints the entries whose name contains the keyword
+ * and opens them with xdg-open if asked
+ */
+int fileSearchVisit(void *arg, char *path, struct dirent *entry) {
+	struct file_search_t *search = arg;
+
+	if(strstr(entry->d_name, search->keyword)) {
+
+		printf("%s\n", path);
+
+		if (search->open) {
+
+			//Calling xdg-open in the child
+			char *xdg = "/bin/xdg-open";
+			char *args[] = {xdg,path,NULL};
+			pid_t pid = shell_fork();
 
+			if(pid == 0) {
+
+				execv(xdg, args);
+				_exit(127);
+			}
+			else {
+				waitpid(pid, NULL, 0);
 			}
-				
 		}
-		closedir(d);
 	}
-	return;	
+	return 1;
+}
+
+void fileSearch(char *keyword, char *current_dir,int recursive, int open) {
+	struct file_search_t search = {keyword, open};
+
+	walkDirectory(current_dir, recursive, fileSearchVisit, &search);
 }
 /**
   * Adds given directory to cdHistory list 
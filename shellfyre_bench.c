@@ -0,0 +1,296 @@
+//Benchmark for the hot paths of shellfyre
+//Compiled with gcc -O2 -o shellfyre_bench shellfyre_bench.c
+//Run with ./shellfyre_bench [-n parse_lines] [-f forks] [-b dispatches] [-w width] [-d depth] [-F files] [-o output.json]
+
+#define SHELLFYRE_BENCH
+#include "shellfyre.c"
+
+//Command lines the parse benchmark cycles through
+const char *bench_lines[] = {
+	"ls -la /tmp",
+	"cat < input.txt | grep -v foo | sort | uniq -c > counts.txt",
+	"make && ./run_tests || echo failed",
+	"cd /usr/local/src; take build/release; filesearch -r -o main",
+	"( echo one; echo two ) && { madmath sum 1 2; madmath pow 2 10; }",
+	"pstraverse 1 -d >> tree.log &",
+	"echo \"quoted; text && more\" 'single || quoted' | tr a-z A-Z",
+};
+
+//Number of entries created by the last make_tree call
+long tree_entries = 0;
+
+/**
+ * Creates a directory tree with width subdirectories and files regular files per level
+ * @param dir
+ * @param width
+ * @param depth
+ * @param files
+ * */
+void make_tree(char *dir, int width, int depth, int files)
+{
+	char path[1024];
+
+	for (int i = 0; i < files; i++) {
+		snprintf(path, sizeof(path), "%s/file_%d.txt", dir, i);
+		int fd = open(path, O_WRONLY | O_CREAT, 0644);
+		if (fd >= 0)
+			close(fd);
+		tree_entries++;
+	}
+	if (depth == 0)
+		return;
+	for (int i = 0; i < width; i++) {
+		snprintf(path, sizeof(path), "%s/dir_%d", dir, i);
+		mkdir(path, S_IRWXU);
+		tree_entries++;
+		make_tree(path, width, depth - 1, files);
+	}
+}
+
+/**
+ * Removes a tree created by make_tree
+ * @param dir
+ * */
+void remove_tree(char *dir)
+{
+	struct dirent *entry;
+	char path[1024];
+	DIR *d = opendir(dir);
+
+	if (d == NULL)
+		return;
+	while ((entry = readdir(d)) != NULL) {
+		if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+			continue;
+		snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+		if (entry->d_type == DT_DIR)
+			remove_tree(path);
+		else
+			unlink(path);
+	}
+	closedir(d);
+	rmdir(dir);
+}
+
+/**
+ * Sends stdout to /dev/null while builtins under benchmark print
+ * @return saved stdout descriptor
+ */
+int silence_stdout()
+{
+	int saved, null;
+
+	fflush(stdout);
+	saved = dup(STDOUT_FILENO);
+	null = open("/dev/null", O_WRONLY);
+	dup2(null, STDOUT_FILENO);
+	close(null);
+	return saved;
+}
+
+void restore_stdout(int saved)
+{
+	fflush(stdout);
+	dup2(saved, STDOUT_FILENO);
+	close(saved);
+}
+
+/**
+ * Parses parse_lines command lines with parse_line
+ * @return elapsed nanoseconds
+ */
+long long bench_parse(long parse_lines, long *bytes)
+{
+	int count = sizeof(bench_lines) / sizeof(bench_lines[0]);
+	char buf[4096];
+	long long start;
+
+	*bytes = 0;
+	start = now_ns();
+	for (long i = 0; i < parse_lines; i++) {
+		const char *line = bench_lines[i % count];
+		strcpy(buf, line);
+		*bytes += strlen(line);
+		free_node(parse_line(buf));
+	}
+	return now_ns() - start;
+}
+
+/**
+ * Runs a command line through execute_node, command true forks and execs /bin/true
+ * while plain true runs in-process
+ * @return elapsed nanoseconds
+ */
+long long bench_fork(char *line, long forks)
+{
+	struct node_t *tree = parse_line(line);
+	long long start;
+
+	start = now_ns();
+	for (long i = 0; i < forks; i++)
+		execute_node(tree);
+	start = now_ns() - start;
+	free_node(tree);
+	return start;
+}
+
+/**
+ * Looks a command name up in the builtin table, without running the builtin
+ * @return elapsed nanoseconds
+ */
+long long bench_dispatch(const char *name, long dispatches)
+{
+	//Read again on every lookup so that the lookup is not hoisted out of the loop
+	const char *volatile command = name;
+	long long start;
+	long found = 0;
+
+	find_builtin(name);
+	start = now_ns();
+	for (long i = 0; i < dispatches; i++)
+		found += find_builtin(command) != NULL;
+	start = now_ns() - start;
+	//Keeps the lookups from being optimized out
+	return found < 0 ? 0 : start;
+}
+
+//CPU time of the process in nanoseconds, a VM that does not get its whole CPU stretches wall time
+long long cpu_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/**
+ * Records spans with the internal tracer, enabled or not
+ * @param cpu set to the CPU time of the spans
+ * @return elapsed nanoseconds
+ */
+long long bench_trace(int enabled, long spans, long long *cpu)
+{
+	long long start;
+
+	if (enabled)
+		trace_start();
+	*cpu = cpu_ns();
+	start = now_ns();
+	for (long i = 0; i < spans; i++)
+		trace_end("bench", trace_begin());
+	start = now_ns() - start;
+	*cpu = cpu_ns() - *cpu;
+	trace_enabled = 0;
+	trace_clear();
+	return start;
+}
+
+/**
+ * Reads the clock of the tracer, an enabled span reads it twice so this is its floor
+ * @return elapsed nanoseconds
+ */
+long long bench_clock(long reads)
+{
+	long long start = now_ns(), sum = 0;
+
+	for (long i = 0; i < reads; i++)
+		sum += trace_clock();
+	start = now_ns() - start;
+	//Keeps the loop from being optimized out
+	return sum == 0 ? 0 : start;
+}
+
+/**
+ * Runs a recursive fileSearch over a generated tree
+ * @return elapsed nanoseconds
+ */
+long long bench_filesearch(int width, int depth, int files)
+{
+	char root[] = "/tmp/shellfyre_bench_XXXXXX";
+	long long start;
+	int saved;
+
+	if (mkdtemp(root) == NULL) {
+		fprintf(stderr, "shellfyre_bench: %s: %s, filesearch is skipped\n", root, strerror(errno));
+		return -1;
+	}
+	tree_entries = 0;
+	make_tree(root, width, depth, files);
+
+	saved = silence_stdout();
+	start = now_ns();
+	fileSearch("file_1", root, 1, 0);
+	start = now_ns() - start;
+	restore_stdout(saved);
+
+	remove_tree(root);
+	return start;
+}
+
+int main(int argc, char *argv[])
+{
+	long parse_lines = 1000000, forks = 1000, dispatches = 1000000;
+	int width = 4, depth = 4, files = 8;
+	char *output = NULL;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:f:b:w:d:F:o:")) != -1) {
+		switch (opt) {
+		case 'n': parse_lines = atol(optarg); break;
+		case 'f': forks = atol(optarg); break;
+		case 'b': dispatches = atol(optarg); break;
+		case 'w': width = atoi(optarg); break;
+		case 'd': depth = atoi(optarg); break;
+		case 'F': files = atoi(optarg); break;
+		case 'o': output = optarg; break;
+		default:
+			fprintf(stderr, "Usage: %s [-n parse_lines] [-f forks] [-b dispatches] [-w width] [-d depth] [-F files] [-o output.json]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (parse_lines < 1 || forks < 1 || dispatches < 1) {
+		fprintf(stderr, "shellfyre_bench: iteration counts must be positive\n");
+		return 1;
+	}
+
+	long bytes;
+	long long parse_ns = bench_parse(parse_lines, &bytes);
+	char external[] = "command true", internal[] = "true";
+	long long fork_ns = bench_fork(external, forks);
+	long long inprocess_ns = bench_fork(internal, forks);
+	//A name that is not in builtins[], true became a builtin
+	long long miss_ns = bench_dispatch("ls", dispatches);
+	long long hit_ns = bench_dispatch("cdh", dispatches);
+	long long search_ns = bench_filesearch(width, depth, files);
+	long long traced_cpu, untraced_cpu;
+	long long traced_ns = bench_trace(1, dispatches, &traced_cpu);
+	long long untraced_ns = bench_trace(0, dispatches, &untraced_cpu);
+	long long clock_ns = bench_clock(dispatches);
+
+	FILE *out = stdout;
+	if (output && (out = fopen(output, "w")) == NULL) {
+		fprintf(stderr, "shellfyre_bench: %s: %s\n", output, strerror(errno));
+		return 1;
+	}
+
+	fprintf(out, "{\n");
+	fprintf(out, "  \"parse_line\": {\"lines\": %ld, \"bytes\": %ld, \"ns_per_line\": %.1f, \"mb_per_s\": %.2f},\n",
+		parse_lines, bytes, (double)parse_ns / parse_lines, bytes / (parse_ns / 1e9) / 1e6);
+	fprintf(out, "  \"fork_exec\": {\"runs\": %ld, \"us_per_run\": %.2f, \"us_per_inprocess_run\": %.3f},\n",
+		forks, fork_ns / 1e3 / forks, inprocess_ns / 1e3 / forks);
+	fprintf(out, "  \"builtin_dispatch\": {\"runs\": %ld, \"ns_per_miss\": %.1f, \"ns_per_hit\": %.1f},\n",
+		dispatches, (double)miss_ns / dispatches, (double)hit_ns / dispatches);
+	fprintf(out, "  \"trace_span\": {\"spans\": %ld, \"ns_enabled\": %.1f, \"ns_disabled\": %.2f, \"ns_clock_read\": %.1f, \"cpu_ns_enabled\": %.1f},\n",
+		dispatches, (double)traced_ns / dispatches, (double)untraced_ns / dispatches, (double)clock_ns / dispatches,
+		(double)traced_cpu / dispatches);
+	//null when the tree could not be created, the reason went to stderr
+	if (search_ns < 0)
+		fprintf(out, "  \"filesearch\": null\n");
+	else
+		fprintf(out, "  \"filesearch\": {\"width\": %d, \"depth\": %d, \"files\": %d, \"entries\": %ld, \"ms\": %.3f, \"entries_per_s\": %.0f}\n",
+			width, depth, files, tree_entries, search_ns / 1e6, tree_entries / (search_ns / 1e9));
+	fprintf(out, "}\n");
+
+	if (out != stdout)
+		fclose(out);
+	return 0;
+}
@@ -0,0 +1,122 @@
+//Checks of shellfyre builtins
+//Compiled with gcc -pthread -o shellfyre_test shellfyre_test.c
+//Run with ./shellfyre_test, exits with 1 if a check fails
+
+#define SHELLFYRE_BENCH
+#include "shellfyre.c"
+
+int failures = 0;
+
+void check(int ok, const char *what)
+{
+	if (!ok) {
+		fprintf(stderr, "shellfyre_test: %s\n", what);
+		failures++;
+	}
+}
+
+/**
+ * Runs a builtin with the given lines on its stdin
+ * @param  input  lines the builtin reads
+ * @param  output what the builtin printed
+ * @return        exit status of the builtin
+ */
+int run_input(int (*builtin)(int, char **, struct io_t *), int argc, char **argv, const char *input, char *output, size_t size)
+{
+	FILE *in = tmpfile(), *out = tmpfile();
+	struct io_t io = { in, out, out };
+	int status;
+	size_t len;
+
+	fputs(input, in);
+	rewind(in);
+
+	status = builtin(argc, argv, &io);
+	rewind(out);
+	len = fread(output, 1, size - 1, out);
+	output[len] = '\0';
+	fclose(in);
+	fclose(out);
+	return status;
+}
+
+/**
+ * Runs parallel -k with a template and arguments given on stdin, one per line
+ * @param  template NULL terminated words
+ * @param  input    lines of arguments
+ * @param  output   what parallel printed
+ * @return          exit status of parallel
+ */
+int run_parallel(char **template, const char *input, char *output, size_t size)
+{
+	char *argv[16] = { "parallel", "-k" };
+	int argc = 2;
+
+	for (int i = 0; template[i]; i++)
+		argv[argc++] = template[i];
+	argv[argc] = NULL;
+	return run_input(builtin_parallel, argc, argv, input, output, size);
+}
+
+//An argument is one word of the command, the parser never sees it. Runs in an empty directory.
+void test_parallel_arguments()
+{
+	char output[4096];
+	char *echo[] = { "echo", NULL };
+	char *touch[] = { "touch", NULL };
+	char *redirect[] = { "echo", "{/}", ">", "{.}.out", NULL };
+
+	check(run_parallel(echo, "b;echo PWNED\nmy file.txt\na|b && c\n", output, sizeof(output)) == 0
+	      && strcmp(output, "b;echo PWNED\nmy file.txt\na|b && c\n") == 0,
+	      "parallel: ; | && or blanks in an argument changed the command");
+
+	check(run_parallel(touch, "my file.txt\nb;touch pwned\n", output, sizeof(output)) == 0, "parallel touch failed");
+	check(access("my file.txt", F_OK) == 0, "parallel: an argument with a blank was split");
+	check(access("b;touch pwned", F_OK) == 0 && access("pwned", F_OK) != 0,
+	      "parallel: an argument with ; ran a second command");
+
+	//The target of a redirect takes the argument as one word too
+	check(run_parallel(redirect, "x y.txt\n", output, sizeof(output)) == 0, "parallel with a redirect failed");
+	check(access("x y.out", F_OK) == 0, "parallel: {.} in a redirect target was split");
+}
+
+//Only the fields the program reads have to be numbers, text columns around them are skipped
+void test_expr_fields()
+{
+	char output[4096];
+	char *twice[] = { "math", "expr", "$2 * 2 + 1", NULL };
+	char *sum[] = { "math", "expr", "$1 + $3", NULL };
+
+	check(run_input(madmath_expr, 3, twice, "a 1,2\nGET 20 /index.html\n\n  \nb,-3\n", output, sizeof(output)) == 0
+	      && strcmp(output, "3\n41\n-5\n") == 0,
+	      "expr: a text field the program does not read was parsed");
+
+	check(run_input(madmath_expr, 3, sum, "1 x 2\n1 2 x\n4 y\n", output, sizeof(output)) == 1
+	      && strcmp(output, "3\nmath: expr: line 2: $3 is not a number\nmath: expr: line 3: $3 is missing\n") == 0,
+	      "expr: a read field that is missing or not a number was not reported");
+}
+
+int main()
+{
+	char dir[] = "/tmp/shellfyre_test_XXXXXX";
+	char command[64];
+
+	if (mkdtemp(dir) == NULL) {
+		fprintf(stderr, "shellfyre_test: %s: %s\n", dir, strerror(errno));
+		return 1;
+	}
+	if (chdir(dir) == -1) {
+		fprintf(stderr, "shellfyre_test: %s: %s\n", dir, strerror(errno));
+		return 1;
+	}
+	test_parallel_arguments();
+	test_expr_fields();
+	chdir("/");
+
+	snprintf(command, sizeof(command), "rm -rf %s", dir);
+	if (system(command) != 0)
+		fprintf(stderr, "shellfyre_test: could not remove %s\n", dir);
+	if (failures == 0)
+		printf("shellfyre_test: all checks passed\n");
+	return failures ? 1 : 0;
+}